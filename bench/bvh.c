@@ -0,0 +1,83 @@
+// compares bvh frustum culling with brute force culling on the demo scene
+// usage: bench_bvh [threads]
+
+#include <SDL.h>
+#include <cglm/cglm.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <inttypes.h>
+
+#include "../log.h"
+#include "../util.h"
+#include "../jobs.h"
+#include "../transform.h"
+#include "../bvh.h"
+#include "../scene.h"
+
+#define VIEWS 64
+
+static double ms(uint64_t ticks) {
+	return 1000.0 * ticks / SDL_GetPerformanceFrequency();
+}
+
+static void run(uint32_t objectCount, JobSystem *js) {
+	Scene s = {};
+	Mesh mesh = {0, 12, {{0.0f, 0.0f, 0.0f}, {0.8f, 0.9f, 0.7f}}, 0, {}};
+	sceneInitDemo(&s, objectCount, mesh);
+	BvhCuller c;
+	bvhCullerInit(&c, js);
+	uint32_t *out = calloc(objectCount, sizeof(uint32_t));
+	mustPtr(out, "benchmark output, len = %"PRIu32, objectCount);
+
+	uint64_t brute = 0, single = 0, multi = 0, update = 0;
+	uint64_t drawn = 0;
+	Frustum f;
+	for (uint32_t v = 0; v < VIEWS; v++) {
+		// orbit around the scene, looking at it from different directions
+		uint64_t t0 = SDL_GetPerformanceCounter();
+		sceneUpdate(&s, 1.0f / 60.0f);
+		uint64_t t1 = SDL_GetPerformanceCounter();
+		update += t1 - t0;
+		s.cam.yaw = 2.0f * GLM_PIf * v / VIEWS;
+		cameraUpdate(&s.cam, 16.0f / 9.0f);
+		frustumFromMatrix(&f, s.cam.viewProj);
+
+		t0 = SDL_GetPerformanceCounter();
+		uint32_t nb = bruteCullFrustum(s.bvh.boxes, objectCount, &f, out);
+		t1 = SDL_GetPerformanceCounter();
+		uint32_t ns = bvhCullFrustum(&s.bvh, &f, out);
+		uint64_t t2 = SDL_GetPerformanceCounter();
+		uint32_t nm = bvhCullerRun(&c, &s.bvh, &f, out);
+		uint64_t t3 = SDL_GetPerformanceCounter();
+		mustCondition(nb == ns && ns == nm, "culling results match (%"PRIu32", %"PRIu32", %"PRIu32")", nb, ns, nm);
+		brute += t1 - t0;
+		single += t2 - t1;
+		multi += t3 - t2;
+		drawn += nb;
+	}
+
+	printf("%8"PRIu32" objects: drawn %8.1f avg | brute %8.3f ms | bvh %8.3f ms | bvh x%"PRIu32" %8.3f ms | update+refit %8.3f ms | %"PRIu32" rebuilds\n",
+		objectCount, (double)drawn / VIEWS, ms(brute) / VIEWS, ms(single) / VIEWS,
+		js->slotCount, ms(multi) / VIEWS, ms(update) / VIEWS, s.bvh.rebuilds);
+
+	free(out);
+	bvhCullerDestroy(&c);
+	sceneDestroy(&s);
+}
+
+int main(int argc, char *argv[]) {
+	uint32_t threads = argc > 1 ? strtoul(argv[1], NULL, 10) : (uint32_t)SDL_GetCPUCount();
+	if (threads < 1)
+		threads = 1;
+	// the main thread is one of the threads
+	JobSystem js;
+	jobsInit(&js, threads - 1, 1);
+	jobsRegister(&js);
+	uint32_t counts[] = {1000, 10000, 100000, 1000000};
+	for (uint32_t i = 0; i < LENGTH(counts); i++)
+		run(counts[i], &js);
+	jobsDestroy(&js);
+	return 0;
+}
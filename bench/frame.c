@@ -0,0 +1,765 @@
+// micro-benchmarks of the code that runs every frame, printed as JSON
+// The lavapipe (cpu) device is used if there is one, so that the results
+// don't depend on the gpu and driver of the machine. Presentation uses a
+// headless surface and is skipped (null) without VK_EXT_headless_surface.
+// Each result is the median of REPEATS runs, in ns per operation. The
+// draw_*_spheres results wait for the gpu, so they measure the frame time of
+// the draws, the lit ones including the assignment of the lights to the
+// clusters.
+// usage: bench_frame > frame.json
+
+#include <SDL.h>
+#include <vulkan.h>
+#include <vk_mem_alloc.h>
+#include <cglm/cglm.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+
+#include "../log.h"
+#include "../util.h"
+#include "../frame.h"
+#include "../swapchain.h"
+#include "../bindless.h"
+#include "../shader.h"
+#include "../pipeline.h"
+#include "../jobs.h"
+#include "../transform.h"
+#include "../bvh.h"
+#include "../scene.h"
+#include "../lod.h"
+#include "../queue.h"
+#include "../lights.h"
+
+#define REPEATS 5
+#define WIDTH 256
+#define HEIGHT 256
+#define COLOR_FORMAT VK_FORMAT_R8G8B8A8_UNORM
+#define DEPTH_FORMAT VK_FORMAT_D32_SFLOAT
+#define DRAWS 1000 // per recorded command buffer
+#define FEATURES (PIPELINE_TEXTURED | PIPELINE_VERTEX_COLORS)
+#define LOD_SEGMENTS 128 // of the sphere drawn by benchLodDraw
+#define LOD_SIDE 10 // the spheres are drawn in a LOD_SIDE^2 grid
+#define LOD_THRESHOLD 1.0f // pixels
+#define LIGHTS_MAX 10000 // lit draws use up to this many clustered lights
+
+typedef struct Bench {
+	VkInstance instance;
+	VkPhysicalDevice vpd;
+	VkPhysicalDeviceProperties props;
+	VkDevice dev;
+	uint32_t qfi;
+	VkQueue queue;
+	VmaAllocator vma;
+	VkSurfaceKHR surface; // VK_NULL_HANDLE if presentation isn't measured
+	Bindless bindless;
+	VkPipelineLayout plly;
+	VkPipeline pl;
+	Frames frames;
+	// offscreen target of the recorded draws
+	VkImage color, depth;
+	VmaAllocation colorAlloc, depthAlloc;
+	VkImageView colorView, depthView;
+	VkBuffer vb, ib;
+	VmaAllocation vba, iba;
+	// a sphere with levels of detail, drawn with world matrices from
+	// lodObjects by the untextured pipeline
+	Mesh lodMesh;
+	VkPipeline flatPl;
+	VkBuffer lodVb, lodIb, lodObjects;
+	VmaAllocation lodVba, lodIba, lodObjectsAlloc;
+	mat4 *lodWorld; // mapped
+	uint32_t lodObjectsIndex;
+	// the spheres lit by clustered lights around them
+	VkPipeline litPl;
+	Lights lights;
+} Bench;
+
+// returns the ticks taken by n operations
+typedef uint64_t (*BenchFunc)(Bench *b, uint32_t n);
+
+static char hasInstanceExtension(const char *name) {
+	uint32_t n;
+	must(vkEnumerateInstanceExtensionProperties(NULL, &n, NULL));
+	VkExtensionProperties *eps = calloc(n, sizeof(VkExtensionProperties));
+	mustPtr(eps, "instance extensions array, len = %"PRIu32, n);
+	must(vkEnumerateInstanceExtensionProperties(NULL, &n, eps));
+	char found = 0;
+	for (uint32_t i = 0; i < n; i++)
+		if (strcmp(eps[i].extensionName, name) == 0)
+			found = 1;
+	free(eps);
+	return found;
+}
+
+static void benchInit(Bench *b) {
+	// mesa's shader cache would make every pipeline creation warm
+	setenv("MESA_SHADER_CACHE_DISABLE", "true", 0);
+
+	char headless = hasInstanceExtension(VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME);
+	const char *iextensions[] = {VK_KHR_SURFACE_EXTENSION_NAME, VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME};
+	VkApplicationInfo ai = {};
+	ai.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+	ai.apiVersion = VK_API_VERSION_1_3;
+	VkInstanceCreateInfo ii = {};
+	ii.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+	ii.pApplicationInfo = &ai;
+	ii.enabledExtensionCount = headless ? LENGTH(iextensions) : 0;
+	ii.ppEnabledExtensionNames = iextensions;
+	must(vkCreateInstance(&ii, NULL, &b->instance));
+
+	// prefer lavapipe
+	uint32_t n;
+	must(vkEnumeratePhysicalDevices(b->instance, &n, NULL));
+	mustCondition(n > 0, "a vulkan device is available");
+	VkPhysicalDevice *pdevs = calloc(n, sizeof(VkPhysicalDevice));
+	mustPtr(pdevs, "physical devices array, len = %"PRIu32, n);
+	must(vkEnumeratePhysicalDevices(b->instance, &n, pdevs));
+	b->vpd = pdevs[0];
+	for (uint32_t i = 0; i < n; i++) {
+		VkPhysicalDeviceProperties p;
+		vkGetPhysicalDeviceProperties(pdevs[i], &p);
+		if (p.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU) {
+			b->vpd = pdevs[i];
+			break;
+		}
+	}
+	free(pdevs);
+	vkGetPhysicalDeviceProperties(b->vpd, &b->props);
+
+	uint32_t qfc;
+	vkGetPhysicalDeviceQueueFamilyProperties(b->vpd, &qfc, NULL);
+	VkQueueFamilyProperties *qfp = calloc(qfc, sizeof(VkQueueFamilyProperties));
+	mustPtr(qfp, "queue family properties array, len = %"PRIu32, qfc);
+	vkGetPhysicalDeviceQueueFamilyProperties(b->vpd, &qfc, qfp);
+	b->qfi = qfc;
+	for (uint32_t i = 0; i < qfc && b->qfi == qfc; i++)
+		if (qfp[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+			b->qfi = i;
+	free(qfp);
+	mustCondition(b->qfi < qfc, "a queue family supports graphics");
+
+	b->surface = VK_NULL_HANDLE;
+	if (headless) {
+		PFN_vkCreateHeadlessSurfaceEXT createHeadlessSurface =
+			(PFN_vkCreateHeadlessSurfaceEXT)vkGetInstanceProcAddr(b->instance, "vkCreateHeadlessSurfaceEXT");
+		VkHeadlessSurfaceCreateInfoEXT hsci = {};
+		hsci.sType = VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT;
+		must(createHeadlessSurface(b->instance, &hsci, NULL, &b->surface));
+		VkBool32 supported = VK_FALSE;
+		must(vkGetPhysicalDeviceSurfaceSupportKHR(b->vpd, b->qfi, b->surface, &supported));
+		if (!supported) {
+			vkDestroySurfaceKHR(b->instance, b->surface, NULL);
+			b->surface = VK_NULL_HANDLE;
+		}
+	}
+
+	// the same features as the renderer
+	VkPhysicalDeviceDescriptorIndexingFeatures dif = {};
+	mustCondition(bindlessFeatures(b->vpd, &dif), "the device supports descriptor indexing");
+	VkPhysicalDeviceTimelineSemaphoreFeatures tsf = {};
+	tsf.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+	tsf.pNext = &dif;
+	tsf.timelineSemaphore = VK_TRUE;
+	VkPhysicalDeviceSynchronization2Features s2f = {};
+	s2f.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES;
+	s2f.pNext = &tsf;
+	s2f.synchronization2 = VK_TRUE;
+	VkPhysicalDeviceDynamicRenderingFeatures drf = {};
+	drf.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+	drf.pNext = &s2f;
+	drf.dynamicRendering = VK_TRUE;
+	const char *dextensions[] = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+	VkDeviceCreateInfo di = {};
+	di.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	di.pNext = &drf;
+	di.queueCreateInfoCount = 1;
+	di.pQueueCreateInfos = &(VkDeviceQueueCreateInfo){
+		.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+		.queueFamilyIndex = b->qfi,
+		.queueCount = 1,
+		.pQueuePriorities = (float[]){1.0f},
+	};
+	di.enabledExtensionCount = b->surface != VK_NULL_HANDLE ? LENGTH(dextensions) : 0;
+	di.ppEnabledExtensionNames = dextensions;
+	must(vkCreateDevice(b->vpd, &di, NULL, &b->dev));
+	vkGetDeviceQueue(b->dev, b->qfi, 0, &b->queue);
+
+	VmaAllocatorCreateInfo aci = {};
+	aci.physicalDevice = b->vpd;
+	aci.device = b->dev;
+	aci.instance = b->instance;
+	aci.vulkanApiVersion = ai.apiVersion;
+	must(vmaCreateAllocator(&aci, &b->vma));
+
+	bindlessInit(&b->bindless, b->dev, b->vpd, 2);
+	b->plly = pipelineLayoutCreate(b->dev, &b->bindless);
+	b->pl = pipelineCreateScene(b->dev, VK_NULL_HANDLE, b->plly, COLOR_FORMAT, DEPTH_FORMAT, FEATURES);
+	b->frames.count = 2;
+	framesInit(&b->frames, b->dev, b->qfi);
+
+	VkImageCreateInfo ici = {};
+	ici.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	ici.imageType = VK_IMAGE_TYPE_2D;
+	ici.extent = (VkExtent3D){WIDTH, HEIGHT, 1};
+	ici.mipLevels = 1;
+	ici.arrayLayers = 1;
+	ici.samples = VK_SAMPLE_COUNT_1_BIT;
+	ici.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	ici.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	VmaAllocationCreateInfo iaci = {};
+	iaci.usage = VMA_MEMORY_USAGE_AUTO;
+	VkImageViewCreateInfo ivci = {};
+	ivci.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	ivci.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	ivci.subresourceRange = (VkImageSubresourceRange){VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+	ici.format = COLOR_FORMAT;
+	ici.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	must(vmaCreateImage(b->vma, &ici, &iaci, &b->color, &b->colorAlloc, NULL));
+	ivci.image = b->color;
+	ivci.format = COLOR_FORMAT;
+	must(vkCreateImageView(b->dev, &ivci, NULL, &b->colorView));
+	ici.format = DEPTH_FORMAT;
+	ici.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	must(vmaCreateImage(b->vma, &ici, &iaci, &b->depth, &b->depthAlloc, NULL));
+	ivci.image = b->depth;
+	ivci.format = DEPTH_FORMAT;
+	ivci.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+	must(vkCreateImageView(b->dev, &ivci, NULL, &b->depthView));
+
+	VkBufferCreateInfo bci = {};
+	bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bci.size = 3 * sizeof(vec3);
+	bci.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VmaAllocationCreateInfo baci = {};
+	baci.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+	baci.usage = VMA_MEMORY_USAGE_AUTO;
+	must(vmaCreateBuffer(b->vma, &bci, &baci, &b->vb, &b->vba, NULL));
+	bci.size = 3 * sizeof(uint32_t);
+	bci.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+	must(vmaCreateBuffer(b->vma, &bci, &baci, &b->ib, &b->iba, NULL));
+}
+
+static void benchInitLod(Bench *b) {
+	vec3 *positions;
+	uint32_t *indices, vertexCount, indexCount;
+	sceneGenerateSphere(LOD_SEGMENTS, GLM_VEC3_ZERO, 0.5f, &positions, &vertexCount, &indices, &indexCount);
+	b->lodMesh = (Mesh){0, indexCount, {{-0.54f, -0.54f, -0.54f}, {0.54f, 0.54f, 0.54f}}, 0, {}};
+	lodBuildChain(&b->lodMesh, positions, vertexCount, &indices, &indexCount);
+	b->flatPl = pipelineCreateScene(b->dev, VK_NULL_HANDLE, b->plly, COLOR_FORMAT, DEPTH_FORMAT, 0);
+
+	VkBufferCreateInfo bci = {};
+	bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VmaAllocationCreateInfo baci = {};
+	baci.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+	baci.usage = VMA_MEMORY_USAGE_AUTO;
+	VmaAllocationInfo ai;
+	bci.size = vertexCount * sizeof(vec3);
+	bci.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	must(vmaCreateBuffer(b->vma, &bci, &baci, &b->lodVb, &b->lodVba, &ai));
+	memcpy(ai.pMappedData, positions, bci.size);
+	bci.size = indexCount * sizeof(uint32_t);
+	bci.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+	must(vmaCreateBuffer(b->vma, &bci, &baci, &b->lodIb, &b->lodIba, &ai));
+	memcpy(ai.pMappedData, indices, bci.size);
+	bci.size = LOD_SIDE * LOD_SIDE * sizeof(mat4);
+	bci.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	must(vmaCreateBuffer(b->vma, &bci, &baci, &b->lodObjects, &b->lodObjectsAlloc, &ai));
+	b->lodWorld = ai.pMappedData;
+	b->lodObjectsIndex = bindlessAddBuffer(&b->bindless, b->lodObjects, 0, VK_WHOLE_SIZE);
+	free(positions);
+	free(indices);
+
+	// around the grid of spheres drawn at distance 4
+	b->litPl = pipelineCreateScene(b->dev, VK_NULL_HANDLE, b->plly, COLOR_FORMAT, DEPTH_FORMAT, PIPELINE_CLUSTERED);
+	Aabb area = {{-0.5f * LOD_SIDE - 1.0f, -0.5f * LOD_SIDE - 1.0f, -5.0f}, {0.5f * LOD_SIDE + 1.0f, 0.5f * LOD_SIDE + 1.0f, -3.0f}};
+	lightsInit(&b->lights, b->dev, b->vma, &b->bindless, b->frames.count, LIGHTS_MAX, &area);
+}
+
+static void benchDestroy(Bench *b) {
+	must(vkDeviceWaitIdle(b->dev));
+	lightsDestroy(&b->lights, 0);
+	vkDestroyPipeline(b->dev, b->litPl, NULL);
+	vmaDestroyBuffer(b->vma, b->lodVb, b->lodVba);
+	vmaDestroyBuffer(b->vma, b->lodIb, b->lodIba);
+	vmaDestroyBuffer(b->vma, b->lodObjects, b->lodObjectsAlloc);
+	vkDestroyPipeline(b->dev, b->flatPl, NULL);
+	vmaDestroyBuffer(b->vma, b->vb, b->vba);
+	vmaDestroyBuffer(b->vma, b->ib, b->iba);
+	vkDestroyImageView(b->dev, b->colorView, NULL);
+	vkDestroyImageView(b->dev, b->depthView, NULL);
+	vmaDestroyImage(b->vma, b->color, b->colorAlloc);
+	vmaDestroyImage(b->vma, b->depth, b->depthAlloc);
+	framesDestroy(&b->frames, b->dev);
+	vkDestroyPipeline(b->dev, b->pl, NULL);
+	vkDestroyPipelineLayout(b->dev, b->plly, NULL);
+	bindlessDestroy(&b->bindless);
+	vmaDestroyAllocator(b->vma);
+	vkDestroyDevice(b->dev, NULL);
+	if (b->surface != VK_NULL_HANDLE)
+		vkDestroySurfaceKHR(b->instance, b->surface, NULL);
+	vkDestroyInstance(b->instance, NULL);
+}
+
+static void imageBarrier(VkCommandBuffer cmd, VkImage img, VkImageAspectFlags aspect, VkImageLayout from, VkImageLayout to,
+		VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess) {
+	VkImageMemoryBarrier2 imb = {};
+	imb.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+	imb.srcStageMask = srcStage;
+	imb.srcAccessMask = srcAccess;
+	imb.dstStageMask = dstStage;
+	imb.dstAccessMask = dstAccess;
+	imb.oldLayout = from;
+	imb.newLayout = to;
+	imb.image = img;
+	imb.subresourceRange = (VkImageSubresourceRange){aspect, 0, 1, 0, 1};
+	VkDependencyInfo di = {};
+	di.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+	di.imageMemoryBarrierCount = 1;
+	di.pImageMemoryBarriers = &imb;
+	vkCmdPipelineBarrier2(cmd, &di);
+}
+
+static void beginCommandBuffer(VkCommandBuffer cmd) {
+	VkCommandBufferBeginInfo cmdbbi = {};
+	cmdbbi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	cmdbbi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	must(vkBeginCommandBuffer(cmd, &cmdbbi));
+}
+
+static uint64_t benchSems(Bench *b, uint32_t n) {
+	SwapchainSems s;
+	swapchainSemsInit(&s, b->dev, 3);
+	uint64_t start = SDL_GetPerformanceCounter();
+	for (uint32_t i = 0; i < n; i++) {
+		uint32_t sem = swapchainSemsReserve(&s);
+		swapchainsSemsAssociate(&s, sem, i % 3);
+	}
+	uint64_t ticks = SDL_GetPerformanceCounter() - start;
+	swapchainSemsDestroy(&s, b->dev);
+	return ticks;
+}
+
+static uint64_t benchFramesNext(Bench *b, uint32_t n) {
+	uint64_t start = SDL_GetPerformanceCounter();
+	for (uint32_t i = 0; i < n; i++)
+		framesNext(&b->frames);
+	return SDL_GetPerformanceCounter() - start;
+}
+
+static uint64_t benchBeginEnd(Bench *b, uint32_t n) {
+	VkCommandBuffer cmd = b->frames.frames[0].cmdbuf;
+	uint64_t start = SDL_GetPerformanceCounter();
+	for (uint32_t i = 0; i < n; i++) {
+		beginCommandBuffer(cmd);
+		must(vkEndCommandBuffer(cmd));
+	}
+	return SDL_GetPerformanceCounter() - start;
+}
+
+// records a frame like the renderer does, with DRAWS draws
+static uint64_t benchRecord(Bench *b, uint32_t n) {
+	VkCommandBuffer cmd = b->frames.frames[0].cmdbuf;
+	VkRenderingAttachmentInfo ati = {};
+	ati.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+	ati.imageView = b->colorView;
+	ati.imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
+	ati.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	ati.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	VkRenderingAttachmentInfo dti = {};
+	dti.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+	dti.imageView = b->depthView;
+	dti.imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
+	dti.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	dti.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	dti.clearValue.depthStencil.depth = 1.0f;
+	VkRenderingInfo ri = {};
+	ri.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+	ri.renderArea.extent = (VkExtent2D){WIDTH, HEIGHT};
+	ri.layerCount = 1;
+	ri.colorAttachmentCount = 1;
+	ri.pColorAttachments = &ati;
+	ri.pDepthAttachment = &dti;
+	PushConstants pc = {};
+	glm_mat4_identity(pc.viewProj);
+	VkShaderStageFlags pushStages = pipelinePushConstantStages();
+
+	uint64_t start = SDL_GetPerformanceCounter();
+	for (uint32_t i = 0; i < n; i++) {
+		beginCommandBuffer(cmd);
+		imageBarrier(cmd, b->color, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
+			VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+			VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT);
+		vkCmdBeginRendering(cmd, &ri);
+		vkCmdSetViewport(cmd, 0, 1, &(VkViewport){0, 0, WIDTH, HEIGHT, 0, 1});
+		vkCmdSetScissor(cmd, 0, 1, &ri.renderArea);
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, b->pl);
+		vkCmdBindVertexBuffers(cmd, 0, 1, &b->vb, (VkDeviceSize[]){0});
+		vkCmdBindIndexBuffer(cmd, b->ib, 0, VK_INDEX_TYPE_UINT32);
+		bindlessBind(&b->bindless, cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, b->plly);
+		vkCmdPushConstants(cmd, b->plly, pushStages, 0, sizeof(pc), &pc);
+		for (uint32_t d = 0; d < DRAWS; d++)
+			vkCmdDrawIndexed(cmd, 3, 1, 0, 0, d);
+		vkCmdEndRendering(cmd);
+		must(vkEndCommandBuffer(cmd));
+	}
+	return SDL_GetPerformanceCounter() - start;
+}
+
+// Draws the spheres at the distance with the level of detail chosen for it
+// (the full mesh if threshold is 0) and waits for the gpu, per operation.
+// The grid of spheres faces the camera, one unit apart. If lights isn't 0,
+// that many clustered lights are assigned and the spheres are lit by them.
+static uint64_t benchLodDraw(Bench *b, uint32_t n, float distance, float threshold, uint32_t lights) {
+	for (uint32_t i = 0; i < LOD_SIDE * LOD_SIDE; i++) {
+		vec3 pos = {(float)(i % LOD_SIDE) - 0.5f * (LOD_SIDE - 1), (float)(i / LOD_SIDE) - 0.5f * (LOD_SIDE - 1), -distance};
+		glm_translate_make(b->lodWorld[i], pos);
+	}
+	float ppu = HEIGHT / (2.0f * distance * tanf(glm_rad(30.0f)));
+	const MeshLod *l = &b->lodMesh.lods[lodSelect(&b->lodMesh, 0, ppu, threshold)];
+
+	VkRenderingAttachmentInfo ati = {};
+	ati.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+	ati.imageView = b->colorView;
+	ati.imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
+	ati.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	ati.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	VkRenderingAttachmentInfo dti = {};
+	dti.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+	dti.imageView = b->depthView;
+	dti.imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
+	dti.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	dti.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	dti.clearValue.depthStencil.depth = 1.0f;
+	VkRenderingInfo ri = {};
+	ri.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+	ri.renderArea.extent = (VkExtent2D){WIDTH, HEIGHT};
+	ri.layerCount = 1;
+	ri.colorAttachmentCount = 1;
+	ri.pColorAttachments = &ati;
+	ri.pDepthAttachment = &dti;
+	Camera cam = {};
+	cam.near = 0.1f;
+	cam.far = 1000.0f;
+	glm_mat4_identity(cam.view);
+	glm_perspective(glm_rad(60.0f), (float)WIDTH / HEIGHT, cam.near, cam.far, cam.proj);
+	cam.proj[1][1] *= -1.0f;
+	PushConstants pc = {};
+	glm_mat4_copy(cam.proj, pc.viewProj);
+	pc.objects = b->lodObjectsIndex;
+	VkShaderStageFlags pushStages = pipelinePushConstantStages();
+	b->lights.count = lights;
+
+	uint64_t start = SDL_GetPerformanceCounter();
+	for (uint32_t i = 0; i < n; i++) {
+		Frame *frame = framesNext(&b->frames);
+		must(vkWaitForFences(b->dev, 1, &frame->ready, VK_TRUE, UINT64_MAX));
+		must(vkResetFences(b->dev, 1, &frame->ready));
+		VkCommandBuffer cmd = frame->cmdbuf;
+		beginCommandBuffer(cmd);
+		if (lights > 0) {
+			lightsUpdate(&b->lights, b->frames.current, i / 60.0f, &cam, (VkExtent2D){WIDTH, HEIGHT});
+			lightsAssign(&b->lights, cmd, b->frames.current);
+			pc.lights = lightsIndex(&b->lights, b->frames.current);
+			pc.clusters = lightsClustersIndex(&b->lights, b->frames.current);
+		}
+		// the previous frame drew to the same images
+		imageBarrier(cmd, b->color, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
+			VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+			VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT);
+		imageBarrier(cmd, b->depth, VK_IMAGE_ASPECT_DEPTH_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
+			VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+			VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+		vkCmdBeginRendering(cmd, &ri);
+		vkCmdSetViewport(cmd, 0, 1, &(VkViewport){0, 0, WIDTH, HEIGHT, 0, 1});
+		vkCmdSetScissor(cmd, 0, 1, &ri.renderArea);
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, lights > 0 ? b->litPl : b->flatPl);
+		vkCmdBindVertexBuffers(cmd, 0, 1, &b->lodVb, (VkDeviceSize[]){0});
+		vkCmdBindIndexBuffer(cmd, b->lodIb, 0, VK_INDEX_TYPE_UINT32);
+		bindlessBind(&b->bindless, cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, b->plly);
+		vkCmdPushConstants(cmd, b->plly, pushStages, 0, sizeof(pc), &pc);
+		for (uint32_t d = 0; d < LOD_SIDE * LOD_SIDE; d++)
+			vkCmdDrawIndexed(cmd, l->indexCount, 1, l->firstIndex, 0, d);
+		vkCmdEndRendering(cmd);
+		must(vkEndCommandBuffer(cmd));
+
+		VkSubmitInfo2 si = {};
+		si.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+		si.commandBufferInfoCount = 1;
+		si.pCommandBufferInfos = &(VkCommandBufferSubmitInfo){
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+			.commandBuffer = cmd,
+		};
+		must(vkQueueSubmit2(b->queue, 1, &si, frame->ready));
+		// one frame at a time, so each operation is the latency of a frame
+		must(vkWaitForFences(b->dev, 1, &frame->ready, VK_TRUE, UINT64_MAX));
+	}
+	return SDL_GetPerformanceCounter() - start;
+}
+
+static uint64_t benchLodFull(Bench *b, uint32_t n) {
+	return benchLodDraw(b, n, 4.0f, 0.0f, 0);
+}
+
+static uint64_t benchLod4(Bench *b, uint32_t n) {
+	return benchLodDraw(b, n, 4.0f, LOD_THRESHOLD, 0);
+}
+
+static uint64_t benchLod16(Bench *b, uint32_t n) {
+	return benchLodDraw(b, n, 16.0f, LOD_THRESHOLD, 0);
+}
+
+static uint64_t benchLod64(Bench *b, uint32_t n) {
+	return benchLodDraw(b, n, 64.0f, LOD_THRESHOLD, 0);
+}
+
+static uint64_t benchLit10(Bench *b, uint32_t n) {
+	return benchLodDraw(b, n, 4.0f, LOD_THRESHOLD, 10);
+}
+
+static uint64_t benchLit100(Bench *b, uint32_t n) {
+	return benchLodDraw(b, n, 4.0f, LOD_THRESHOLD, 100);
+}
+
+static uint64_t benchLit1000(Bench *b, uint32_t n) {
+	return benchLodDraw(b, n, 4.0f, LOD_THRESHOLD, 1000);
+}
+
+static uint64_t benchLit10000(Bench *b, uint32_t n) {
+	return benchLodDraw(b, n, 4.0f, LOD_THRESHOLD, LIGHTS_MAX);
+}
+
+// fills and sorts a render queue of DRAWS draws at random depths
+static uint64_t benchQueueSort(Bench *b, uint32_t n) {
+	(void)b;
+	RenderQueue q;
+	queueInit(&q, DRAWS);
+	srand(1);
+	uint64_t start = SDL_GetPerformanceCounter();
+	for (uint32_t i = 0; i < n; i++) {
+		queueClear(&q);
+		for (uint32_t d = 0; d < DRAWS; d++)
+			queuePush(&q, queueKey(0, d % 2, d % 4, 1.0f + rand() % 1000, d % 8), (QueueDraw){3, 0, d});
+		queueSort(&q);
+	}
+	uint64_t ticks = SDL_GetPerformanceCounter() - start;
+	queueDestroy(&q);
+	return ticks;
+}
+
+static uint64_t benchBufferCreate(Bench *b, uint32_t n) {
+	VkBufferCreateInfo bci = {};
+	bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bci.size = 64 << 10;
+	bci.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VmaAllocationCreateInfo aci = {};
+	aci.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+	aci.usage = VMA_MEMORY_USAGE_AUTO;
+	uint64_t start = SDL_GetPerformanceCounter();
+	for (uint32_t i = 0; i < n; i++) {
+		VkBuffer buf;
+		VmaAllocation alloc;
+		must(vmaCreateBuffer(b->vma, &bci, &aci, &buf, &alloc, NULL));
+		vmaDestroyBuffer(b->vma, buf, alloc);
+	}
+	return SDL_GetPerformanceCounter() - start;
+}
+
+static uint64_t benchMap(Bench *b, uint32_t n) {
+	uint64_t start = SDL_GetPerformanceCounter();
+	for (uint32_t i = 0; i < n; i++) {
+		void *data;
+		must(vmaMapMemory(b->vma, b->vba, &data));
+		vmaUnmapMemory(b->vma, b->vba);
+	}
+	return SDL_GetPerformanceCounter() - start;
+}
+
+static uint64_t benchPipelineCold(Bench *b, uint32_t n) {
+	uint64_t start = SDL_GetPerformanceCounter();
+	for (uint32_t i = 0; i < n; i++) {
+		VkPipelineCache cache;
+		must(vkCreatePipelineCache(b->dev, &(VkPipelineCacheCreateInfo){
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+		}, NULL, &cache));
+		VkPipeline pl = pipelineCreateScene(b->dev, cache, b->plly, COLOR_FORMAT, DEPTH_FORMAT, FEATURES);
+		vkDestroyPipeline(b->dev, pl, NULL);
+		vkDestroyPipelineCache(b->dev, cache, NULL);
+	}
+	return SDL_GetPerformanceCounter() - start;
+}
+
+static uint64_t benchPipelineWarm(Bench *b, uint32_t n) {
+	VkPipelineCache cache;
+	must(vkCreatePipelineCache(b->dev, &(VkPipelineCacheCreateInfo){
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+	}, NULL, &cache));
+	vkDestroyPipeline(b->dev, pipelineCreateScene(b->dev, cache, b->plly, COLOR_FORMAT, DEPTH_FORMAT, FEATURES), NULL);
+	uint64_t start = SDL_GetPerformanceCounter();
+	for (uint32_t i = 0; i < n; i++) {
+		VkPipeline pl = pipelineCreateScene(b->dev, cache, b->plly, COLOR_FORMAT, DEPTH_FORMAT, FEATURES);
+		vkDestroyPipeline(b->dev, pl, NULL);
+	}
+	uint64_t ticks = SDL_GetPerformanceCounter() - start;
+	vkDestroyPipelineCache(b->dev, cache, NULL);
+	return ticks;
+}
+
+// acquire, record a clear, submit and present, with two frames in flight
+static uint64_t benchPresent(Bench *b, uint32_t n) {
+	Swapchain sc = {};
+	VkSurfaceFormatKHR fmt = swapchainGetFormat(b->vpd, b->surface);
+	swapchainConfigure(&sc, b->vpd, b->surface, 3, (VkExtent2D){WIDTH, HEIGHT});
+	swapchainInit(&sc, b->dev, b->surface, fmt);
+	VkRenderingAttachmentInfo ati = {};
+	ati.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+	ati.imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
+	ati.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	ati.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	VkRenderingInfo ri = {};
+	ri.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+	ri.renderArea.extent = sc.extent;
+	ri.layerCount = 1;
+	ri.colorAttachmentCount = 1;
+	ri.pColorAttachments = &ati;
+
+	uint64_t start = SDL_GetPerformanceCounter();
+	for (uint32_t i = 0; i < n; i++) {
+		Frame *frame = framesNext(&b->frames);
+		must(vkWaitForFences(b->dev, 1, &frame->ready, VK_TRUE, UINT64_MAX));
+		must(vkResetFences(b->dev, 1, &frame->ready));
+		uint32_t sem = swapchainSemsReserve(&sc.drawReady);
+		uint32_t img;
+		must(vkAcquireNextImageKHR(b->dev, sc.chain, UINT64_MAX, sc.drawReady.sem[sem], VK_NULL_HANDLE, &img));
+		swapchainsSemsAssociate(&sc.drawReady, sem, img);
+
+		VkCommandBuffer cmd = frame->cmdbuf;
+		beginCommandBuffer(cmd);
+		imageBarrier(cmd, sc.img[img], VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
+			VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_NONE,
+			VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT);
+		ati.imageView = sc.imgv[img];
+		vkCmdBeginRendering(cmd, &ri);
+		vkCmdEndRendering(cmd);
+		imageBarrier(cmd, sc.img[img], VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+			VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+			VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE);
+		must(vkEndCommandBuffer(cmd));
+
+		VkSubmitInfo2 si = {};
+		si.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+		si.waitSemaphoreInfoCount = 1;
+		si.pWaitSemaphoreInfos = &(VkSemaphoreSubmitInfo){
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+			.semaphore = sc.drawReady.sem[sem],
+			.stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+		};
+		si.commandBufferInfoCount = 1;
+		si.pCommandBufferInfos = &(VkCommandBufferSubmitInfo){
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+			.commandBuffer = cmd,
+		};
+		si.signalSemaphoreInfoCount = 1;
+		si.pSignalSemaphoreInfos = &(VkSemaphoreSubmitInfo){
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+			.semaphore = sc.presReady[img],
+			.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+		};
+		must(vkQueueSubmit2(b->queue, 1, &si, frame->ready));
+
+		VkPresentInfoKHR pi = {};
+		pi.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		pi.waitSemaphoreCount = 1;
+		pi.pWaitSemaphores = &sc.presReady[img];
+		pi.swapchainCount = 1;
+		pi.pSwapchains = &sc.chain;
+		pi.pImageIndices = &img;
+		must(vkQueuePresentKHR(b->queue, &pi));
+	}
+	must(vkDeviceWaitIdle(b->dev));
+	uint64_t ticks = SDL_GetPerformanceCounter() - start;
+	swapchainDestroy(&sc, b->dev);
+	return ticks;
+}
+
+static int compareTicks(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+// prints s as a json string
+static void printJsonString(const char *s) {
+	putchar('"');
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			putchar('\\');
+		if ((unsigned char)*s < 0x20)
+			printf("\\u%04x", *s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+// prints one result, fn == NULL prints a skipped benchmark
+static void run(Bench *b, const char *name, BenchFunc fn, uint32_t n, char last) {
+	printf("\t\t{\"name\": \"%s\", \"iterations\": %"PRIu32", \"ns_per_op\": ", name, n);
+	if (fn == NULL) {
+		printf("null");
+	} else {
+		uint64_t ticks[REPEATS];
+		for (uint32_t i = 0; i < REPEATS; i++) {
+			// the frames' fences and command buffers must be idle for the next run
+			must(vkDeviceWaitIdle(b->dev));
+			ticks[i] = fn(b, n);
+		}
+		qsort(ticks, REPEATS, sizeof(uint64_t), compareTicks);
+		printf("%.1f", 1e9 * ticks[REPEATS / 2] / SDL_GetPerformanceFrequency() / n);
+	}
+	printf("}%s\n", last ? "" : ",");
+	fflush(stdout);
+}
+
+int main(void) {
+	// stdout is for the results only
+	logSetLevel(LOG_ERROR);
+	Bench b = {};
+	benchInit(&b);
+	benchInitLod(&b);
+
+	printf("{\n");
+	printf("\t\"device\": ");
+	printJsonString(b.props.deviceName);
+	printf(",\n");
+	printf("\t\"repeats\": %d,\n", REPEATS);
+	printf("\t\"results\": [\n");
+	run(&b, "swapchain_sems_reserve_associate", benchSems, 1000000, 0);
+	run(&b, "frames_next", benchFramesNext, 10000000, 0);
+	run(&b, "cmdbuf_begin_end", benchBeginEnd, 10000, 0);
+	run(&b, "cmdbuf_record_1000_draws", benchRecord, 200, 0);
+	run(&b, "render_queue_fill_sort_1000", benchQueueSort, 10000, 0);
+	run(&b, "draw_100_spheres_full_detail", benchLodFull, 20, 0);
+	run(&b, "draw_100_spheres_lod_distance_4", benchLod4, 20, 0);
+	run(&b, "draw_100_spheres_lod_distance_16", benchLod16, 20, 0);
+	run(&b, "draw_100_spheres_lod_distance_64", benchLod64, 20, 0);
+	run(&b, "draw_100_spheres_lit_10_lights", benchLit10, 20, 0);
+	run(&b, "draw_100_spheres_lit_100_lights", benchLit100, 20, 0);
+	run(&b, "draw_100_spheres_lit_1000_lights", benchLit1000, 20, 0);
+	run(&b, "draw_100_spheres_lit_10000_lights", benchLit10000, 20, 0);
+	run(&b, "vma_buffer_create_destroy_64k", benchBufferCreate, 10000, 0);
+	run(&b, "vma_map_unmap", benchMap, 100000, 0);
+	run(&b, "pipeline_create_cold", benchPipelineCold, 10, 0);
+	run(&b, "pipeline_create_warm", benchPipelineWarm, 50, 0);
+	run(&b, "submit_present_round_trip", b.surface != VK_NULL_HANDLE ? benchPresent : NULL, 200, 1);
+	printf("\t]\n");
+	printf("}\n");
+
+	benchDestroy(&b);
+	return 0;
+}
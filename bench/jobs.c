@@ -0,0 +1,110 @@
+// measures how the frame loop of the renderer scales with the number of
+// threads: the scene update and culling of the next frame run as a job while
+// the main thread walks the visible objects of the current one, standing in
+// for command buffer recording
+// usage: bench_jobs [max threads]
+
+#include <SDL.h>
+#include <cglm/cglm.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <inttypes.h>
+
+#include "../log.h"
+#include "../util.h"
+#include "../jobs.h"
+#include "../transform.h"
+#include "../bvh.h"
+#include "../scene.h"
+
+#define OBJECTS 200000
+#define FRAMES 64
+
+typedef struct Frame {
+	Scene *scene;
+	BvhCuller *culler;
+	uint32_t frame;
+	uint32_t *visible;
+	uint32_t visibleCount;
+} Frame;
+
+static void simulate(void *arg) {
+	Frame *f = arg;
+	sceneUpdate(f->scene, 1.0f / 60.0f);
+	f->scene->cam.yaw = 2.0f * GLM_PIf * f->frame / FRAMES;
+	cameraUpdate(&f->scene->cam, 16.0f / 9.0f);
+	f->visibleCount = sceneCull(f->scene, f->culler, f->visible);
+}
+
+// reads what recording reads, the world matrices of the visible objects
+static float record(Scene *s, const uint32_t *visible, uint32_t count) {
+	float sum = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		mat4 m;
+		glm_mat4_copy(s->tf.world[s->objects[visible[i]].node], m);
+		sum += m[3][0] + m[3][1] + m[3][2];
+	}
+	return sum;
+}
+
+static double run(uint32_t threads) {
+	JobSystem js;
+	jobsInit(&js, threads - 1, 1);
+	jobsRegister(&js);
+	Scene s = {};
+	Mesh mesh = {0, 12, {{0.0f, 0.0f, 0.0f}, {0.8f, 0.9f, 0.7f}}, 0, {}};
+	sceneInitDemo(&s, OBJECTS, mesh);
+	BvhCuller c;
+	bvhCullerInit(&c, &js);
+	uint32_t *visible[2];
+	for (uint32_t i = 0; i < LENGTH(visible); i++) {
+		visible[i] = calloc(OBJECTS, sizeof(uint32_t));
+		mustPtr(visible[i], "benchmark visible list, len = %"PRIu32, OBJECTS);
+	}
+
+	Frame f = {&s, &c, 0, visible[0], 0};
+	JobCounter done = {};
+	jobsRun(&js, simulate, &f, &done);
+	float sum = 0;
+	uint64_t start = SDL_GetPerformanceCounter();
+	for (uint32_t i = 1; i <= FRAMES; i++) {
+		jobsWait(&js, &done);
+		uint32_t *drawn = f.visible;
+		uint32_t drawnCount = f.visibleCount;
+		// the world matrices are read before the next update starts
+		sum += record(&s, drawn, drawnCount);
+		f.frame = i;
+		f.visible = drawn == visible[0] ? visible[1] : visible[0];
+		jobsRun(&js, simulate, &f, &done);
+		sum += (float)drawnCount;
+	}
+	jobsWait(&js, &done);
+	uint64_t ticks = SDL_GetPerformanceCounter() - start;
+	jobsPrintStats(&js);
+
+	for (uint32_t i = 0; i < LENGTH(visible); i++)
+		free(visible[i]);
+	bvhCullerDestroy(&c);
+	sceneDestroy(&s);
+	jobsDestroy(&js);
+	// keeps the recording loop from being optimized away
+	if (isnan(sum))
+		printf("\n");
+	return 1000.0 * ticks / SDL_GetPerformanceFrequency() / FRAMES;
+}
+
+int main(int argc, char *argv[]) {
+	uint32_t maxThreads = argc > 1 ? strtoul(argv[1], NULL, 10) : (uint32_t)SDL_GetCPUCount();
+	if (maxThreads < 1)
+		maxThreads = 1;
+	double base = 0;
+	for (uint32_t t = 1; t <= maxThreads; t++) {
+		double frame = run(t);
+		if (t == 1)
+			base = frame;
+		printf("%3"PRIu32" threads: %8.3f ms per frame | speedup x%.2f\n", t, frame, base / frame);
+	}
+	return 0;
+}
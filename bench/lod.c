@@ -0,0 +1,72 @@
+// builds the levels of detail of generated spheres and shows the level and
+// triangle count chosen at various distances, walking away from the sphere
+// and back to show the hysteresis
+// usage: bench_lod [threshold px]
+
+#include <SDL.h>
+#include <cglm/cglm.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <inttypes.h>
+
+#include "../log.h"
+#include "../util.h"
+#include "../jobs.h"
+#include "../transform.h"
+#include "../bvh.h"
+#include "../scene.h"
+#include "../lod.h"
+
+#define HEIGHT 1080.0f // viewport, pixels
+#define FOVY 60.0f // degrees
+
+static double ms(uint64_t ticks) {
+	return 1000.0 * ticks / SDL_GetPerformanceFrequency();
+}
+
+// returns the mesh of a sphere with its levels
+static Mesh build(uint32_t segments, char print) {
+	vec3 *positions;
+	uint32_t *indices, vertexCount, indexCount;
+	sceneGenerateSphere(segments, GLM_VEC3_ZERO, 0.5f, &positions, &vertexCount, &indices, &indexCount);
+	Mesh m = {0, indexCount, {{-0.54f, -0.54f, -0.54f}, {0.54f, 0.54f, 0.54f}}, 0, {}};
+	uint64_t start = SDL_GetPerformanceCounter();
+	lodBuildChain(&m, positions, vertexCount, &indices, &indexCount);
+	uint64_t ticks = SDL_GetPerformanceCounter() - start;
+	if (print) {
+		printf("%4"PRIu32" segments: %7"PRIu32" triangles, %"PRIu32" levels built in %8.3f ms |",
+			segments, m.indexCount / 3, m.lodCount, ms(ticks));
+		for (uint32_t i = 0; i < m.lodCount; i++)
+			printf(" %"PRIu32" (%.4f)", m.lods[i].indexCount / 3, m.lods[i].error);
+		printf("\n");
+	}
+	free(positions);
+	free(indices);
+	return m;
+}
+
+static void sweep(const Mesh *m, float distance, float threshold, uint32_t *lod) {
+	float ppu = HEIGHT / (2.0f * distance * tanf(0.5f * glm_rad(FOVY)));
+	*lod = lodSelect(m, *lod, ppu, threshold);
+	const MeshLod *l = &m->lods[*lod];
+	printf("distance %7.2f: lod %"PRIu32", %7"PRIu32" triangles (%5.1f%%), error %6.3f px\n",
+		distance, *lod, l->indexCount / 3, 100.0f * l->indexCount / m->indexCount, l->error * ppu);
+}
+
+int main(int argc, char *argv[]) {
+	float threshold = argc > 1 ? strtof(argv[1], NULL) : 1.0f;
+	uint32_t segments[] = {32, 64, 128, 256, 512};
+	for (uint32_t i = 0; i < LENGTH(segments); i++)
+		build(segments[i], 1);
+
+	printf("\nsphere of diameter 1 with 256 segments, %.0f px high viewport, threshold %.2f px\n", HEIGHT, threshold);
+	Mesh m = build(256, 0);
+	uint32_t lod = 0;
+	for (float d = 1.0f; d <= 512.0f; d *= 2.0f)
+		sweep(&m, d, threshold, &lod);
+	for (float d = 512.0f; d >= 1.0f; d *= 0.5f * 1.25f)
+		sweep(&m, d, threshold, &lod);
+	return 0;
+}
@@ -0,0 +1,199 @@
+// bindless resources
+
+#include <vulkan.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "log.h"
+#include "util.h"
+#include "bindless.h"
+
+char bindlessFeatures(VkPhysicalDevice vpd, VkPhysicalDeviceDescriptorIndexingFeatures *f) {
+	VkPhysicalDeviceDescriptorIndexingFeatures supported = {};
+	supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+	VkPhysicalDeviceFeatures2 f2 = {};
+	f2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	f2.pNext = &supported;
+	vkGetPhysicalDeviceFeatures2(vpd, &f2);
+
+	void *next = f->pNext;
+	*f = (VkPhysicalDeviceDescriptorIndexingFeatures){};
+	f->sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+	f->pNext = next;
+	f->shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+	f->shaderStorageBufferArrayNonUniformIndexing = VK_TRUE;
+	f->descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+	f->descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+	f->descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+	f->descriptorBindingPartiallyBound = VK_TRUE;
+	f->runtimeDescriptorArray = VK_TRUE;
+	return supported.shaderSampledImageArrayNonUniformIndexing
+		&& supported.shaderStorageBufferArrayNonUniformIndexing
+		&& supported.descriptorBindingSampledImageUpdateAfterBind
+		&& supported.descriptorBindingStorageBufferUpdateAfterBind
+		&& supported.descriptorBindingUpdateUnusedWhilePending
+		&& supported.descriptorBindingPartiallyBound
+		&& supported.runtimeDescriptorArray;
+}
+
+static uint32_t min3(uint32_t a, uint32_t b, uint32_t c) {
+	uint32_t m = a < b ? a : b;
+	return m < c ? m : c;
+}
+
+static void bindlessArrayInit(BindlessArray *a, uint32_t capacity) {
+	a->capacity = capacity;
+	a->used = 0;
+	a->freeCount = 0;
+	a->free = calloc(capacity, sizeof(uint32_t));
+	mustPtr(a->free, "bindless free list, len = %"PRIu32, capacity);
+	a->retiredCount = 0;
+	a->retired = calloc(capacity, sizeof(BindlessRetired));
+	mustPtr(a->retired, "bindless retired list, len = %"PRIu32, capacity);
+}
+
+void bindlessInit(Bindless *b, VkDevice dev, VkPhysicalDevice vpd, uint32_t framesInFlight) {
+	b->dev = dev;
+	b->framesInFlight = framesInFlight;
+
+	VkPhysicalDeviceDescriptorIndexingProperties dip = {};
+	dip.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+	VkPhysicalDeviceProperties2 p2 = {};
+	p2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	p2.pNext = &dip;
+	vkGetPhysicalDeviceProperties2(vpd, &p2);
+	bindlessArrayInit(&b->buffers, min3(BINDLESS_BUFFERS,
+		dip.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+		dip.maxDescriptorSetUpdateAfterBindStorageBuffers));
+	bindlessArrayInit(&b->textures, min3(BINDLESS_TEXTURES,
+		dip.maxPerStageDescriptorUpdateAfterBindSampledImages < dip.maxPerStageDescriptorUpdateAfterBindSamplers
+			? dip.maxPerStageDescriptorUpdateAfterBindSampledImages : dip.maxPerStageDescriptorUpdateAfterBindSamplers,
+		dip.maxDescriptorSetUpdateAfterBindSampledImages < dip.maxDescriptorSetUpdateAfterBindSamplers
+			? dip.maxDescriptorSetUpdateAfterBindSampledImages : dip.maxDescriptorSetUpdateAfterBindSamplers));
+
+	// descriptors can be written while the set is bound in pending command
+	// buffers, as long as those don't use them
+	VkDescriptorBindingFlags flags = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT
+		| VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT
+		| VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+	VkDescriptorSetLayoutBinding dslb[2] = {};
+	dslb[0].binding = BINDLESS_BINDING_BUFFERS;
+	dslb[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	dslb[0].descriptorCount = b->buffers.capacity;
+	dslb[0].stageFlags = VK_SHADER_STAGE_ALL;
+	dslb[1].binding = BINDLESS_BINDING_TEXTURES;
+	dslb[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	dslb[1].descriptorCount = b->textures.capacity;
+	dslb[1].stageFlags = VK_SHADER_STAGE_ALL;
+	VkDescriptorSetLayoutBindingFlagsCreateInfo dslbfci = {};
+	dslbfci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+	dslbfci.bindingCount = LENGTH(dslb);
+	dslbfci.pBindingFlags = (VkDescriptorBindingFlags[]){flags, flags};
+	VkDescriptorSetLayoutCreateInfo dslci = {};
+	dslci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	dslci.pNext = &dslbfci;
+	dslci.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+	dslci.bindingCount = LENGTH(dslb);
+	dslci.pBindings = dslb;
+	must(vkCreateDescriptorSetLayout(dev, &dslci, NULL, &b->dsl));
+
+	VkDescriptorPoolCreateInfo dpci = {};
+	dpci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	dpci.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	dpci.maxSets = 1;
+	dpci.poolSizeCount = 2;
+	dpci.pPoolSizes = (VkDescriptorPoolSize[]){
+		{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, b->buffers.capacity},
+		{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, b->textures.capacity},
+	};
+	must(vkCreateDescriptorPool(dev, &dpci, NULL, &b->pool));
+
+	VkDescriptorSetAllocateInfo dsai = {};
+	dsai.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	dsai.descriptorPool = b->pool;
+	dsai.descriptorSetCount = 1;
+	dsai.pSetLayouts = &b->dsl;
+	must(vkAllocateDescriptorSets(dev, &dsai, &b->set));
+
+	infof("bindless descriptor set created (%"PRIu32" buffers, %"PRIu32" textures)",
+		b->buffers.capacity, b->textures.capacity);
+}
+
+void bindlessDestroy(Bindless *b) {
+	vkDestroyDescriptorPool(b->dev, b->pool, NULL);
+	vkDestroyDescriptorSetLayout(b->dev, b->dsl, NULL);
+	free(b->buffers.free);
+	free(b->buffers.retired);
+	free(b->textures.free);
+	free(b->textures.retired);
+}
+
+static uint32_t bindlessArrayAlloc(BindlessArray *a, const char *what) {
+	if (a->freeCount > 0)
+		return a->free[--a->freeCount];
+	mustCondition(a->used < a->capacity, "bindless %s count below %"PRIu32, what, a->capacity);
+	return a->used++;
+}
+
+static void bindlessArrayRetire(BindlessArray *a, uint32_t index, uint64_t frame) {
+	mustCondition(index < a->used, "bindless index %"PRIu32" was allocated", index);
+	a->retired[a->retiredCount++] = (BindlessRetired){index, frame};
+}
+
+static void bindlessArrayUpdate(BindlessArray *a, uint64_t frame, uint32_t framesInFlight) {
+	for (uint32_t i = 0; i < a->retiredCount; ) {
+		if (a->retired[i].frame + framesInFlight <= frame) {
+			a->free[a->freeCount++] = a->retired[i].index;
+			a->retired[i] = a->retired[--a->retiredCount];
+		} else {
+			i++;
+		}
+	}
+}
+
+uint32_t bindlessAddBuffer(Bindless *b, VkBuffer buf, VkDeviceSize offset, VkDeviceSize range) {
+	uint32_t i = bindlessArrayAlloc(&b->buffers, "buffer");
+	vkUpdateDescriptorSets(b->dev, 1, &(VkWriteDescriptorSet){
+		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.dstSet = b->set,
+		.dstBinding = BINDLESS_BINDING_BUFFERS,
+		.dstArrayElement = i,
+		.descriptorCount = 1,
+		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		.pBufferInfo = &(VkDescriptorBufferInfo){buf, offset, range},
+	}, 0, NULL);
+	return i;
+}
+
+uint32_t bindlessAddTexture(Bindless *b, VkSampler sampler, VkImageView view) {
+	uint32_t i = bindlessArrayAlloc(&b->textures, "texture");
+	vkUpdateDescriptorSets(b->dev, 1, &(VkWriteDescriptorSet){
+		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.dstSet = b->set,
+		.dstBinding = BINDLESS_BINDING_TEXTURES,
+		.dstArrayElement = i,
+		.descriptorCount = 1,
+		.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+		.pImageInfo = &(VkDescriptorImageInfo){sampler, view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+	}, 0, NULL);
+	return i;
+}
+
+void bindlessRemoveBuffer(Bindless *b, uint32_t index, uint64_t frame) {
+	bindlessArrayRetire(&b->buffers, index, frame);
+}
+
+void bindlessRemoveTexture(Bindless *b, uint32_t index, uint64_t frame) {
+	bindlessArrayRetire(&b->textures, index, frame);
+}
+
+void bindlessUpdate(Bindless *b, uint64_t frame) {
+	bindlessArrayUpdate(&b->buffers, frame, b->framesInFlight);
+	bindlessArrayUpdate(&b->textures, frame, b->framesInFlight);
+}
+
+void bindlessBind(Bindless *b, VkCommandBuffer cmd, VkPipelineBindPoint bp, VkPipelineLayout layout) {
+	vkCmdBindDescriptorSets(cmd, bp, layout, 0, 1, &b->set, 0, NULL);
+}
@@ -0,0 +1,65 @@
+// bindless resources
+// All storage buffers and sampled textures live in large update-after-bind
+// arrays of a single descriptor set, bound once per command buffer. Shaders
+// index the arrays with values passed in push constants. Indices are handed
+// out from a free-list and stay valid until removed; a removed index is
+// reused only after the frames that could still reference it have completed.
+// requires:
+// #include <vulkan.h>
+
+#define BINDLESS_NONE UINT32_MAX
+// array sizes, lowered to the device limits
+#define BINDLESS_BUFFERS 1024
+#define BINDLESS_TEXTURES 4096
+// bindings in the set, must match the shaders
+#define BINDLESS_BINDING_BUFFERS 0
+#define BINDLESS_BINDING_TEXTURES 1
+
+typedef struct BindlessRetired {
+	uint32_t index;
+	uint64_t frame; // frame in which it was last used
+} BindlessRetired;
+
+// index allocator for one array
+typedef struct BindlessArray {
+	uint32_t capacity;
+	uint32_t used; // indices below this were handed out at some point
+	uint32_t freeCount;
+	uint32_t *free;
+	uint32_t retiredCount;
+	BindlessRetired *retired; // removed, but possibly referenced by frames in flight
+} BindlessArray;
+
+typedef struct Bindless {
+	VkDevice dev;
+	uint32_t framesInFlight;
+	VkDescriptorSetLayout dsl;
+	VkDescriptorPool pool;
+	VkDescriptorSet set;
+	BindlessArray buffers;
+	BindlessArray textures;
+} Bindless;
+
+// fills the descriptor indexing features needed by bindlessInit
+// returns 0 if the device doesn't support them
+char bindlessFeatures(VkPhysicalDevice vpd, VkPhysicalDeviceDescriptorIndexingFeatures *f);
+
+void bindlessInit(Bindless *b, VkDevice dev, VkPhysicalDevice vpd, uint32_t framesInFlight);
+
+void bindlessDestroy(Bindless *b);
+
+uint32_t bindlessAddBuffer(Bindless *b, VkBuffer buf, VkDeviceSize offset, VkDeviceSize range);
+
+// the image must be in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL when sampled
+uint32_t bindlessAddTexture(Bindless *b, VkSampler sampler, VkImageView view);
+
+// frame is the number of the last frame that can use the index
+void bindlessRemoveBuffer(Bindless *b, uint32_t index, uint64_t frame);
+
+void bindlessRemoveTexture(Bindless *b, uint32_t index, uint64_t frame);
+
+// makes indices removed at least framesInFlight frames ago available again
+// frame is the current frame number, whose previous use has completed
+void bindlessUpdate(Bindless *b, uint64_t frame);
+
+void bindlessBind(Bindless *b, VkCommandBuffer cmd, VkPipelineBindPoint bp, VkPipelineLayout layout);
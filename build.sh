@@ -5,8 +5,19 @@ mkdir -p shaders_out obj
 # Compile VMA implementation
 g++ -g -Wall -Wextra -std=c++20 -c vma/vma_usage.cpp -o obj/vma_usage.o -I/usr/include -lVulkanMemoryAllocator
 # Compile Vulkan application
-for basename in main frame swapchain; do
-    gcc -g -Wall -Wextra -c -o "obj/${basename}.o" "${basename}.c" -I/usr/include/SDL2 -I/usr/include/vulkan -I/usr/include
+for basename in main log frame swapchain capture bindless texture jobs transform scene bvh pipeline shader occlusion particles defrag lod queue replay lights; do
+    gcc -g -Wall -Wextra -DCGLM_FORCE_DEPTH_ZERO_TO_ONE -c -o "obj/${basename}.o" "${basename}.c" -I/usr/include/SDL2 -I/usr/include/vulkan -I/usr/include
 done
 # Link everything
-gcc -lstdc++ -o main obj/*.o -L/usr/lib -lSDL2 -lvulkan -lcglm
+gcc -lstdc++ -o main obj/*.o -L/usr/lib -lSDL2 -lvulkan -lcglm -lm
+# Benchmarks (./build.sh bench)
+if [ "$1" = "bench" ]; then
+    mkdir -p obj/bench
+    for basename in bvh jobs frame lod; do
+        gcc -O2 -g -Wall -Wextra -DCGLM_FORCE_DEPTH_ZERO_TO_ONE -c -o "obj/bench/${basename}.o" "bench/${basename}.c" -I/usr/include/SDL2 -I/usr/include/vulkan -I/usr/include
+    done
+    gcc -o bench_bvh obj/bench/bvh.o obj/log.o obj/jobs.o obj/bvh.o obj/scene.o obj/transform.o obj/lod.o -L/usr/lib -lSDL2 -lcglm -lm
+    gcc -o bench_jobs obj/bench/jobs.o obj/log.o obj/jobs.o obj/bvh.o obj/scene.o obj/transform.o obj/lod.o -L/usr/lib -lSDL2 -lcglm -lm
+    gcc -lstdc++ -o bench_frame obj/bench/frame.o obj/log.o obj/frame.o obj/swapchain.o obj/bindless.o obj/pipeline.o obj/shader.o obj/vma_usage.o obj/jobs.o obj/bvh.o obj/scene.o obj/transform.o obj/lod.o obj/queue.o obj/lights.o -L/usr/lib -lSDL2 -lvulkan -lcglm -lm
+    gcc -o bench_lod obj/bench/lod.o obj/log.o obj/jobs.o obj/bvh.o obj/scene.o obj/transform.o obj/lod.o -L/usr/lib -lSDL2 -lcglm -lm
+fi
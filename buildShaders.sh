@@ -1,5 +1,27 @@
-cd shaders
-for f in *; do
-    glslc $f -o "../shaders_out/${f}.spv"
-    xxd -n "$f" -i "../shaders_out/${f}.spv" "../shaders_out/${f}.h"
-done
+#!/bin/bash
+# Compiles every shader permutation into shaders_out/<name>.h: optimized
+# SPIR-V as a uint32_t array, with reflection data (shader.h)
+set -e
+
+mkdir -p shaders_out obj
+gcc -O2 -Wall -Wextra -o obj/spvheader tools/spvheader.c
+
+# source, output name, permutation defines
+while read -r src name defines; do
+    glslc -O --target-env=vulkan1.3 $defines "shaders/${src}" -o "shaders_out/${name}.spv"
+    spirv-opt -O --target-env=vulkan1.3 "shaders_out/${name}.spv" -o "shaders_out/${name}.opt.spv"
+    obj/spvheader "${name//./_}" "shaders_out/${name}.opt.spv" > "shaders_out/${name}.h"
+done <<END
+shader.vert scene.vert -DTEXTURED
+shader.frag scene.frag -DTEXTURED
+shader.vert scene_flat.vert
+shader.frag scene_flat.frag
+hiz.comp hiz.comp
+occlusion.comp occlusion.comp
+clusters.comp clusters.comp
+particles.comp particles_prepare.comp -DPREPARE
+particles.comp particles_emit.comp -DEMIT
+particles.comp particles_simulate.comp -DSIMULATE
+particles.vert particles.vert
+particles.frag particles.frag
+END
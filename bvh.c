@@ -0,0 +1,535 @@
+// bounding volume hierarchy over axis-aligned bounding boxes
+
+#include <SDL.h>
+#include <cglm/cglm.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <inttypes.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "log.h"
+#include "util.h"
+#include "jobs.h"
+#include "bvh.h"
+
+#define BVH_BINS 16
+#define BVH_LEAF_MAX 4
+#define BVH_STACK_MAX 64 // also the maximum tree depth
+// traversal stack entries have this bit set if the node is fully inside the frustum
+#define BVH_INSIDE 0x80000000u
+
+// unlike fminf/fmaxf, these compile to single instructions
+static inline float minf(float a, float b) {
+	return a < b ? a : b;
+}
+
+static inline float maxf(float a, float b) {
+	return a > b ? a : b;
+}
+
+static void aabbEmpty(Aabb *b) {
+	b->min[0] = b->min[1] = b->min[2] = FLT_MAX;
+	b->max[0] = b->max[1] = b->max[2] = -FLT_MAX;
+}
+
+static void aabbGrow(Aabb *b, const Aabb *o) {
+	for (int k = 0; k < 3; k++) {
+		b->min[k] = minf(b->min[k], o->min[k]);
+		b->max[k] = maxf(b->max[k], o->max[k]);
+	}
+}
+
+static float aabbArea(const Aabb *b) {
+	float x = b->max[0] - b->min[0], y = b->max[1] - b->min[1], z = b->max[2] - b->min[2];
+	if (x < 0 || y < 0 || z < 0)
+		return 0;
+	return 2.0f * (x*y + y*z + z*x);
+}
+
+static float aabbCentroid(const Aabb *b, int axis) {
+	return 0.5f * (b->min[axis] + b->max[axis]);
+}
+
+void bvhInit(Bvh *b, uint32_t itemCount) {
+	b->itemCount = itemCount;
+	// at least one item, so that no allocation returns NULL
+	b->boxes = calloc(itemCount > 0 ? itemCount : 1, sizeof(Aabb));
+	mustPtr(b->boxes, "bvh boxes array, len = %"PRIu32, itemCount);
+	b->items = calloc(itemCount > 0 ? itemCount : 1, sizeof(uint32_t));
+	mustPtr(b->items, "bvh items array, len = %"PRIu32, itemCount);
+	// a binary tree with n leaves has 2n - 1 nodes
+	b->nodes = calloc(2 * itemCount + 1, sizeof(BvhNode));
+	mustPtr(b->nodes, "bvh nodes array, len = %"PRIu32, 2 * itemCount + 1);
+	b->nodeCount = 0;
+	b->builtCost = b->cost = 0;
+	b->rebuilds = 0;
+}
+
+void bvhDestroy(Bvh *b) {
+	free(b->boxes);
+	free(b->items);
+	free(b->nodes);
+	b->nodes = NULL;
+	b->nodeCount = 0;
+}
+
+// sah cost relative to the root area, intersection and traversal costs are equal
+static float bvhCost(const Bvh *b) {
+	float root = aabbArea(&b->nodes[0].box);
+	if (root <= 0)
+		return 0;
+	float cost = 0;
+	for (uint32_t i = 0; i < b->nodeCount; i++) {
+		const BvhNode *n = &b->nodes[i];
+		cost += aabbArea(&n->box) * (n->count ? n->count : 1);
+	}
+	return cost / root;
+}
+
+typedef struct BvhBin {
+	Aabb box;
+	uint32_t count;
+} BvhBin;
+
+// finds the best binned split of the node's items
+// returns 0 if a leaf is cheaper than any split
+static char bvhFindSplit(const Bvh *b, const BvhNode *n, int *bestAxis, float *bestPos) {
+	Aabb cb; // centroid bounds
+	aabbEmpty(&cb);
+	for (uint32_t i = n->first; i < n->first + n->count; i++) {
+		const Aabb *box = &b->boxes[b->items[i]];
+		for (int k = 0; k < 3; k++) {
+			float c = aabbCentroid(box, k);
+			cb.min[k] = minf(cb.min[k], c);
+			cb.max[k] = maxf(cb.max[k], c);
+		}
+	}
+
+	float bestCost = aabbArea(&n->box) * n->count; // cost of a leaf
+	char found = 0;
+	for (int axis = 0; axis < 3; axis++) {
+		float extent = cb.max[axis] - cb.min[axis];
+		if (extent <= 0)
+			continue;
+		BvhBin bins[BVH_BINS];
+		for (int j = 0; j < BVH_BINS; j++) {
+			aabbEmpty(&bins[j].box);
+			bins[j].count = 0;
+		}
+		float scale = BVH_BINS / extent;
+		for (uint32_t i = n->first; i < n->first + n->count; i++) {
+			const Aabb *box = &b->boxes[b->items[i]];
+			int j = (int)((aabbCentroid(box, axis) - cb.min[axis]) * scale);
+			if (j >= BVH_BINS)
+				j = BVH_BINS - 1;
+			bins[j].count++;
+			aabbGrow(&bins[j].box, box);
+		}
+		// sweep from the right to get the cost of every right side
+		float rightArea[BVH_BINS];
+		uint32_t rightCount[BVH_BINS];
+		Aabb acc;
+		aabbEmpty(&acc);
+		uint32_t cnt = 0;
+		for (int j = BVH_BINS - 1; j > 0; j--) {
+			aabbGrow(&acc, &bins[j].box);
+			cnt += bins[j].count;
+			rightArea[j] = aabbArea(&acc);
+			rightCount[j] = cnt;
+		}
+		aabbEmpty(&acc);
+		cnt = 0;
+		for (int j = 0; j < BVH_BINS - 1; j++) {
+			aabbGrow(&acc, &bins[j].box);
+			cnt += bins[j].count;
+			if (cnt == 0 || rightCount[j + 1] == 0)
+				continue;
+			float cost = aabbArea(&acc) * cnt + rightArea[j + 1] * rightCount[j + 1];
+			if (cost < bestCost) {
+				bestCost = cost;
+				*bestAxis = axis;
+				*bestPos = cb.min[axis] + (j + 1) / scale;
+				found = 1;
+			}
+		}
+	}
+	return found;
+}
+
+void bvhBuild(Bvh *b) {
+	for (uint32_t i = 0; i < b->itemCount; i++)
+		b->items[i] = i;
+	b->nodeCount = 1;
+	BvhNode *root = &b->nodes[0];
+	root->first = 0;
+	root->count = b->itemCount;
+	aabbEmpty(&root->box);
+	if (b->itemCount == 0) {
+		b->builtCost = b->cost = 0;
+		return;
+	}
+
+	// the depth is limited, so traversal stacks never overflow
+	uint32_t stack[BVH_STACK_MAX];
+	uint32_t depth[BVH_STACK_MAX];
+	uint32_t top = 0;
+	stack[top] = 0;
+	depth[top++] = 0;
+	while (top > 0) {
+		top--;
+		BvhNode *n = &b->nodes[stack[top]];
+		uint32_t d = depth[top];
+		aabbEmpty(&n->box);
+		for (uint32_t i = n->first; i < n->first + n->count; i++)
+			aabbGrow(&n->box, &b->boxes[b->items[i]]);
+		if (n->count <= 2 || d + 2 >= BVH_STACK_MAX)
+			continue;
+
+		int axis = 0;
+		float pos = 0;
+		if (!bvhFindSplit(b, n, &axis, &pos)) {
+			if (n->count <= BVH_LEAF_MAX)
+				continue;
+			// too many items for a leaf, split at the median of the largest axis
+			axis = 0;
+			for (int k = 1; k < 3; k++)
+				if (n->box.max[k] - n->box.min[k] > n->box.max[axis] - n->box.min[axis])
+					axis = k;
+			pos = NAN;
+		}
+
+		// partition the items in place
+		uint32_t mid;
+		if (isnan(pos)) {
+			mid = n->first + n->count / 2;
+		} else {
+			uint32_t i = n->first, j = n->first + n->count;
+			while (i < j) {
+				if (aabbCentroid(&b->boxes[b->items[i]], axis) < pos) {
+					i++;
+				} else {
+					uint32_t t = b->items[i];
+					b->items[i] = b->items[--j];
+					b->items[j] = t;
+				}
+			}
+			mid = i;
+			if (mid == n->first || mid == n->first + n->count)
+				mid = n->first + n->count / 2;
+		}
+
+		uint32_t c = b->nodeCount;
+		b->nodeCount += 2;
+		b->nodes[c].first = n->first;
+		b->nodes[c].count = mid - n->first;
+		b->nodes[c + 1].first = mid;
+		b->nodes[c + 1].count = n->first + n->count - mid;
+		n->first = c;
+		n->count = 0;
+		stack[top] = c;
+		depth[top++] = d + 1;
+		stack[top] = c + 1;
+		depth[top++] = d + 1;
+	}
+
+	b->builtCost = b->cost = bvhCost(b);
+	b->rebuilds++;
+}
+
+void bvhRefit(Bvh *b) {
+	// the root of an empty tree has count 0 too, but no children
+	if (b->itemCount == 0) {
+		aabbEmpty(&b->nodes[0].box);
+		b->cost = 0;
+		return;
+	}
+	// children always have higher indices than their parent
+	for (uint32_t i = b->nodeCount; i-- > 0; ) {
+		BvhNode *n = &b->nodes[i];
+		aabbEmpty(&n->box);
+		if (n->count > 0) {
+			for (uint32_t j = n->first; j < n->first + n->count; j++)
+				aabbGrow(&n->box, &b->boxes[b->items[j]]);
+		} else {
+			aabbGrow(&n->box, &b->nodes[n->first].box);
+			aabbGrow(&n->box, &b->nodes[n->first + 1].box);
+		}
+	}
+	b->cost = bvhCost(b);
+}
+
+char bvhUpdate(Bvh *b, float maxGrowth) {
+	if (b->itemCount == 0 && b->nodeCount > 0)
+		return 0;
+	if (b->nodeCount == 0) {
+		bvhBuild(b);
+		return 1;
+	}
+	bvhRefit(b);
+	if (b->cost > b->builtCost * (1.0f + maxGrowth)) {
+		bvhBuild(b);
+		return 1;
+	}
+	return 0;
+}
+
+void frustumFromMatrix(Frustum *f, mat4 m) {
+	vec4 planes[6];
+	glm_frustum_planes(m, planes);
+	for (int i = 0; i < 8; i++) {
+		if (i < 6) {
+			f->nx[i] = planes[i][0];
+			f->ny[i] = planes[i][1];
+			f->nz[i] = planes[i][2];
+			f->d[i] = planes[i][3];
+		} else {
+			// padding, always inside
+			f->nx[i] = f->ny[i] = f->nz[i] = 0;
+			f->d[i] = 1;
+		}
+	}
+}
+
+#define FRUSTUM_OUTSIDE 0
+#define FRUSTUM_INTERSECTS 1
+#define FRUSTUM_INSIDE 2
+
+#ifdef __SSE__
+// tests four planes at a time using the box center and half extent
+static int frustumClassify(const Frustum *f, const Aabb *box) {
+	__m128 cx = _mm_set1_ps(0.5f * (box->min[0] + box->max[0]));
+	__m128 cy = _mm_set1_ps(0.5f * (box->min[1] + box->max[1]));
+	__m128 cz = _mm_set1_ps(0.5f * (box->min[2] + box->max[2]));
+	__m128 ex = _mm_set1_ps(0.5f * (box->max[0] - box->min[0]));
+	__m128 ey = _mm_set1_ps(0.5f * (box->max[1] - box->min[1]));
+	__m128 ez = _mm_set1_ps(0.5f * (box->max[2] - box->min[2]));
+	__m128 sign = _mm_set1_ps(-0.0f);
+	__m128 zero = _mm_setzero_ps();
+	int outside = 0, partial = 0;
+	for (int k = 0; k < 8; k += 4) {
+		__m128 nx = _mm_loadu_ps(f->nx + k);
+		__m128 ny = _mm_loadu_ps(f->ny + k);
+		__m128 nz = _mm_loadu_ps(f->nz + k);
+		__m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)),
+			_mm_add_ps(_mm_mul_ps(nz, cz), _mm_loadu_ps(f->d + k)));
+		__m128 rad = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign, nx), ex),
+			_mm_mul_ps(_mm_andnot_ps(sign, ny), ey)), _mm_mul_ps(_mm_andnot_ps(sign, nz), ez));
+		outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(dist, rad), zero));
+		partial |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(dist, rad), zero));
+	}
+	if (outside)
+		return FRUSTUM_OUTSIDE;
+	return partial ? FRUSTUM_INTERSECTS : FRUSTUM_INSIDE;
+}
+#else
+static int frustumClassify(const Frustum *f, const Aabb *box) {
+	int result = FRUSTUM_INSIDE;
+	for (int i = 0; i < 6; i++) {
+		float dist = 0, rad = 0;
+		const float n[3] = {f->nx[i], f->ny[i], f->nz[i]};
+		for (int k = 0; k < 3; k++) {
+			dist += n[k] * 0.5f * (box->min[k] + box->max[k]);
+			rad += fabsf(n[k]) * 0.5f * (box->max[k] - box->min[k]);
+		}
+		dist += f->d[i];
+		if (dist + rad < 0)
+			return FRUSTUM_OUTSIDE;
+		if (dist - rad < 0)
+			result = FRUSTUM_INTERSECTS;
+	}
+	return result;
+}
+#endif
+
+char frustumTestAabb(const Frustum *f, const Aabb *box) {
+	return frustumClassify(f, box) != FRUSTUM_OUTSIDE;
+}
+
+// culls the subtree starting at root
+static uint32_t bvhCullSubtree(const Bvh *b, uint32_t root, const Frustum *f, uint32_t *out) {
+	uint32_t n = 0;
+	uint32_t stack[BVH_STACK_MAX];
+	uint32_t top = 0;
+	stack[top++] = root;
+	while (top > 0) {
+		uint32_t e = stack[--top];
+		char inside = (e & BVH_INSIDE) != 0;
+		const BvhNode *node = &b->nodes[e & ~BVH_INSIDE];
+		if (!inside) {
+			int c = frustumClassify(f, &node->box);
+			if (c == FRUSTUM_OUTSIDE)
+				continue;
+			inside = c == FRUSTUM_INSIDE;
+		}
+		if (node->count > 0 && inside) {
+			memcpy(out + n, b->items + node->first, node->count * sizeof(uint32_t));
+			n += node->count;
+		} else if (node->count > 0) {
+			for (uint32_t i = node->first; i < node->first + node->count; i++)
+				if (frustumClassify(f, &b->boxes[b->items[i]]) != FRUSTUM_OUTSIDE)
+					out[n++] = b->items[i];
+		} else {
+			uint32_t flag = inside ? BVH_INSIDE : 0;
+			stack[top++] = (node->first + 1) | flag;
+			stack[top++] = node->first | flag;
+		}
+	}
+	return n;
+}
+
+uint32_t bvhCullFrustum(const Bvh *b, const Frustum *f, uint32_t *out) {
+	if (b->itemCount == 0)
+		return 0;
+	return bvhCullSubtree(b, 0, f, out);
+}
+
+uint32_t bruteCullFrustum(const Aabb *boxes, uint32_t count, const Frustum *f, uint32_t *out) {
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < count; i++)
+		if (frustumClassify(f, &boxes[i]) != FRUSTUM_OUTSIDE)
+			out[n++] = i;
+	return n;
+}
+
+// returns the entry distance of the ray into the box, or FLT_MAX if it misses
+static float aabbRay(const Aabb *box, const vec3 origin, const vec3 inv, float tmax) {
+	float t0 = 0, t1 = tmax;
+	for (int k = 0; k < 3; k++) {
+		float a = (box->min[k] - origin[k]) * inv[k];
+		float b = (box->max[k] - origin[k]) * inv[k];
+		t0 = maxf(t0, minf(a, b));
+		t1 = minf(t1, maxf(a, b));
+	}
+	return t0 <= t1 ? t0 : FLT_MAX;
+}
+
+uint32_t bvhRaycast(const Bvh *b, vec3 origin, vec3 dir, float *t) {
+	uint32_t hit = BVH_NONE;
+	float best = FLT_MAX;
+	if (b->itemCount == 0)
+		return hit;
+	vec3 inv = {1.0f / dir[0], 1.0f / dir[1], 1.0f / dir[2]};
+	uint32_t stack[BVH_STACK_MAX];
+	uint32_t top = 0;
+	if (aabbRay(&b->nodes[0].box, origin, inv, best) != FLT_MAX)
+		stack[top++] = 0;
+	while (top > 0) {
+		const BvhNode *node = &b->nodes[stack[--top]];
+		if (node->count > 0) {
+			for (uint32_t i = node->first; i < node->first + node->count; i++) {
+				float d = aabbRay(&b->boxes[b->items[i]], origin, inv, best);
+				if (d < best) {
+					best = d;
+					hit = b->items[i];
+				}
+			}
+			continue;
+		}
+		// visit the nearer child first
+		uint32_t c0 = node->first, c1 = node->first + 1;
+		float d0 = aabbRay(&b->nodes[c0].box, origin, inv, best);
+		float d1 = aabbRay(&b->nodes[c1].box, origin, inv, best);
+		if (d0 > d1) {
+			uint32_t ct = c0; c0 = c1; c1 = ct;
+			float dt = d0; d0 = d1; d1 = dt;
+		}
+		if (d1 < best)
+			stack[top++] = c1;
+		if (d0 < best)
+			stack[top++] = c0;
+	}
+	*t = best;
+	return hit;
+}
+
+// the items of a subtree are b->items[*first..*end-1]
+static void bvhSubtreeItems(const Bvh *b, uint32_t root, uint32_t *first, uint32_t *end) {
+	uint32_t l = root, r = root;
+	while (b->nodes[l].count == 0)
+		l = b->nodes[l].first;
+	while (b->nodes[r].count == 0)
+		r = b->nodes[r].first + 1;
+	*first = b->nodes[l].first;
+	*end = b->nodes[r].first + b->nodes[r].count;
+}
+
+static void bvhCullJob(void *arg) {
+	BvhCullTask *t = arg;
+	BvhCuller *c = t->c;
+	t->count = bvhCullSubtree(c->bvh, t->root, &c->fr, c->out + t->offset);
+}
+
+void bvhCullerInit(BvhCuller *c, JobSystem *jobs) {
+	c->jobs = jobs;
+	c->maxTasks = BVH_TASKS_PER_THREAD * jobs->slotCount;
+	c->roots = calloc(c->maxTasks + 1, sizeof(uint32_t));
+	mustPtr(c->roots, "bvh culler roots, len = %"PRIu32, c->maxTasks + 1);
+	c->tasks = calloc(c->maxTasks + 1, sizeof(BvhCullTask));
+	mustPtr(c->tasks, "bvh culler tasks, len = %"PRIu32, c->maxTasks + 1);
+}
+
+void bvhCullerDestroy(BvhCuller *c) {
+	free(c->roots);
+	free(c->tasks);
+}
+
+uint32_t bvhCullerRun(BvhCuller *c, const Bvh *b, const Frustum *f, uint32_t *out) {
+	if (c->jobs->slotCount == 1 || b->itemCount == 0)
+		return bvhCullFrustum(b, f, out);
+
+	// split the tree breadth first into enough subtrees to balance the threads
+	// (leaves can't be split, so the queue may stop growing)
+	uint32_t want = c->maxTasks;
+	uint32_t head = 0;
+	uint32_t count = 0;
+	c->roots[count++] = 0;
+	while (count - head < want && head < count) {
+		uint32_t i = c->roots[head];
+		const BvhNode *node = &b->nodes[i];
+		if (node->count > 0 || count + 2 > want + 1)
+			break;
+		head++;
+		if (!frustumTestAabb(f, &node->box))
+			continue;
+		c->roots[count++] = node->first;
+		c->roots[count++] = node->first + 1;
+	}
+
+	// every subtree writes to the range of its items in out
+	c->bvh = b;
+	c->fr = *f;
+	c->out = out;
+	JobCounter done = {};
+	uint32_t tasks = count - head;
+	for (uint32_t i = 0; i < tasks; i++) {
+		BvhCullTask *t = &c->tasks[i];
+		uint32_t end;
+		t->c = c;
+		t->root = c->roots[head + i];
+		bvhSubtreeItems(b, t->root, &t->offset, &end);
+		t->count = 0;
+		jobsRun(c->jobs, bvhCullJob, t, &done);
+	}
+	jobsWait(c->jobs, &done);
+
+	// compact the outputs in item order, so nothing is overwritten before it is moved
+	for (uint32_t i = 1; i < tasks; i++) {
+		BvhCullTask t = c->tasks[i];
+		uint32_t j = i;
+		for (; j > 0 && c->tasks[j - 1].offset > t.offset; j--)
+			c->tasks[j] = c->tasks[j - 1];
+		c->tasks[j] = t;
+	}
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < tasks; i++) {
+		memmove(out + n, out + c->tasks[i].offset, c->tasks[i].count * sizeof(uint32_t));
+		n += c->tasks[i].count;
+	}
+	return n;
+}
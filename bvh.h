@@ -0,0 +1,107 @@
+// bounding volume hierarchy over axis-aligned bounding boxes
+// Items are identified by their index in Bvh.boxes. The tree is built with
+// the binned surface area heuristic and refitted in place when the boxes
+// move; once refitting has degraded the tree too much, it is rebuilt.
+// requires:
+// #include <SDL.h>
+// #include <cglm/cglm.h>
+// #include "jobs.h"
+
+#define BVH_NONE UINT32_MAX
+
+typedef struct Aabb {
+	vec3 min;
+	vec3 max;
+} Aabb;
+
+// inner nodes have count == 0 and children at first and first + 1
+// leaves reference count items starting at Bvh.items[first]
+// a tree without items only has a root with count == 0 and no children, so
+// every traversal checks Bvh.itemCount first
+typedef struct BvhNode {
+	Aabb box;
+	uint32_t first;
+	uint32_t count;
+} BvhNode;
+
+typedef struct Bvh {
+	uint32_t itemCount;
+	Aabb *boxes; // input, filled by the user
+	uint32_t *items; // item indices in leaf order
+	uint32_t nodeCount;
+	BvhNode *nodes; // nodes[0] is the root, children always follow their parent
+	float builtCost; // sah cost right after the last rebuild
+	float cost; // sah cost after the last refit
+	uint32_t rebuilds;
+} Bvh;
+
+// planes in structure-of-arrays layout, padded to a multiple of 4 for simd
+// a point p is inside plane i if n.p + d >= 0
+typedef struct Frustum {
+	float nx[8], ny[8], nz[8], d[8];
+} Frustum;
+
+// subtrees culled per job system slot, more than one to balance uneven subtrees
+#define BVH_TASKS_PER_THREAD 4
+
+typedef struct BvhCuller BvhCuller;
+
+// one subtree, culled as a job
+typedef struct BvhCullTask {
+	BvhCuller *c;
+	uint32_t root;
+	uint32_t offset; // first item of the subtree, where its output is written
+	uint32_t count; // visible items
+} BvhCullTask;
+
+// runs frustum queries on a job system, split into subtrees
+struct BvhCuller {
+	JobSystem *jobs;
+	uint32_t maxTasks;
+	uint32_t *roots; // queue used for splitting the tree
+	BvhCullTask *tasks;
+	// current query
+	const Bvh *bvh;
+	Frustum fr;
+	uint32_t *out;
+};
+
+void bvhInit(Bvh *b, uint32_t itemCount);
+
+void bvhDestroy(Bvh *b);
+
+// full rebuild from b->boxes
+void bvhBuild(Bvh *b);
+
+// recomputes the node bounds from b->boxes, keeping the topology
+void bvhRefit(Bvh *b);
+
+// refits the tree and rebuilds it if the sah cost grew by more than maxGrowth
+// (e.g. 0.5 for 50%)
+// returns 1 if the tree was rebuilt
+char bvhUpdate(Bvh *b, float maxGrowth);
+
+// m is a view-projection matrix
+void frustumFromMatrix(Frustum *f, mat4 m);
+
+// returns 1 if the box intersects or is inside the frustum
+char frustumTestAabb(const Frustum *f, const Aabb *box);
+
+// writes visible items to out (which must hold b->itemCount items)
+// returns the number of visible items
+uint32_t bvhCullFrustum(const Bvh *b, const Frustum *f, uint32_t *out);
+
+// tests every box without using the tree
+uint32_t bruteCullFrustum(const Aabb *boxes, uint32_t count, const Frustum *f, uint32_t *out);
+
+// returns the item whose box is hit first by the ray, or BVH_NONE
+// *t is set to the distance along dir
+uint32_t bvhRaycast(const Bvh *b, vec3 origin, vec3 dir, float *t);
+
+void bvhCullerInit(BvhCuller *c, JobSystem *jobs);
+
+void bvhCullerDestroy(BvhCuller *c);
+
+// same as bvhCullFrustum, but splits the tree into jobs
+// must be called from a thread of the job system
+uint32_t bvhCullerRun(BvhCuller *c, const Bvh *b, const Frustum *f, uint32_t *out);
@@ -0,0 +1,436 @@
+// asynchronous readback of rendered frames
+
+#include <SDL.h>
+#include <vulkan.h>
+#include <vk_mem_alloc.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "log.h"
+#include "util.h"
+#include "capture.h"
+
+static const char *captureExtensions[] = {
+	[CAPTURE_RAW] = "raw",
+	[CAPTURE_PPM] = "ppm",
+	[CAPTURE_PNG] = "png",
+};
+
+int captureParseFormat(const char *name) {
+	for (uint32_t i = 0; i < LENGTH(captureExtensions); i++)
+		if (strcmp(name, captureExtensions[i]) == 0)
+			return i;
+	return -1;
+}
+
+char captureSupported(VkFormat fmt) {
+	switch (fmt) {
+		case VK_FORMAT_B8G8R8A8_UNORM:
+		case VK_FORMAT_B8G8R8A8_SRGB:
+		case VK_FORMAT_R8G8B8A8_UNORM:
+		case VK_FORMAT_R8G8B8A8_SRGB:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+// returns 1 if the red and blue channels of the image are swapped
+static char captureIsBgr(VkFormat fmt) {
+	switch (fmt) {
+		case VK_FORMAT_B8G8R8A8_UNORM:
+		case VK_FORMAT_B8G8R8A8_SRGB:
+			return 1;
+		case VK_FORMAT_R8G8B8A8_UNORM:
+		case VK_FORMAT_R8G8B8A8_SRGB:
+			return 0;
+		default:
+			panicf("capture: unsupported image format %d", fmt);
+	}
+}
+
+// converts 4-byte pixels to RGB, dst must hold w*3 bytes
+static void captureRowToRgb(uint8_t *dst, const uint8_t *src, uint32_t w, char bgr) {
+	uint32_t r = bgr ? 2 : 0, b = bgr ? 0 : 2;
+	for (uint32_t x = 0; x < w; x++) {
+		dst[3*x + 0] = src[4*x + r];
+		dst[3*x + 1] = src[4*x + 1];
+		dst[3*x + 2] = src[4*x + b];
+	}
+}
+
+static uint32_t crcTable[256];
+
+static void crcInit() {
+	for (uint32_t n = 0; n < 256; n++) {
+		uint32_t c = n;
+		for (int k = 0; k < 8; k++)
+			c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+		crcTable[n] = c;
+	}
+}
+
+static uint32_t crcUpdate(uint32_t crc, const uint8_t *buf, size_t len) {
+	for (size_t i = 0; i < len; i++)
+		crc = crcTable[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+static void putBe32(uint8_t *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void pngWriteChunk(FILE *f, const char *type, const uint8_t *data, uint32_t len) {
+	uint8_t hdr[8];
+	putBe32(hdr, len);
+	memcpy(hdr + 4, type, 4);
+	uint32_t crc = crcUpdate(0xFFFFFFFFu, hdr + 4, 4);
+	crc = crcUpdate(crc, data, len) ^ 0xFFFFFFFFu;
+	uint8_t tail[4];
+	putBe32(tail, crc);
+	fwrite(hdr, 1, 8, f);
+	fwrite(data, 1, len, f);
+	fwrite(tail, 1, 4, f);
+}
+
+// Encoding is dominated by the disk, so the image data is stored without
+// compression (deflate "stored" blocks), which costs a single copy.
+static uint64_t captureWritePng(FILE *f, const uint8_t *px, VkExtent2D ext, char bgr) {
+	static const uint8_t sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	fwrite(sig, 1, 8, f);
+
+	uint8_t ihdr[13] = {};
+	putBe32(ihdr, ext.width);
+	putBe32(ihdr + 4, ext.height);
+	ihdr[8] = 8; // bit depth
+	ihdr[9] = 2; // color type: RGB
+	pngWriteChunk(f, "IHDR", ihdr, sizeof(ihdr));
+
+	// raw scanlines with filter type 0
+	size_t stride = 1 + 3 * (size_t)ext.width;
+	size_t rawlen = stride * ext.height;
+	size_t blocks = rawlen / 65535 + 1;
+	size_t zlen = 2 + rawlen + 5 * blocks + 4;
+	uint8_t *z = malloc(zlen);
+	mustPtr(z, "png zlib stream, len = %zu", zlen);
+
+	uint8_t *raw = malloc(rawlen);
+	mustPtr(raw, "png scanlines, len = %zu", rawlen);
+	for (uint32_t y = 0; y < ext.height; y++) {
+		raw[y * stride] = 0;
+		captureRowToRgb(raw + y * stride + 1, px + (size_t)y * ext.width * 4, ext.width, bgr);
+	}
+
+	uint8_t *p = z;
+	*p++ = 0x78; // deflate, 32K window
+	*p++ = 0x01; // no preset dictionary, fastest
+	uint32_t a = 1, b = 0; // adler32
+	size_t n;
+	for (size_t off = 0; off < rawlen; off += n) {
+		n = rawlen - off > 65535 ? 65535 : rawlen - off;
+		*p++ = off + n == rawlen; // BFINAL, BTYPE = 00
+		*p++ = n & 0xFF;
+		*p++ = n >> 8;
+		*p++ = ~n & 0xFF;
+		*p++ = (~n >> 8) & 0xFF;
+		memcpy(p, raw + off, n);
+		for (size_t i = 0; i < n; i++) {
+			a = (a + raw[off + i]) % 65521;
+			b = (b + a) % 65521;
+		}
+		p += n;
+	}
+	putBe32(p, (b << 16) | a);
+	p += 4;
+	pngWriteChunk(f, "IDAT", z, p - z);
+	pngWriteChunk(f, "IEND", NULL, 0);
+
+	free(raw);
+	free(z);
+	return 8 + 25 + (p - z) + 12 + 12;
+}
+
+static uint64_t captureWritePpm(FILE *f, const uint8_t *px, VkExtent2D ext, char bgr) {
+	int hdr = fprintf(f, "P6\n%"PRIu32" %"PRIu32"\n255\n", ext.width, ext.height);
+	uint8_t *row = malloc(3 * (size_t)ext.width);
+	mustPtr(row, "ppm row, len = %"PRIu32, 3 * ext.width);
+	for (uint32_t y = 0; y < ext.height; y++) {
+		captureRowToRgb(row, px + (size_t)y * ext.width * 4, ext.width, bgr);
+		fwrite(row, 1, 3 * (size_t)ext.width, f);
+	}
+	free(row);
+	return hdr + 3 * (uint64_t)ext.width * ext.height;
+}
+
+static void captureEncode(Capture *c, CaptureSlot *slot) {
+	char path[4096];
+	if (c->format == CAPTURE_RAW) {
+		snprintf(path, sizeof(path), "%s/frame%06"PRIu64"_%"PRIu32"x%"PRIu32".%s", c->dir, slot->frame,
+			slot->extent.width, slot->extent.height, captureExtensions[c->format]);
+	} else {
+		snprintf(path, sizeof(path), "%s/frame%06"PRIu64".%s", c->dir, slot->frame, captureExtensions[c->format]);
+	}
+	FILE *f = fopen(path, "wb");
+	if (f == NULL) {
+		errorf("capture: failed to open %s", path);
+		return;
+	}
+	char bgr = captureIsBgr(c->imgfmt);
+	uint64_t n = 0;
+	switch (c->format) {
+		case CAPTURE_RAW:
+			n = 4 * (uint64_t)slot->extent.width * slot->extent.height;
+			fwrite(slot->data, 1, n, f);
+			break;
+		case CAPTURE_PPM:
+			n = captureWritePpm(f, slot->data, slot->extent, bgr);
+			break;
+		case CAPTURE_PNG:
+			n = captureWritePng(f, slot->data, slot->extent, bgr);
+			break;
+	}
+	fclose(f);
+	c->bytes += n;
+}
+
+static int captureWorker(void *data) {
+	Capture *c = data;
+	for (;;) {
+		SDL_LockMutex(c->mtx);
+		while (c->queued == 0 && !c->quit)
+			SDL_CondWait(c->cond, c->mtx);
+		if (c->queued == 0 && c->quit) {
+			SDL_UnlockMutex(c->mtx);
+			return 0;
+		}
+		CaptureSlot *slot = &c->slots[c->head];
+		SDL_UnlockMutex(c->mtx);
+
+		// wait for the copy, not for the whole frame ring
+		VkSemaphoreWaitInfo swi = {};
+		swi.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+		swi.semaphoreCount = 1;
+		swi.pSemaphores = &c->timeline;
+		swi.pValues = &slot->value;
+		must(vkWaitSemaphores(c->dev, &swi, UINT64_MAX));
+		must(vmaInvalidateAllocation(c->vma, slot->alloc, 0, VK_WHOLE_SIZE));
+
+		uint64_t start = SDL_GetPerformanceCounter();
+		captureEncode(c, slot);
+		c->encodeTicks += SDL_GetPerformanceCounter() - start;
+		SDL_AtomicAdd(&c->encoded, 1);
+
+		SDL_LockMutex(c->mtx);
+		SDL_AtomicSet(&slot->state, CAPTURE_SLOT_FREE);
+		c->head = (c->head + 1) % c->count;
+		c->queued--;
+		SDL_CondBroadcast(c->cond);
+		SDL_UnlockMutex(c->mtx);
+	}
+}
+
+static void captureCreateBuffers(Capture *c) {
+	c->slots = calloc(c->count, sizeof(CaptureSlot));
+	mustPtr(c->slots, "capture slots array, len = %"PRIu32, c->count);
+	for (uint32_t i = 0; i < c->count; i++) {
+		CaptureSlot *slot = &c->slots[i];
+		VkBufferCreateInfo bci = {};
+		bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bci.size = 4 * (VkDeviceSize)c->extent.width * c->extent.height;
+		bci.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		VmaAllocationCreateInfo aci = {};
+		aci.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+		aci.usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST;
+		VmaAllocationInfo ai;
+		must(vmaCreateBuffer(c->vma, &bci, &aci, &slot->buf, &slot->alloc, &ai));
+		slot->data = ai.pMappedData;
+		SDL_AtomicSet(&slot->state, CAPTURE_SLOT_FREE);
+	}
+	c->next = 0;
+	c->head = 0;
+	c->queued = 0;
+}
+
+static void captureDestroyBuffers(Capture *c) {
+	for (uint32_t i = 0; i < c->count; i++)
+		vmaDestroyBuffer(c->vma, c->slots[i].buf, c->slots[i].alloc);
+	free(c->slots);
+	c->slots = NULL;
+}
+
+// waits until the worker has written all queued frames
+static void captureDrain(Capture *c) {
+	SDL_LockMutex(c->mtx);
+	while (c->queued > 0)
+		SDL_CondWait(c->cond, c->mtx);
+	SDL_UnlockMutex(c->mtx);
+}
+
+void captureInit(Capture *c, VkDevice dev, VmaAllocator vma, uint32_t count, VkFormat imgfmt, VkExtent2D extent) {
+	mustCondition(captureSupported(imgfmt), "capture of image format %d is supported", imgfmt);
+	c->dev = dev;
+	c->vma = vma;
+	c->count = count;
+	c->imgfmt = imgfmt;
+	c->extent = extent;
+	c->value = 0;
+	c->quit = 0;
+	c->captured = 0;
+	c->dropped = 0;
+	c->bytes = 0;
+	c->encodeTicks = 0;
+	SDL_AtomicSet(&c->encoded, 0);
+	c->startTicks = SDL_GetPerformanceCounter();
+	crcInit();
+
+	VkSemaphoreTypeCreateInfo stci = {};
+	stci.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	stci.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	stci.initialValue = 0;
+	VkSemaphoreCreateInfo sci = {};
+	sci.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	sci.pNext = &stci;
+	must(vkCreateSemaphore(dev, &sci, NULL, &c->timeline));
+
+	captureCreateBuffers(c);
+
+	c->mtx = SDL_CreateMutex();
+	mustPtr(c->mtx, "capture mutex: %s", SDL_GetError());
+	c->cond = SDL_CreateCond();
+	mustPtr(c->cond, "capture condition variable: %s", SDL_GetError());
+	c->thread = SDL_CreateThread(captureWorker, "capture", c);
+	mustPtr(c->thread, "capture thread: %s", SDL_GetError());
+
+	infof("capture enabled (%"PRIu32" buffers, %s, %s)", count, captureExtensions[c->format], c->dir);
+}
+
+void captureDestroy(Capture *c) {
+	SDL_LockMutex(c->mtx);
+	c->quit = 1;
+	SDL_CondBroadcast(c->cond);
+	SDL_UnlockMutex(c->mtx);
+	SDL_WaitThread(c->thread, NULL);
+	capturePrintStats(c);
+	SDL_DestroyCond(c->cond);
+	SDL_DestroyMutex(c->mtx);
+	captureDestroyBuffers(c);
+	vkDestroySemaphore(c->dev, c->timeline, NULL);
+}
+
+void captureResize(Capture *c, VkExtent2D extent) {
+	captureDrain(c);
+	captureDestroyBuffers(c);
+	c->extent = extent;
+	captureCreateBuffers(c);
+}
+
+char captureRecord(Capture *c, VkCommandBuffer cmd, VkImage img, uint64_t frame) {
+	CaptureSlot *slot = &c->slots[c->next];
+	if (SDL_AtomicGet(&slot->state) != CAPTURE_SLOT_FREE) {
+		c->dropped++;
+		return 0;
+	}
+	SDL_AtomicSet(&slot->state, CAPTURE_SLOT_RECORDED);
+	slot->value = ++c->value;
+	slot->frame = frame;
+	slot->extent = c->extent;
+
+	VkImageSubresourceRange range = {
+		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+		.baseMipLevel = 0,
+		.levelCount = 1,
+		.baseArrayLayer = 0,
+		.layerCount = 1,
+	};
+	VkImageMemoryBarrier2 toSrc = {};
+	toSrc.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+	toSrc.srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+	toSrc.srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+	toSrc.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+	toSrc.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT;
+	toSrc.oldLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
+	toSrc.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	toSrc.image = img;
+	toSrc.subresourceRange = range;
+	vkCmdPipelineBarrier2(cmd, &(VkDependencyInfo){
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.imageMemoryBarrierCount = 1,
+		.pImageMemoryBarriers = &toSrc,
+	});
+
+	VkBufferImageCopy bic = {};
+	bic.bufferOffset = 0;
+	bic.bufferRowLength = 0; // tightly packed
+	bic.bufferImageHeight = 0;
+	bic.imageSubresource = (VkImageSubresourceLayers){
+		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+		.mipLevel = 0,
+		.baseArrayLayer = 0,
+		.layerCount = 1,
+	};
+	bic.imageExtent = (VkExtent3D){c->extent.width, c->extent.height, 1};
+	vkCmdCopyImageToBuffer(cmd, img, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot->buf, 1, &bic);
+
+	VkImageMemoryBarrier2 toPresent = toSrc;
+	toPresent.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+	toPresent.srcAccessMask = VK_ACCESS_2_NONE;
+	toPresent.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+	toPresent.dstAccessMask = VK_ACCESS_2_NONE;
+	toPresent.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	toPresent.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	VkBufferMemoryBarrier2 toHost = {};
+	toHost.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+	toHost.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+	toHost.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+	toHost.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT;
+	toHost.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT;
+	toHost.buffer = slot->buf;
+	toHost.offset = 0;
+	toHost.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier2(cmd, &(VkDependencyInfo){
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.bufferMemoryBarrierCount = 1,
+		.pBufferMemoryBarriers = &toHost,
+		.imageMemoryBarrierCount = 1,
+		.pImageMemoryBarriers = &toPresent,
+	});
+
+	c->captured++;
+	return 1;
+}
+
+VkSemaphoreSubmitInfo captureSignal(Capture *c) {
+	return (VkSemaphoreSubmitInfo){
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+		.semaphore = c->timeline,
+		.value = c->value,
+		.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+	};
+}
+
+void captureCommit(Capture *c) {
+	SDL_LockMutex(c->mtx);
+	SDL_AtomicSet(&c->slots[c->next].state, CAPTURE_SLOT_QUEUED);
+	c->queued++;
+	SDL_CondSignal(c->cond);
+	SDL_UnlockMutex(c->mtx);
+	c->next = (c->next + 1) % c->count;
+}
+
+void capturePrintStats(Capture *c) {
+	double elapsed = (double)(SDL_GetPerformanceCounter() - c->startTicks) / SDL_GetPerformanceFrequency();
+	double encoding = (double)c->encodeTicks / SDL_GetPerformanceFrequency();
+	uint32_t encoded = SDL_AtomicGet(&c->encoded);
+	if (elapsed <= 0)
+		elapsed = 1e-9;
+	infof("capture: %"PRIu64" captured, %"PRIu32" written (%.1f frames/s, %.1f MB/s, %.2f ms/frame encoding), %"PRIu64" dropped",
+		c->captured, encoded, encoded / elapsed, c->bytes / elapsed / 1e6,
+		encoded ? 1000.0 * encoding / encoded : 0.0, c->dropped);
+}
@@ -0,0 +1,87 @@
+// asynchronous readback of rendered frames
+// The rendered image is copied into a host-visible buffer at the end of the
+// frame's command buffer. A worker thread waits until the copy is complete
+// (timeline semaphore) and encodes the buffer to a file, so the render loop
+// never waits for the disk. If all slots are busy, the frame is dropped.
+
+typedef enum CaptureFormat {
+	CAPTURE_RAW, // pixels as stored in the image
+	CAPTURE_PPM, // binary RGB netpbm
+	CAPTURE_PNG, // RGB, uncompressed deflate
+} CaptureFormat;
+
+typedef enum CaptureSlotState {
+	CAPTURE_SLOT_FREE,
+	CAPTURE_SLOT_RECORDED, // copy recorded, not yet handed to the worker
+	CAPTURE_SLOT_QUEUED, // waiting for the gpu or being encoded
+} CaptureSlotState;
+
+typedef struct CaptureSlot {
+	VkBuffer buf;
+	VmaAllocation alloc;
+	void *data; // persistently mapped
+	uint64_t value; // timeline value signalled after the copy
+	uint64_t frame; // frame number, used for the file name
+	VkExtent2D extent;
+	SDL_atomic_t state; // CaptureSlotState
+} CaptureSlot;
+
+typedef struct Capture {
+	VkDevice dev;
+	VmaAllocator vma;
+	CaptureFormat format;
+	const char *dir;
+	VkFormat imgfmt;
+	VkExtent2D extent;
+	VkSemaphore timeline;
+	uint64_t value; // last timeline value used
+	uint32_t count;
+	CaptureSlot *slots;
+	uint32_t next; // slot used by the next capture
+	// queue of slots to be encoded (guarded by mtx)
+	SDL_Thread *thread;
+	SDL_mutex *mtx;
+	SDL_cond *cond;
+	uint32_t head; // next slot to be encoded
+	uint32_t queued;
+	char quit;
+	// statistics
+	uint64_t captured;
+	uint64_t dropped;
+	SDL_atomic_t encoded;
+	uint64_t bytes; // written by the worker
+	uint64_t encodeTicks; // time spent encoding, SDL performance counter ticks
+	uint64_t startTicks;
+} Capture;
+
+// returns 1 if images of the format can be captured: 8-bit RGBA or BGRA
+char captureSupported(VkFormat fmt);
+
+// c->format and c->dir must be set, imgfmt must be supported
+// count is the number of readback buffers
+void captureInit(Capture *c, VkDevice dev, VmaAllocator vma, uint32_t count, VkFormat imgfmt, VkExtent2D extent);
+
+// waits until all queued frames are written
+void captureDestroy(Capture *c);
+
+// waits until all queued frames are written and recreates the buffers
+// caller has to ensure that the buffers are no longer in use by the gpu
+void captureResize(Capture *c, VkExtent2D extent);
+
+// Records a copy of img (in VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL after color
+// attachment writes) and leaves it in VK_IMAGE_LAYOUT_PRESENT_SRC_KHR.
+// Returns 0 without recording anything if no slot is available, in which case
+// the caller is responsible for the transition.
+// If 1 is returned, the semaphore from captureSignal must be signalled by the
+// submission and captureCommit called after it.
+char captureRecord(Capture *c, VkCommandBuffer cmd, VkImage img, uint64_t frame);
+
+VkSemaphoreSubmitInfo captureSignal(Capture *c);
+
+// hands the recorded slot to the worker
+void captureCommit(Capture *c);
+
+void capturePrintStats(Capture *c);
+
+// returns -1 if the name is unknown
+int captureParseFormat(const char *name);
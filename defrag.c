@@ -0,0 +1,187 @@
+// incremental defragmentation of device memory
+
+#include <vulkan.h>
+#include <vk_mem_alloc.h>
+#include <SDL.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "log.h"
+#include "util.h"
+#include "bindless.h"
+#include "defrag.h"
+
+void defragInit(Defrag *d, VkDevice dev, VmaAllocator vma, Bindless *b, uint32_t framesInFlight, float budgetMs, VkDeviceSize bytesPerPass) {
+	*d = (Defrag){};
+	d->dev = dev;
+	d->vma = vma;
+	d->bindless = b;
+	d->framesInFlight = framesInFlight;
+	d->budgetTicks = (uint64_t)(budgetMs / 1000.0 * SDL_GetPerformanceFrequency());
+	d->bytesPerPass = bytesPerPass;
+	d->ctx = VK_NULL_HANDLE;
+}
+
+void defragRegister(Defrag *d, VmaAllocation alloc, DefragBuffer *db) {
+	vmaSetAllocationUserData(d->vma, alloc, db);
+}
+
+float defragPrintStats(Defrag *d) {
+	VmaTotalStatistics ts;
+	vmaCalculateStatistics(d->vma, &ts);
+	const VmaDetailedStatistics *t = &ts.total;
+	VkDeviceSize free = t->statistics.blockBytes - t->statistics.allocationBytes;
+	float fragmentation = free > 0 && t->unusedRangeCount > 0 ? 1.0f - (float)t->unusedRangeSizeMax / free : 0.0f;
+	infof("memory: %.1f MiB in %"PRIu32" blocks, %.1f MiB in %"PRIu32" allocations, %.1f MiB free in %"PRIu32" ranges (largest %.1f MiB), fragmentation %.0f%%",
+		t->statistics.blockBytes / 1048576.0, t->statistics.blockCount,
+		t->statistics.allocationBytes / 1048576.0, t->statistics.allocationCount,
+		free / 1048576.0, t->unusedRangeCount, t->unusedRangeCount > 0 ? t->unusedRangeSizeMax / 1048576.0 : 0.0,
+		100.0f * fragmentation);
+	return fragmentation;
+}
+
+// returns 1 if a defragmentation was started
+static char defragStart(Defrag *d) {
+	VmaTotalStatistics ts;
+	vmaCalculateStatistics(d->vma, &ts);
+	const VmaDetailedStatistics *t = &ts.total;
+	VkDeviceSize free = t->statistics.blockBytes - t->statistics.allocationBytes;
+	if (free < DEFRAG_MIN_FREE || t->unusedRangeCount < 2)
+		return 0;
+	if (1.0f - (float)t->unusedRangeSizeMax / free < DEFRAG_THRESHOLD)
+		return 0;
+
+	infof("defragmentation started");
+	d->fragmentationBefore = defragPrintStats(d);
+	VmaDefragmentationInfo dfi = {};
+	dfi.maxBytesPerPass = d->bytesPerPass;
+	dfi.maxAllocationsPerPass = DEFRAG_MOVES_MAX;
+	must(vmaBeginDefragmentation(d->vma, &dfi, &d->ctx));
+	d->passes = 0;
+	return 1;
+}
+
+static void defragFinish(Defrag *d) {
+	VmaDefragmentationStats st;
+	vmaEndDefragmentation(d->vma, d->ctx, &st);
+	d->ctx = VK_NULL_HANDLE;
+	infof("defragmentation done in %"PRIu32" passes: %"PRIu32" allocations moved (%.1f MiB), %.1f MiB and %"PRIu32" blocks freed",
+		d->passes, st.allocationsMoved, st.bytesMoved / 1048576.0, st.bytesFreed / 1048576.0, st.deviceMemoryBlocksFreed);
+	float after = defragPrintStats(d);
+	infof("fragmentation: %.0f%% before, %.0f%% after", 100.0f * d->fragmentationBefore, 100.0f * after);
+}
+
+// releases the old buffers, VMA frees their memory and moves the
+// allocations to their new place
+static void defragEndPass(Defrag *d) {
+	for (uint32_t i = 0; i < d->oldCount; i++)
+		vkDestroyBuffer(d->dev, d->old[i], NULL);
+	d->oldCount = 0;
+	d->passActive = 0;
+	VkResult r = vmaEndDefragmentationPass(d->vma, d->ctx, &d->pass);
+	if (r == VK_SUCCESS || d->passes >= DEFRAG_PASSES_MAX)
+		defragFinish(d);
+	else if (r != VK_INCOMPLETE)
+		must(r);
+}
+
+static void defragBarrier(VkCommandBuffer cmd, VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess,
+		VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess) {
+	VkMemoryBarrier2 mb = {};
+	mb.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+	mb.srcStageMask = srcStage;
+	mb.srcAccessMask = srcAccess;
+	mb.dstStageMask = dstStage;
+	mb.dstAccessMask = dstAccess;
+	VkDependencyInfo di = {};
+	di.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+	di.memoryBarrierCount = 1;
+	di.pMemoryBarriers = &mb;
+	vkCmdPipelineBarrier2(cmd, &di);
+}
+
+// moves the buffers of the pass that fit in the time budget
+static void defragMoves(Defrag *d, VkCommandBuffer cmd, uint64_t frame) {
+	uint64_t start = SDL_GetPerformanceCounter();
+	char copied = 0;
+	for (uint32_t i = 0; i < d->pass.moveCount; i++) {
+		VmaDefragmentationMove *m = &d->pass.pMoves[i];
+		VmaAllocationInfo src, dst;
+		vmaGetAllocationInfo(d->vma, m->srcAllocation, &src);
+		vmaGetAllocationInfo(d->vma, m->dstTmpAllocation, &dst);
+		DefragBuffer *db = src.pUserData;
+		// unregistered (images, buffers whose users can't be updated), over
+		// budget, or its mapping can't be replaced
+		if (db == NULL || SDL_GetPerformanceCounter() - start > d->budgetTicks || (db->mapped != NULL && dst.pMappedData == NULL)) {
+			m->operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+			continue;
+		}
+
+		VkBuffer buf;
+		must(vkCreateBuffer(d->dev, &db->info, NULL, &buf));
+		must(vmaBindBufferMemory(d->vma, m->dstTmpAllocation, buf));
+		if (db->copy) {
+			if (!copied) {
+				// earlier submissions may still write the old buffers
+				defragBarrier(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_WRITE_BIT,
+					VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT);
+				copied = 1;
+			}
+			vkCmdCopyBuffer(cmd, *db->buf, buf, 1, &(VkBufferCopy){0, 0, db->info.size});
+		}
+
+		// earlier frames keep using the old buffer through the old index
+		d->old[d->oldCount++] = *db->buf;
+		*db->buf = buf;
+		if (db->index != NULL) {
+			bindlessRemoveBuffer(d->bindless, *db->index, frame);
+			*db->index = bindlessAddBuffer(d->bindless, buf, 0, VK_WHOLE_SIZE);
+		}
+		if (db->mapped != NULL)
+			*db->mapped = dst.pMappedData;
+		if (db->moved != NULL)
+			db->moved(db->arg);
+	}
+	if (copied) {
+		defragBarrier(cmd, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+			VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT);
+	}
+}
+
+char defragUpdate(Defrag *d, VkCommandBuffer cmd, uint64_t frame) {
+	if (d->passActive) {
+		if (frame < d->passFrame + d->framesInFlight)
+			return 1;
+		defragEndPass(d);
+		// the next pass starts in the next frame
+		return d->ctx != VK_NULL_HANDLE;
+	}
+	if (d->ctx == VK_NULL_HANDLE) {
+		if (frame - d->lastCheck < DEFRAG_CHECK_FRAMES)
+			return 0;
+		d->lastCheck = frame;
+		if (!defragStart(d))
+			return 0;
+	}
+
+	VkResult r = vmaBeginDefragmentationPass(d->vma, d->ctx, &d->pass);
+	if (r == VK_SUCCESS) {
+		defragFinish(d);
+		return 0;
+	}
+	mustCondition(r == VK_INCOMPLETE, "vmaBeginDefragmentationPass: VkResult=%d", r);
+	d->passes++;
+	defragMoves(d, cmd, frame);
+	d->passActive = 1;
+	d->passFrame = frame;
+	return 1;
+}
+
+void defragDestroy(Defrag *d) {
+	if (d->passActive)
+		defragEndPass(d);
+	if (d->ctx != VK_NULL_HANDLE)
+		defragFinish(d);
+}
@@ -0,0 +1,76 @@
+// incremental defragmentation of device memory
+// Fragmentation is checked periodically and, when the free memory is split
+// into many small ranges, VMA's defragmentation runs one pass per frame.
+// Only registered buffers are moved (their allocation's user data is a
+// DefragBuffer), everything else stays in place. A moved buffer is recreated
+// on the new memory, its contents are copied on the gpu and the references
+// to it are replaced at the frame boundary; the old buffer and memory are
+// released once the frames that could use them have completed.
+// requires:
+// #include <vulkan.h>
+// #include <vk_mem_alloc.h>
+// #include "bindless.h"
+
+#define DEFRAG_CHECK_FRAMES 600 // frames between fragmentation checks
+#define DEFRAG_THRESHOLD 0.5f // fragmentation which starts a defragmentation
+#define DEFRAG_MIN_FREE (4 << 20) // bytes, less free memory isn't worth it
+#define DEFRAG_MOVES_MAX 64 // per pass
+#define DEFRAG_PASSES_MAX 64 // per defragmentation
+
+// buffer usage needed by buffers whose contents are copied when moved
+#define DEFRAG_BUFFER_USAGE (VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT)
+
+typedef void (*DefragMovedFunc)(void *arg);
+
+// a movable buffer, owned by the user
+typedef struct DefragBuffer {
+	VkBufferCreateInfo info; // used to recreate the buffer
+	VkBuffer *buf; // replaced when moved
+	uint32_t *index; // bindless buffer index replaced when moved, NULL if none
+	void **mapped; // persistent mapping replaced when moved, NULL if none
+	// 0 if the contents aren't copied, the owner rewrites them before the
+	// next use, notified by moved
+	char copy;
+	DefragMovedFunc moved; // called after a move if not NULL
+	void *arg;
+} DefragBuffer;
+
+typedef struct Defrag {
+	VkDevice dev;
+	VmaAllocator vma;
+	Bindless *bindless;
+	uint32_t framesInFlight;
+	uint64_t budgetTicks; // cpu time per pass, SDL performance counter ticks
+	VkDeviceSize bytesPerPass; // bounds the gpu copy time of a pass
+	uint64_t lastCheck; // frame number
+	VmaDefragmentationContext ctx; // VK_NULL_HANDLE when not defragmenting
+	uint32_t passes;
+	char passActive; // moves of the pass are waiting for their frames
+	uint64_t passFrame; // frame which recorded the copies
+	VmaDefragmentationPassMoveInfo pass;
+	uint32_t oldCount;
+	VkBuffer old[DEFRAG_MOVES_MAX]; // replaced buffers of the pass
+	float fragmentationBefore;
+} Defrag;
+
+// budgetMs limits the cpu time of a pass, bytesPerPass the amount of memory
+// moved (and copied) per pass
+void defragInit(Defrag *d, VkDevice dev, VmaAllocator vma, Bindless *b, uint32_t framesInFlight, float budgetMs, VkDeviceSize bytesPerPass);
+
+// ends a running defragmentation, the device must be idle
+void defragDestroy(Defrag *d);
+
+// makes the buffer of alloc movable, db must stay valid while it exists and
+// db->buf, db->index and db->mapped must be set
+void defragRegister(Defrag *d, VmaAllocation alloc, DefragBuffer *db);
+
+// Runs at the frame boundary after the frame's fence was waited for, before
+// the references to movable buffers are used for the frame. Copies are
+// recorded into cmd, which must be executed before the moved buffers are
+// used. frame is the current frame number.
+// Returns 1 while a defragmentation is in progress.
+char defragUpdate(Defrag *d, VkCommandBuffer cmd, uint64_t frame);
+
+// logs the fragmentation of all memory, returns the fragmentation: the part
+// of the free memory outside the largest free range
+float defragPrintStats(Defrag *d);
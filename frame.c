@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <inttypes.h>
 
+#include "log.h"
 #include "util.h"
 #include "frame.h"
 
@@ -36,6 +37,7 @@ void frameDestroy(Frame *f, VkDevice dev, VkCommandPool cmdpl) {
 // queueFamilyIndex is used for creating a command pool
 void framesInit(Frames *f, VkDevice dev, uint32_t queueFamilyIndex) {
 	f->current = 0;
+	f->timestamps = VK_NULL_HANDLE;
 	// f->cmdpl
 	VkCommandPoolCreateInfo cmdplci = {};
 	cmdplci.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -58,6 +60,9 @@ void framesDestroy(Frames *f, VkDevice dev) {
 	}
 	free(f->frames);
 	f->frames = NULL;
+	// f->timestamps
+	if (f->timestamps != VK_NULL_HANDLE)
+		vkDestroyQueryPool(dev, f->timestamps, NULL);
 	// f->cmdpl
 	vkDestroyCommandPool(dev, f->cmdpl, NULL);
 }
@@ -66,3 +71,38 @@ Frame *framesNext(Frames *f) {
 	f->current = (f->current + 1) % f->count;
 	return &f->frames[f->current];
 }
+
+void framesInitTimestamps(Frames *f, VkDevice dev, float period) {
+	VkQueryPoolCreateInfo qpci = {};
+	qpci.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	qpci.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	qpci.queryCount = 2 * f->count;
+	must(vkCreateQueryPool(dev, &qpci, NULL, &f->timestamps));
+	f->timestampPeriod = period;
+}
+
+void framesTimestampBegin(Frames *f, VkCommandBuffer cmd) {
+	if (f->timestamps == VK_NULL_HANDLE)
+		return;
+	vkCmdResetQueryPool(cmd, f->timestamps, 2 * f->current, 2);
+	vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, f->timestamps, 2 * f->current);
+}
+
+void framesTimestampEnd(Frames *f, VkCommandBuffer cmd) {
+	if (f->timestamps == VK_NULL_HANDLE)
+		return;
+	vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT, f->timestamps, 2 * f->current + 1);
+	f->frames[f->current].timed = 1;
+}
+
+uint64_t framesGpuTime(Frames *f, VkDevice dev) {
+	Frame *fr = &f->frames[f->current];
+	if (f->timestamps == VK_NULL_HANDLE || !fr->timed)
+		return 0;
+	fr->timed = 0;
+	uint64_t ts[2];
+	VkResult r = vkGetQueryPoolResults(dev, f->timestamps, 2 * f->current, 2, sizeof(ts), ts, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+	if (r != VK_SUCCESS || ts[1] < ts[0])
+		return 0;
+	return (uint64_t)((ts[1] - ts[0]) * (double)f->timestampPeriod);
+}
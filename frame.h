@@ -3,6 +3,7 @@
 typedef struct Frame {
 	VkCommandBuffer cmdbuf;
 	VkFence ready;
+	char timed; // the last submission wrote timestamps
 } Frame;
 
 typedef struct Frames {
@@ -10,6 +11,9 @@ typedef struct Frames {
 	uint32_t current;
 	VkCommandPool cmdpl;
 	Frame *frames;
+	// gpu timing, two timestamps per frame
+	VkQueryPool timestamps; // VK_NULL_HANDLE if disabled
+	float timestampPeriod; // ns per tick
 } Frames;
 
 void frameInit(Frame *f, VkDevice dev, VkCommandPool cmdpl);
@@ -25,3 +29,15 @@ void framesInit(Frames *f, VkDevice dev, uint32_t queueFamilyIndex);
 void framesDestroy(Frames *f, VkDevice dev);
 
 Frame *framesNext(Frames *f);
+
+// enables gpu timing, period is VkPhysicalDeviceLimits.timestampPeriod
+// the queue family must have timestampValidBits > 0
+void framesInitTimestamps(Frames *f, VkDevice dev, float period);
+
+// record the timestamps around the commands of the current frame
+void framesTimestampBegin(Frames *f, VkCommandBuffer cmd);
+void framesTimestampEnd(Frames *f, VkCommandBuffer cmd);
+
+// returns the gpu time of the previous submission of the current frame in ns
+// or 0 if unknown, its fence must have been waited for
+uint64_t framesGpuTime(Frames *f, VkDevice dev);
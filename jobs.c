@@ -0,0 +1,252 @@
+// work-stealing job system
+
+#include <SDL.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "log.h"
+#include "util.h"
+#include "jobs.h"
+
+// failed attempts to find a job before a worker or waiter goes to sleep
+#define JOBS_SPINS 256
+
+static _Thread_local JobSlot *jobsSelf;
+
+// number of jobs between top and bottom, also correct after wrapping around
+static int jobsQueueSize(int top, int bottom) {
+	return (int)((unsigned)bottom - (unsigned)top);
+}
+
+// SDL_AtomicSet and SDL_AtomicCAS are full barriers, which the deque relies on
+
+// owner only, returns 0 if the deque is full
+static char jobsPush(JobSlot *s, Job j) {
+	int b = SDL_AtomicGet(&s->bottom);
+	int t = SDL_AtomicGet(&s->top);
+	if (jobsQueueSize(t, b) >= JOBS_QUEUE_SIZE)
+		return 0;
+	s->q[(unsigned)b & (JOBS_QUEUE_SIZE - 1)] = j;
+	SDL_AtomicSet(&s->bottom, (int)((unsigned)b + 1));
+	return 1;
+}
+
+// owner only, takes the most recently pushed job
+static char jobsPop(JobSlot *s, Job *j) {
+	int b = (int)((unsigned)SDL_AtomicGet(&s->bottom) - 1);
+	SDL_AtomicSet(&s->bottom, b);
+	int t = SDL_AtomicGet(&s->top);
+	int size = jobsQueueSize(t, b);
+	if (size < 0) {
+		SDL_AtomicSet(&s->bottom, t);
+		return 0;
+	}
+	*j = s->q[(unsigned)b & (JOBS_QUEUE_SIZE - 1)];
+	if (size > 0)
+		return 1;
+	// the last job, thieves may be taking it at the same time
+	char won = SDL_AtomicCAS(&s->top, t, (int)((unsigned)t + 1));
+	SDL_AtomicSet(&s->bottom, (int)((unsigned)t + 1));
+	return won;
+}
+
+// any thread, takes the oldest job
+static char jobsSteal(JobSlot *s, Job *j) {
+	int t = SDL_AtomicGet(&s->top);
+	int b = SDL_AtomicGet(&s->bottom);
+	if (jobsQueueSize(t, b) <= 0)
+		return 0;
+	*j = s->q[(unsigned)t & (JOBS_QUEUE_SIZE - 1)];
+	return SDL_AtomicCAS(&s->top, t, (int)((unsigned)t + 1));
+}
+
+static char jobsFind(JobSystem *js, JobSlot *self, Job *j) {
+	char found = jobsPop(self, j);
+	for (uint32_t i = 1; !found && i < js->slotCount; i++) {
+		if (jobsSteal(&js->slots[(self->index + i) % js->slotCount], j)) {
+			SDL_AtomicAdd(&self->steals, 1);
+			found = 1;
+		}
+	}
+	if (found)
+		SDL_AtomicAdd(&js->queued, -1);
+	return found;
+}
+
+// wakes the threads sleeping in jobsWait, which check their counters again
+static void jobsWakeWaiters(JobSystem *js) {
+	if (SDL_AtomicGet(&js->waiting) > 0) {
+		SDL_LockMutex(js->lock);
+		SDL_CondBroadcast(js->done);
+		SDL_UnlockMutex(js->lock);
+	}
+}
+
+static void jobsExecute(JobSlot *self, const Job *j) {
+	uint64_t start = SDL_GetPerformanceCounter();
+	self->depth++;
+	j->fn(j->arg);
+	self->depth--;
+	// jobsWait checks the counter after increasing waiting, so either it
+	// sees zero or it is woken
+	if (j->counter != NULL && SDL_AtomicAdd(&j->counter->pending, -1) == 1)
+		jobsWakeWaiters(self->js);
+	// nested jobs run while waiting are already part of the outer job
+	if (self->depth == 0) {
+		uint64_t freq = SDL_GetPerformanceFrequency();
+		self->busyTicks += SDL_GetPerformanceCounter() - start;
+		uint64_t us = self->busyTicks * 1000000 / freq;
+		if (us > 0) {
+			SDL_AtomicAdd(&self->busy, (int)us);
+			self->busyTicks -= us * freq / 1000000;
+		}
+	}
+	SDL_AtomicAdd(&self->jobs, 1);
+}
+
+static int jobsWorker(void *data) {
+	JobSlot *self = data;
+	JobSystem *js = self->js;
+	jobsSelf = self;
+	Job j;
+	uint32_t spins = 0;
+	for (;;) {
+		if (jobsFind(js, self, &j)) {
+			jobsExecute(self, &j);
+			spins = 0;
+			continue;
+		}
+		if (++spins < JOBS_SPINS)
+			continue;
+		spins = 0;
+		// jobsRun checks sleeping after increasing queued, so a job queued
+		// after the check below always wakes a worker
+		SDL_LockMutex(js->lock);
+		SDL_AtomicAdd(&js->sleeping, 1);
+		while (!js->quit && SDL_AtomicGet(&js->queued) <= 0)
+			SDL_CondWait(js->wake, js->lock);
+		SDL_AtomicAdd(&js->sleeping, -1);
+		char quit = js->quit;
+		SDL_UnlockMutex(js->lock);
+		if (quit)
+			return 0;
+	}
+}
+
+void jobsInit(JobSystem *js, uint32_t workers, uint32_t external) {
+	js->workers = workers;
+	js->slotCount = workers + external;
+	mustCondition(js->slotCount > 0, "job system has at least one slot");
+	SDL_AtomicSet(&js->registered, 0);
+	SDL_AtomicSet(&js->queued, 0);
+	SDL_AtomicSet(&js->sleeping, 0);
+	SDL_AtomicSet(&js->waiting, 0);
+	js->quit = 0;
+	js->slots = aligned_alloc(_Alignof(JobSlot), js->slotCount * sizeof(JobSlot));
+	mustPtr(js->slots, "job slots, len = %"PRIu32, js->slotCount);
+	memset(js->slots, 0, js->slotCount * sizeof(JobSlot));
+	js->lock = SDL_CreateMutex();
+	mustPtr(js->lock, "job system mutex: %s", SDL_GetError());
+	js->wake = SDL_CreateCond();
+	mustPtr(js->wake, "job system condition variable: %s", SDL_GetError());
+	js->done = SDL_CreateCond();
+	mustPtr(js->done, "job system condition variable: %s", SDL_GetError());
+	js->statsStart = SDL_GetPerformanceCounter();
+	for (uint32_t i = 0; i < js->slotCount; i++) {
+		js->slots[i].js = js;
+		js->slots[i].index = i;
+	}
+	for (uint32_t i = 0; i < workers; i++) {
+		js->slots[i].th = SDL_CreateThread(jobsWorker, "job", &js->slots[i]);
+		mustPtr(js->slots[i].th, "job worker thread: %s", SDL_GetError());
+	}
+	infof("job system started (%"PRIu32" workers, %"PRIu32" external threads)", workers, external);
+}
+
+void jobsDestroy(JobSystem *js) {
+	SDL_LockMutex(js->lock);
+	js->quit = 1;
+	SDL_CondBroadcast(js->wake);
+	SDL_UnlockMutex(js->lock);
+	for (uint32_t i = 0; i < js->workers; i++)
+		SDL_WaitThread(js->slots[i].th, NULL);
+	SDL_DestroyCond(js->done);
+	SDL_DestroyCond(js->wake);
+	SDL_DestroyMutex(js->lock);
+	free(js->slots);
+}
+
+void jobsRegister(JobSystem *js) {
+	uint32_t i = js->workers + SDL_AtomicAdd(&js->registered, 1);
+	mustCondition(i < js->slotCount, "registered threads below %"PRIu32, js->slotCount - js->workers);
+	jobsSelf = &js->slots[i];
+}
+
+void jobsRun(JobSystem *js, JobFunc fn, void *arg, JobCounter *c) {
+	JobSlot *self = jobsSelf;
+	mustCondition(self != NULL && self->js == js, "thread is registered with the job system");
+	if (c != NULL)
+		SDL_AtomicAdd(&c->pending, 1);
+	Job j = {fn, arg, c};
+	SDL_AtomicAdd(&js->queued, 1);
+	if (!jobsPush(self, j)) {
+		SDL_AtomicAdd(&js->queued, -1);
+		jobsExecute(self, &j);
+		return;
+	}
+	if (SDL_AtomicGet(&js->sleeping) > 0) {
+		SDL_LockMutex(js->lock);
+		SDL_CondSignal(js->wake);
+		SDL_UnlockMutex(js->lock);
+	}
+	// a waiter can help with the new job
+	jobsWakeWaiters(js);
+}
+
+void jobsWait(JobSystem *js, JobCounter *c) {
+	JobSlot *self = jobsSelf;
+	mustCondition(self != NULL && self->js == js, "thread is registered with the job system");
+	Job j;
+	uint32_t spins = 0;
+	while (SDL_AtomicGet(&c->pending) > 0) {
+		if (jobsFind(js, self, &j)) {
+			jobsExecute(self, &j);
+			spins = 0;
+			continue;
+		}
+		if (++spins < JOBS_SPINS)
+			continue;
+		spins = 0;
+		// the remaining jobs run on other threads, sleep instead of taking
+		// time from them
+		SDL_LockMutex(js->lock);
+		SDL_AtomicAdd(&js->waiting, 1);
+		while (SDL_AtomicGet(&c->pending) > 0 && SDL_AtomicGet(&js->queued) <= 0)
+			SDL_CondWait(js->done, js->lock);
+		SDL_AtomicAdd(&js->waiting, -1);
+		SDL_UnlockMutex(js->lock);
+	}
+}
+
+void jobsPrintStats(JobSystem *js) {
+	uint64_t now = SDL_GetPerformanceCounter();
+	double elapsed = (now - js->statsStart) * 1e6 / SDL_GetPerformanceFrequency();
+	js->statsStart = now;
+	char line[512];
+	int len = 0;
+	for (uint32_t i = 0; i < js->slotCount && len < (int)sizeof(line); i++) {
+		JobSlot *s = &js->slots[i];
+		// swapping in zero takes each counter without losing concurrent
+		// additions; a job finishing in between may be split across reports
+		int busy = SDL_AtomicSet(&s->busy, 0);
+		int jobs = SDL_AtomicSet(&s->jobs, 0);
+		int steals = SDL_AtomicSet(&s->steals, 0);
+		len += snprintf(line + len, sizeof(line) - len, " %s%"PRIu32" %.0f%% (%d jobs, %d stolen)",
+			i < js->workers ? "w" : "ext", i < js->workers ? i : i - js->workers,
+			elapsed > 0 ? 100.0 * busy / elapsed : 0.0, jobs, steals);
+	}
+	infof("job utilization:%s", line);
+}
@@ -0,0 +1,80 @@
+// work-stealing job system
+// Every thread that runs jobs has a slot with its own deque. Jobs are pushed
+// and popped at the bottom of the own deque (most recent first, which keeps
+// nested work cache friendly) and stolen from the top of the other slots'
+// deques when it runs empty. Worker threads sleep when there is nothing to
+// do. Other threads register a slot to submit jobs, and help running them
+// while they wait for a counter; once there is nothing to help with, they
+// sleep until a counted job completes or another one is queued.
+// requires:
+// #include <SDL.h>
+
+#define JOBS_QUEUE_SIZE 1024 // per slot, must be a power of 2
+
+typedef void (*JobFunc)(void *arg);
+
+// number of unfinished jobs, zero-initialize before use
+typedef struct JobCounter {
+	SDL_atomic_t pending;
+} JobCounter;
+
+typedef struct Job {
+	JobFunc fn;
+	void *arg;
+	JobCounter *counter; // may be NULL
+} Job;
+
+typedef struct JobSystem JobSystem;
+
+// Chase-Lev deque, top and bottom grow without bound and wrap around
+typedef struct JobSlot {
+	_Alignas(64) SDL_atomic_t top; // stealing end
+	_Alignas(64) SDL_atomic_t bottom; // owner end
+	_Alignas(64) JobSystem *js;
+	uint32_t index;
+	SDL_Thread *th; // NULL for registered threads
+	uint32_t depth; // nesting of running jobs
+	// statistics since the last jobsPrintStats, added to by the owner and
+	// atomically taken and reset by jobsPrintStats
+	SDL_atomic_t busy; // microseconds spent in jobs
+	SDL_atomic_t jobs;
+	SDL_atomic_t steals;
+	uint64_t busyTicks; // owner only, not yet added to busy
+	Job q[JOBS_QUEUE_SIZE];
+} JobSlot;
+
+struct JobSystem {
+	uint32_t workers; // threads owned by the job system
+	uint32_t slotCount; // workers and registered threads
+	SDL_atomic_t registered;
+	JobSlot *slots;
+	SDL_atomic_t queued; // jobs waiting in the deques
+	SDL_atomic_t sleeping; // workers waiting for jobs
+	SDL_atomic_t waiting; // threads in jobsWait waiting for other threads
+	SDL_mutex *lock;
+	SDL_cond *wake;
+	SDL_cond *done; // a counter reached zero or a job was queued
+	char quit;
+	uint64_t statsStart;
+};
+
+// starts workers threads, external is the number of other threads that
+// can register
+void jobsInit(JobSystem *js, uint32_t workers, uint32_t external);
+
+// all jobs must have completed
+void jobsDestroy(JobSystem *js);
+
+// gives the calling thread a slot, so it can submit jobs and wait for them
+void jobsRegister(JobSystem *js);
+
+// queues fn(arg), c is decremented when it has completed
+// must be called from a worker or a registered thread
+void jobsRun(JobSystem *js, JobFunc fn, void *arg, JobCounter *c);
+
+// runs jobs until the counter is zero
+// must be called from a worker or a registered thread
+void jobsWait(JobSystem *js, JobCounter *c);
+
+// logs per-thread utilization since the previous call and resets it
+void jobsPrintStats(JobSystem *js);
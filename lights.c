@@ -0,0 +1,179 @@
+// clustered forward lighting
+
+#include <SDL.h>
+#include <vulkan.h>
+#include <vk_mem_alloc.h>
+#include <cglm/cglm.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <inttypes.h>
+
+#include "log.h"
+#include "util.h"
+#include "bindless.h"
+#include "shader.h"
+#include "pipeline.h"
+#include "jobs.h"
+#include "transform.h"
+#include "bvh.h"
+#include "scene.h"
+#include "lights.h"
+
+#include "shaders_out/clusters.comp.h"
+
+#define LIGHTS_ORBIT 0.5f // radius of the circles the lights move on
+#define LIGHTS_SPEED 1.0f // radians per second
+
+// must match clusters.comp
+typedef struct LightsPush {
+	uint32_t lights;
+	uint32_t clusters;
+} LightsPush;
+
+// the same hash as the shaders use, uniform in [0, 1)
+static float lightsRandom(uint32_t *state) {
+	uint32_t i = *state;
+	i = (i ^ 61u) ^ (i >> 16);
+	i *= 9u;
+	i ^= i >> 4;
+	i *= 0x27d4eb2du;
+	i ^= i >> 15;
+	*state = i;
+	return (i >> 8) / 16777216.0f;
+}
+
+void lightsInit(Lights *l, VkDevice dev, VmaAllocator vma, Bindless *b, uint32_t frameCount, uint32_t capacity, const Aabb *area) {
+	l->dev = dev;
+	l->vma = vma;
+	l->bindless = b;
+	l->capacity = capacity;
+	l->count = capacity;
+
+	l->centers = calloc(capacity, sizeof(vec4));
+	mustPtr(l->centers, "light centers array, len = %"PRIu32, capacity);
+	l->colors = calloc(capacity, sizeof(vec3));
+	mustPtr(l->colors, "light colors array, len = %"PRIu32, capacity);
+	uint32_t state = 1;
+	for (uint32_t i = 0; i < capacity; i++) {
+		for (uint32_t k = 0; k < 3; k++) {
+			l->centers[i][k] = area->min[k] + lightsRandom(&state) * (area->max[k] - area->min[k]);
+			l->colors[i][k] = 0.2f + 0.8f * lightsRandom(&state);
+		}
+		l->centers[i][3] = 2.0f * GLM_PIf * lightsRandom(&state);
+	}
+
+	l->frameCount = frameCount;
+	l->frames = calloc(frameCount, sizeof(LightsFrame));
+	mustPtr(l->frames, "lights frames array, len = %"PRIu32, frameCount);
+	for (uint32_t i = 0; i < frameCount; i++) {
+		LightsFrame *f = &l->frames[i];
+		VkBufferCreateInfo bci = {};
+		bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bci.size = sizeof(LightsHeader) + capacity * sizeof(Light);
+		bci.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+		bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		VmaAllocationCreateInfo aci = {};
+		aci.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+		aci.usage = VMA_MEMORY_USAGE_AUTO;
+		aci.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		VmaAllocationInfo ai;
+		must(vmaCreateBuffer(vma, &bci, &aci, &f->buf, &f->alloc, &ai));
+		f->data = ai.pMappedData;
+		f->index = bindlessAddBuffer(b, f->buf, 0, VK_WHOLE_SIZE);
+
+		bci.size = LIGHTS_CLUSTER_COUNT * (LIGHTS_PER_CLUSTER_MAX + 1) * sizeof(uint32_t);
+		aci = (VmaAllocationCreateInfo){};
+		aci.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+		must(vmaCreateBuffer(vma, &bci, &aci, &f->clusters, &f->clustersAlloc, NULL));
+		f->clustersIndex = bindlessAddBuffer(b, f->clusters, 0, VK_WHOLE_SIZE);
+	}
+
+	const ShaderCode *cs = &clusters_comp;
+	VkPushConstantRange pcr = shaderPushConstants(&cs, 1);
+	mustCondition(pcr.size <= sizeof(LightsPush), "the push constants of %s fit in LightsPush", cs->name);
+	VkPipelineLayoutCreateInfo pllyci = {};
+	pllyci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pllyci.setLayoutCount = 1;
+	pllyci.pSetLayouts = &b->dsl;
+	pllyci.pushConstantRangeCount = 1;
+	pllyci.pPushConstantRanges = &pcr;
+	must(vkCreatePipelineLayout(dev, &pllyci, NULL, &l->layout));
+	l->assign = pipelineCreateCompute(dev, VK_NULL_HANDLE, l->layout, cs);
+
+	infof("clustered lighting: %"PRIu32" lights, %dx%dx%d clusters", capacity,
+		LIGHTS_CLUSTERS_X, LIGHTS_CLUSTERS_Y, LIGHTS_CLUSTERS_Z);
+}
+
+void lightsDestroy(Lights *l, uint64_t frameNumber) {
+	vkDestroyPipeline(l->dev, l->assign, NULL);
+	vkDestroyPipelineLayout(l->dev, l->layout, NULL);
+	for (uint32_t i = 0; i < l->frameCount; i++) {
+		LightsFrame *f = &l->frames[i];
+		bindlessRemoveBuffer(l->bindless, f->index, frameNumber);
+		bindlessRemoveBuffer(l->bindless, f->clustersIndex, frameNumber);
+		vmaDestroyBuffer(l->vma, f->buf, f->alloc);
+		vmaDestroyBuffer(l->vma, f->clusters, f->clustersAlloc);
+	}
+	free(l->frames);
+	free(l->colors);
+	free(l->centers);
+}
+
+void lightsUpdate(Lights *l, uint32_t frame, float t, const Camera *cam, VkExtent2D extent) {
+	LightsFrame *f = &l->frames[frame];
+	LightsHeader *h = f->data;
+	glm_mat4_copy((vec4 *)cam->view, h->view);
+	glm_mat4_inv((vec4 *)cam->proj, h->invProj);
+	h->near = cam->near;
+	h->far = cam->far;
+	float range = logf(cam->far / cam->near);
+	h->sliceScale = LIGHTS_CLUSTERS_Z / range;
+	h->sliceBias = -LIGHTS_CLUSTERS_Z * logf(cam->near) / range;
+	h->width = extent.width;
+	h->height = extent.height;
+	h->count = l->count;
+
+	Light *lights = (Light *)(h + 1);
+	for (uint32_t i = 0; i < l->count; i++) {
+		float a = l->centers[i][3] + LIGHTS_SPEED * t;
+		Light light = {};
+		light.pos[0] = l->centers[i][0] + LIGHTS_ORBIT * cosf(a);
+		light.pos[1] = l->centers[i][1];
+		light.pos[2] = l->centers[i][2] + LIGHTS_ORBIT * sinf(a);
+		light.radius = LIGHTS_RADIUS;
+		glm_vec3_copy(l->colors[i], light.color);
+		lights[i] = light;
+	}
+}
+
+void lightsAssign(Lights *l, VkCommandBuffer cmd, uint32_t frame) {
+	LightsFrame *f = &l->frames[frame];
+	LightsPush pc = {f->index, f->clustersIndex};
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, l->assign);
+	bindlessBind(l->bindless, cmd, VK_PIPELINE_BIND_POINT_COMPUTE, l->layout);
+	vkCmdPushConstants(cmd, l->layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pc), &pc);
+	// one workgroup per cluster
+	vkCmdDispatch(cmd, LIGHTS_CLUSTER_COUNT, 1, 1);
+
+	VkMemoryBarrier2 mb = {};
+	mb.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+	mb.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	mb.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+	mb.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+	mb.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT;
+	VkDependencyInfo di = {};
+	di.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+	di.memoryBarrierCount = 1;
+	di.pMemoryBarriers = &mb;
+	vkCmdPipelineBarrier2(cmd, &di);
+}
+
+uint32_t lightsIndex(const Lights *l, uint32_t frame) {
+	return l->frames[frame].index;
+}
+
+uint32_t lightsClustersIndex(const Lights *l, uint32_t frame) {
+	return l->frames[frame].clustersIndex;
+}
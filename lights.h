@@ -0,0 +1,88 @@
+// clustered forward lighting
+// The view frustum is split into froxel clusters: screen tiles, each cut into
+// slices whose depth grows exponentially. Every frame a compute shader
+// assigns the lights of the frame's light buffer to the clusters their
+// spheres of influence touch, and the scene's fragment shader only loops over
+// the lights of its cluster, so the cost is pixels times lights per cluster
+// instead of pixels times lights.
+// requires:
+// #include <vulkan.h>
+// #include <vk_mem_alloc.h>
+// #include <cglm/cglm.h>
+// #include "bindless.h"
+// #include "bvh.h"
+// #include "scene.h"
+
+// cluster grid, must match clusters.comp and shader.frag
+#define LIGHTS_CLUSTERS_X 16
+#define LIGHTS_CLUSTERS_Y 9
+#define LIGHTS_CLUSTERS_Z 24
+#define LIGHTS_CLUSTER_COUNT (LIGHTS_CLUSTERS_X * LIGHTS_CLUSTERS_Y * LIGHTS_CLUSTERS_Z)
+// lights a cluster can hold, the others touching it are ignored
+#define LIGHTS_PER_CLUSTER_MAX 255
+#define LIGHTS_GROUP_SIZE 64 // local size of clusters.comp
+#define LIGHTS_RADIUS 1.0f // of influence, world units
+
+// must match clusters.comp and shader.frag
+typedef struct Light {
+	vec3 pos; // world space
+	float radius;
+	vec3 color;
+	float pad;
+} Light;
+
+// written every frame before the lights, must match clusters.comp and
+// shader.frag
+typedef struct LightsHeader {
+	mat4 view;
+	mat4 invProj;
+	float near, far;
+	// slice of a view space depth z: log(z) * sliceScale + sliceBias
+	float sliceScale, sliceBias;
+	uint32_t width, height; // viewport, pixels
+	uint32_t count;
+	uint32_t pad;
+} LightsHeader;
+
+typedef struct LightsFrame {
+	VkBuffer buf; // header and lights, written by the cpu
+	VmaAllocation alloc;
+	void *data; // persistently mapped
+	uint32_t index; // bindless buffer index
+	VkBuffer clusters; // device-local, per cluster its light count and indices
+	VmaAllocation clustersAlloc;
+	uint32_t clustersIndex;
+} LightsFrame;
+
+typedef struct Lights {
+	VkDevice dev;
+	VmaAllocator vma;
+	Bindless *bindless;
+	uint32_t capacity;
+	uint32_t count; // lights used, at most capacity
+	// animation: each light circles around its center
+	vec4 *centers; // xyz, phase in w
+	vec3 *colors;
+	uint32_t frameCount;
+	LightsFrame *frames;
+	VkPipelineLayout layout;
+	VkPipeline assign;
+} Lights;
+
+// places capacity lights at random in area, all of them are used
+void lightsInit(Lights *l, VkDevice dev, VmaAllocator vma, Bindless *b, uint32_t frameCount, uint32_t capacity, const Aabb *area);
+
+// caller has to ensure that the resources are no longer in use
+void lightsDestroy(Lights *l, uint64_t frameNumber);
+
+// writes the lights at time t (seconds) and the camera to the buffer of the
+// frame, its fence must have been waited for
+void lightsUpdate(Lights *l, uint32_t frame, float t, const Camera *cam, VkExtent2D extent);
+
+// records the assignment of the lights to the clusters, outside of a render
+// pass; the fragment shaders of the following draws can read the clusters
+void lightsAssign(Lights *l, VkCommandBuffer cmd, uint32_t frame);
+
+// bindless indices to pass to the scene shaders (PushConstants)
+uint32_t lightsIndex(const Lights *l, uint32_t frame);
+uint32_t lightsClustersIndex(const Lights *l, uint32_t frame);
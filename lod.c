@@ -0,0 +1,273 @@
+// level of detail generation and selection
+
+#include <SDL.h>
+#include <cglm/cglm.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+
+#include "log.h"
+#include "util.h"
+#include "jobs.h"
+#include "transform.h"
+#include "bvh.h"
+#include "scene.h"
+#include "lod.h"
+
+// keeps the border of open meshes in place, an edge on the border has a
+// plane perpendicular to its triangle with this weight
+#define LOD_BORDER_WEIGHT 10.0
+
+// symmetric 4x4 matrix of the summed squared distances to planes
+// (xx, xy, xz, xw, yy, yz, yw, zz, zw, ww)
+typedef struct Quadric {
+	double a[10];
+} Quadric;
+
+// candidate collapse of vertex from onto vertex to
+typedef struct LodCollapse {
+	uint32_t from, to;
+	double cost;
+} LodCollapse;
+
+// adds the plane n.p + d = 0 (n normalized) with weight w
+static void quadricAddPlane(Quadric *q, vec3 n, float d, double w) {
+	double p[4] = {n[0], n[1], n[2], d};
+	uint32_t k = 0;
+	for (uint32_t i = 0; i < 4; i++)
+		for (uint32_t j = i; j < 4; j++)
+			q->a[k++] += w * p[i] * p[j];
+}
+
+static void quadricAdd(Quadric *q, const Quadric *r) {
+	for (uint32_t i = 0; i < LENGTH(q->a); i++)
+		q->a[i] += r->a[i];
+}
+
+// p^T Q p with p = (v, 1)
+static double quadricError(const Quadric *q, const float *v) {
+	double x = v[0], y = v[1], z = v[2];
+	const double *a = q->a;
+	double e = a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+		+ a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+		+ a[7] * z * z + 2 * a[8] * z
+		+ a[9];
+	return e > 0 ? e : 0;
+}
+
+static int compareEdges(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static int compareCollapses(const void *a, const void *b) {
+	double x = ((const LodCollapse *)a)->cost, y = ((const LodCollapse *)b)->cost;
+	return (x > y) - (x < y);
+}
+
+// quadrics of the triangle planes around each vertex, borders included
+static void lodQuadrics(const vec3 *positions, const uint32_t *indices, uint32_t indexCount, Quadric *q) {
+	uint64_t *edges = calloc(indexCount, sizeof(uint64_t));
+	mustPtr(edges, "lod edges array, len = %"PRIu32, indexCount);
+	for (uint32_t t = 0; t < indexCount; t += 3)
+		for (uint32_t e = 0; e < 3; e++)
+			edges[t + e] = (uint64_t)indices[t + e] << 32 | indices[t + (e + 1) % 3];
+	qsort(edges, indexCount, sizeof(uint64_t), compareEdges);
+
+	for (uint32_t t = 0; t < indexCount; t += 3) {
+		const uint32_t *v = &indices[t];
+		vec3 e1, e2, n;
+		glm_vec3_sub((float *)positions[v[1]], (float *)positions[v[0]], e1);
+		glm_vec3_sub((float *)positions[v[2]], (float *)positions[v[0]], e2);
+		glm_vec3_cross(e1, e2, n);
+		if (glm_vec3_norm(n) == 0)
+			continue;
+		glm_vec3_normalize(n);
+		float d = -glm_vec3_dot(n, (float *)positions[v[0]]);
+		for (uint32_t e = 0; e < 3; e++)
+			quadricAddPlane(&q[v[e]], n, d, 1.0);
+
+		// an edge without its opposite is on the border
+		for (uint32_t e = 0; e < 3; e++) {
+			uint32_t a = v[e], b = v[(e + 1) % 3];
+			uint64_t opposite = (uint64_t)b << 32 | a;
+			if (bsearch(&opposite, edges, indexCount, sizeof(uint64_t), compareEdges) != NULL)
+				continue;
+			vec3 dir, bn;
+			glm_vec3_sub((float *)positions[b], (float *)positions[a], dir);
+			glm_vec3_cross(dir, n, bn);
+			if (glm_vec3_norm(bn) == 0)
+				continue;
+			glm_vec3_normalize(bn);
+			float bd = -glm_vec3_dot(bn, (float *)positions[a]);
+			quadricAddPlane(&q[a], bn, bd, LOD_BORDER_WEIGHT);
+			quadricAddPlane(&q[b], bn, bd, LOD_BORDER_WEIGHT);
+		}
+	}
+	free(edges);
+}
+
+// returns 1 if moving vertex from onto to turns a triangle around it over
+static char lodFlips(const vec3 *positions, const uint32_t *indices, const uint32_t *adjacency, const uint32_t *first,
+		uint32_t from, uint32_t to) {
+	for (uint32_t i = first[from]; i < first[from + 1]; i++) {
+		const uint32_t *v = &indices[adjacency[i]];
+		if (v[0] == to || v[1] == to || v[2] == to)
+			continue; // degenerates and is removed
+		vec3 p[3], moved[3];
+		for (uint32_t k = 0; k < 3; k++) {
+			glm_vec3_copy((float *)positions[v[k]], p[k]);
+			glm_vec3_copy((float *)positions[v[k] == from ? to : v[k]], moved[k]);
+		}
+		vec3 e1, e2, n0, n1;
+		glm_vec3_sub(p[1], p[0], e1);
+		glm_vec3_sub(p[2], p[0], e2);
+		glm_vec3_cross(e1, e2, n0);
+		glm_vec3_sub(moved[1], moved[0], e1);
+		glm_vec3_sub(moved[2], moved[0], e2);
+		glm_vec3_cross(e1, e2, n1);
+		if (glm_vec3_dot(n0, n1) <= 0)
+			return 1;
+	}
+	return 0;
+}
+
+uint32_t lodSimplify(const vec3 *positions, uint32_t vertexCount, const uint32_t *indices, uint32_t indexCount,
+		uint32_t targetCount, float maxError, uint32_t *out, float *error) {
+	memcpy(out, indices, indexCount * sizeof(uint32_t));
+	*error = 0;
+	if (indexCount <= targetCount)
+		return indexCount;
+
+	Quadric *q = calloc(vertexCount, sizeof(Quadric));
+	mustPtr(q, "lod quadrics array, len = %"PRIu32, vertexCount);
+	lodQuadrics(positions, indices, indexCount, q);
+	uint32_t *remap = calloc(vertexCount, sizeof(uint32_t));
+	mustPtr(remap, "lod remap array, len = %"PRIu32, vertexCount);
+	char *locked = calloc(vertexCount, 1);
+	mustPtr(locked, "lod locked array, len = %"PRIu32, vertexCount);
+	uint32_t *first = calloc(vertexCount + 1, sizeof(uint32_t));
+	mustPtr(first, "lod adjacency offsets, len = %"PRIu32, vertexCount + 1);
+	uint32_t *adjacency = calloc(indexCount, sizeof(uint32_t));
+	mustPtr(adjacency, "lod adjacency array, len = %"PRIu32, indexCount);
+	LodCollapse *collapses = calloc(indexCount, sizeof(LodCollapse));
+	mustPtr(collapses, "lod collapses array, len = %"PRIu32, indexCount);
+
+	// the error is a sum of squared distances
+	double maxCost = (double)maxError * maxError;
+	double worst = 0;
+	uint32_t count = indexCount;
+	// every pass does independent collapses only, so that their costs and
+	// flip checks stay valid
+	while (count > targetCount) {
+		// triangles around each vertex, as offsets of their first index
+		memset(first, 0, (vertexCount + 1) * sizeof(uint32_t));
+		for (uint32_t i = 0; i < count; i++)
+			first[out[i] + 1]++;
+		for (uint32_t v = 0; v < vertexCount; v++)
+			first[v + 1] += first[v];
+		for (uint32_t i = 0; i < count; i++)
+			adjacency[first[out[i]]++] = i - i % 3;
+		for (uint32_t v = vertexCount; v > 0; v--)
+			first[v] = first[v - 1];
+		first[0] = 0;
+
+		uint32_t collapseCount = 0;
+		for (uint32_t t = 0; t < count; t += 3) {
+			for (uint32_t e = 0; e < 3; e++) {
+				uint32_t a = out[t + e], b = out[t + (e + 1) % 3];
+				Quadric sum = q[a];
+				quadricAdd(&sum, &q[b]);
+				collapses[collapseCount++] = (LodCollapse){a, b, quadricError(&sum, positions[b])};
+			}
+		}
+		qsort(collapses, collapseCount, sizeof(LodCollapse), compareCollapses);
+
+		for (uint32_t v = 0; v < vertexCount; v++)
+			remap[v] = v;
+		memset(locked, 0, vertexCount);
+		uint32_t removed = 0, done = 0;
+		for (uint32_t i = 0; i < collapseCount && count - removed > targetCount; i++) {
+			LodCollapse *c = &collapses[i];
+			if (c->cost > maxCost)
+				break;
+			if (locked[c->from] || locked[c->to] || lodFlips(positions, out, adjacency, first, c->from, c->to))
+				continue;
+			remap[c->from] = c->to;
+			quadricAdd(&q[c->to], &q[c->from]);
+			if (c->cost > worst)
+				worst = c->cost;
+			done++;
+			// the triangles around the moved vertex changed
+			for (uint32_t k = first[c->from]; k < first[c->from + 1]; k++) {
+				const uint32_t *v = &out[adjacency[k]];
+				locked[v[0]] = locked[v[1]] = locked[v[2]] = 1;
+				if (v[0] == c->to || v[1] == c->to || v[2] == c->to)
+					removed += 3;
+			}
+		}
+		if (done == 0)
+			break;
+
+		// apply the collapses, dropping the triangles that degenerated
+		uint32_t n = 0;
+		for (uint32_t t = 0; t < count; t += 3) {
+			uint32_t a = remap[out[t]], b = remap[out[t + 1]], c = remap[out[t + 2]];
+			if (a == b || b == c || a == c)
+				continue;
+			out[n++] = a;
+			out[n++] = b;
+			out[n++] = c;
+		}
+		count = n;
+	}
+
+	free(collapses);
+	free(adjacency);
+	free(first);
+	free(locked);
+	free(remap);
+	free(q);
+	*error = sqrtf((float)worst);
+	return count;
+}
+
+void lodBuildChain(Mesh *m, const vec3 *positions, uint32_t vertexCount, uint32_t **indices, uint32_t *indexCount) {
+	m->lods[0] = (MeshLod){m->firstIndex, m->indexCount, 0.0f};
+	m->lodCount = 1;
+	float maxError = LOD_MAX_ERROR * glm_vec3_distance(m->bounds.min, m->bounds.max);
+	while (m->lodCount < MESH_LODS_MAX) {
+		MeshLod prev = m->lods[m->lodCount - 1];
+		uint32_t target = prev.indexCount / 6 * 3;
+		if (target < 3 * LOD_MIN_TRIANGLES)
+			break;
+		// room for the level at the end of the list
+		uint32_t *grown = realloc(*indices, (*indexCount + prev.indexCount) * sizeof(uint32_t));
+		mustPtr(grown, "index list, len = %"PRIu32, *indexCount + prev.indexCount);
+		*indices = grown;
+		float error;
+		uint32_t n = lodSimplify(positions, vertexCount, grown + prev.firstIndex, prev.indexCount,
+			target, maxError, grown + *indexCount, &error);
+		if (n > LOD_MIN_REDUCTION * prev.indexCount)
+			break;
+		// the errors of the levels add up
+		m->lods[m->lodCount++] = (MeshLod){*indexCount, n, prev.error + error};
+		*indexCount += n;
+	}
+	debugf("%"PRIu32" levels of detail built, %"PRIu32" triangles in the last one (error %g)",
+		m->lodCount, m->lods[m->lodCount - 1].indexCount / 3, m->lods[m->lodCount - 1].error);
+}
+
+uint32_t lodSelect(const Mesh *m, uint32_t current, float pixelsPerUnit, float threshold) {
+	if (threshold <= 0 || m->lodCount <= 1)
+		return 0;
+	uint32_t l = current < m->lodCount ? current : m->lodCount - 1;
+	while (l > 0 && m->lods[l].error * pixelsPerUnit > threshold * (1.0f + LOD_HYSTERESIS))
+		l--;
+	while (l + 1 < m->lodCount && m->lods[l + 1].error * pixelsPerUnit < threshold * (1.0f - LOD_HYSTERESIS))
+		l++;
+	return l;
+}
@@ -0,0 +1,37 @@
+// level of detail generation and selection
+// The levels of a mesh are built when it is loaded by simplifying the index
+// list of the previous level with quadric error metrics (Garland and
+// Heckbert): edges are collapsed onto one of their vertices, cheapest first,
+// so the levels keep using the vertices of the full mesh and only add index
+// ranges to the shared index buffer. At draw time the level is chosen from
+// its error projected to the screen.
+// requires:
+// #include <cglm/cglm.h>
+// #include "bvh.h"
+// #include "scene.h"
+
+// collapses whose error exceeds this part of the mesh's bounding box
+// diagonal are never done
+#define LOD_MAX_ERROR 0.05f
+// a level which keeps more than this part of the triangles isn't worth it
+#define LOD_MIN_REDUCTION 0.8f
+#define LOD_MIN_TRIANGLES 8
+// relative margin around the screen-space error threshold
+#define LOD_HYSTERESIS 0.25f
+
+// Simplifies the triangle list indices to at most targetCount indices if
+// possible without collapses whose error exceeds maxError (model space
+// distance). The result is written to out, which must hold indexCount
+// items, and its index count is returned. *error is set to the largest
+// error of the done collapses.
+uint32_t lodSimplify(const vec3 *positions, uint32_t vertexCount, const uint32_t *indices, uint32_t indexCount,
+	uint32_t targetCount, float maxError, uint32_t *out, float *error);
+
+// Fills m->lods with the levels of the mesh. The simplified index lists are
+// appended to *indices, the shared index list holding the mesh, which is
+// reallocated (it must come from malloc) and whose *indexCount is updated.
+void lodBuildChain(Mesh *m, const vec3 *positions, uint32_t vertexCount, uint32_t **indices, uint32_t *indexCount);
+
+// returns the level of m to draw instead of current, where pixelsPerUnit
+// is the size of one model space unit on screen; 0 if threshold is 0
+uint32_t lodSelect(const Mesh *m, uint32_t current, float pixelsPerUnit, float threshold);
@@ -0,0 +1,248 @@
+// asynchronous logging backend of infof/errorf
+
+#include <SDL.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "log.h"
+#include "util.h"
+
+typedef struct LogRecord {
+	uint64_t ticks;
+	LogLevel level;
+	const char *file;
+	int line;
+	char msg[LOG_MESSAGE_SIZE];
+} LogRecord;
+
+// written by its thread, read by the background thread
+typedef struct LogRing {
+	_Alignas(64) SDL_atomic_t head; // next record to be written out
+	_Alignas(64) SDL_atomic_t tail; // next record to be filled
+	_Alignas(64) SDL_atomic_t dropped;
+	struct LogRing *next;
+	LogRecord records[LOG_RING_SIZE];
+} LogRing;
+
+static struct {
+	SDL_atomic_t running; // between logInit and logDestroy
+	SDL_atomic_t level;
+	void *rings; // LogRing list, rings are added but never removed
+	SDL_atomic_t sleeping; // the background thread waits for a record
+	SDL_sem *wake;
+	SDL_mutex *drain; // held while records are written out
+	SDL_Thread *th;
+	char quit;
+	FILE *out;
+	uint64_t start;
+} logger = {.level = {LOG_INFO}};
+
+static _Thread_local LogRing *logSelf;
+
+static const char *logNames[] = {
+	[LOG_DEBUG] = "debug",
+	[LOG_INFO] = "info",
+	[LOG_ERROR] = "error",
+};
+
+void logSetLevel(LogLevel level) {
+	SDL_AtomicSet(&logger.level, level);
+}
+
+int logParseLevel(const char *name) {
+	for (uint32_t i = 0; i < LENGTH(logNames); i++)
+		if (strcmp(name, logNames[i]) == 0)
+			return i;
+	return -1;
+}
+
+// number of records in the ring, also correct after wrapping around
+static uint32_t logRingSize(LogRing *r) {
+	return (unsigned)SDL_AtomicGet(&r->tail) - (unsigned)SDL_AtomicGet(&r->head);
+}
+
+// returns the ring of the calling thread, NULL if it can't be allocated
+static LogRing *logRing(void) {
+	if (logSelf != NULL)
+		return logSelf;
+	LogRing *r = aligned_alloc(_Alignof(LogRing), sizeof(LogRing));
+	if (r == NULL)
+		return NULL;
+	memset(r, 0, sizeof(LogRing));
+	void *head;
+	do {
+		head = SDL_AtomicGetPtr(&logger.rings);
+		r->next = head;
+	} while (!SDL_AtomicCASPtr(&logger.rings, head, r));
+	logSelf = r;
+	return r;
+}
+
+static void logPrint(FILE *f, const LogRecord *rec) {
+	fprintf(f, "[%11.6f] [%s] %s:%d: %s\n",
+		(double)(rec->ticks - logger.start) / SDL_GetPerformanceFrequency(),
+		logNames[rec->level], rec->file, rec->line, rec->msg);
+}
+
+// writes out the records in timestamp order, logger.drain must be held
+static void logDrain(void) {
+	uint32_t ringCount = 0;
+	for (LogRing *r = SDL_AtomicGetPtr(&logger.rings); r != NULL; r = r->next)
+		ringCount++;
+	// records keep arriving while this runs, so the amount is limited
+	for (uint32_t n = 0; n < ringCount * LOG_RING_SIZE; n++) {
+		LogRing *first = NULL;
+		for (LogRing *r = SDL_AtomicGetPtr(&logger.rings); r != NULL; r = r->next) {
+			if (logRingSize(r) == 0)
+				continue;
+			if (first == NULL || r->records[(unsigned)SDL_AtomicGet(&r->head) & (LOG_RING_SIZE - 1)].ticks
+					< first->records[(unsigned)SDL_AtomicGet(&first->head) & (LOG_RING_SIZE - 1)].ticks)
+				first = r;
+		}
+		if (first == NULL)
+			break;
+		int h = SDL_AtomicGet(&first->head);
+		logPrint(logger.out, &first->records[(unsigned)h & (LOG_RING_SIZE - 1)]);
+		SDL_AtomicSet(&first->head, (int)((unsigned)h + 1));
+	}
+	uint32_t dropped = 0;
+	for (LogRing *r = SDL_AtomicGetPtr(&logger.rings); r != NULL; r = r->next)
+		dropped += SDL_AtomicSet(&r->dropped, 0);
+	if (dropped > 0)
+		fprintf(logger.out, "[%11.6f] [error] %s:%d: %"PRIu32" log records dropped, the buffer was full\n",
+			(double)(SDL_GetPerformanceCounter() - logger.start) / SDL_GetPerformanceFrequency(),
+			__FILE__, __LINE__, dropped);
+	fflush(logger.out);
+}
+
+static char logPending(void) {
+	for (LogRing *r = SDL_AtomicGetPtr(&logger.rings); r != NULL; r = r->next)
+		if (logRingSize(r) > 0 || SDL_AtomicGet(&r->dropped) > 0)
+			return 1;
+	return 0;
+}
+
+static int logThread(void *data) {
+	(void)data;
+	for (;;) {
+		SDL_LockMutex(logger.drain);
+		logDrain();
+		char quit = logger.quit;
+		SDL_UnlockMutex(logger.drain);
+		if (quit)
+			return 0;
+		if (logPending()) {
+			// collect more records before the next write
+			SDL_SemWaitTimeout(logger.wake, LOG_DRAIN_MS);
+			continue;
+		}
+		// sleep until the next record, logWrite checks sleeping after
+		// publishing a record, so it can't be missed
+		SDL_AtomicSet(&logger.sleeping, 1);
+		if (!logPending() || !SDL_AtomicCAS(&logger.sleeping, 1, 0))
+			SDL_SemWait(logger.wake);
+	}
+}
+
+char logInit(const char *path) {
+	char ok = 1;
+	logger.out = stdout;
+	if (path != NULL) {
+		FILE *f = fopen(path, "a");
+		if (f != NULL) {
+			logger.out = f;
+		} else {
+			errorf("can't open log file %s, using stdout", path);
+			ok = 0;
+		}
+	}
+	logger.start = SDL_GetPerformanceCounter();
+	logger.quit = 0;
+	SDL_AtomicSet(&logger.sleeping, 0);
+	logger.wake = SDL_CreateSemaphore(0);
+	mustPtr(logger.wake, "log semaphore: %s", SDL_GetError());
+	logger.drain = SDL_CreateMutex();
+	mustPtr(logger.drain, "log mutex: %s", SDL_GetError());
+	SDL_AtomicSet(&logger.running, 1);
+	logger.th = SDL_CreateThread(logThread, "log", NULL);
+	if (logger.th == NULL) {
+		SDL_AtomicSet(&logger.running, 0);
+		panicf("log thread: %s", SDL_GetError());
+	}
+	return ok;
+}
+
+// other threads must have stopped logging
+void logDestroy(void) {
+	SDL_LockMutex(logger.drain);
+	logger.quit = 1;
+	SDL_UnlockMutex(logger.drain);
+	SDL_SemPost(logger.wake);
+	SDL_WaitThread(logger.th, NULL);
+	SDL_AtomicSet(&logger.running, 0);
+	// records written after the last drain of the thread
+	logDrain();
+	if (logger.out != stdout)
+		fclose(logger.out);
+	SDL_DestroyMutex(logger.drain);
+	SDL_DestroySemaphore(logger.wake);
+	LogRing *r = SDL_AtomicGetPtr(&logger.rings);
+	while (r != NULL) {
+		LogRing *next = r->next;
+		free(r);
+		r = next;
+	}
+	SDL_AtomicSetPtr(&logger.rings, NULL);
+	logSelf = NULL;
+}
+
+void logWrite(LogLevel level, const char *file, int line, const char *fmt, ...) {
+	if ((int)level < SDL_AtomicGet(&logger.level))
+		return;
+	va_list ap;
+	LogRing *r = SDL_AtomicGet(&logger.running) ? logRing() : NULL;
+	if (r == NULL) {
+		char msg[LOG_MESSAGE_SIZE];
+		va_start(ap, fmt);
+		vsnprintf(msg, sizeof(msg), fmt, ap);
+		va_end(ap);
+		printf("[%s] %s:%d: %s\n", logNames[level], file, line, msg);
+		return;
+	}
+
+	// drop policy: errors wait for space, everything else is dropped
+	while (logRingSize(r) >= LOG_RING_SIZE) {
+		if (level < LOG_ERROR || !SDL_AtomicGet(&logger.running)) {
+			SDL_AtomicAdd(&r->dropped, 1);
+			return;
+		}
+		SDL_SemPost(logger.wake);
+		SDL_Delay(1);
+	}
+	int t = SDL_AtomicGet(&r->tail);
+	LogRecord *rec = &r->records[(unsigned)t & (LOG_RING_SIZE - 1)];
+	rec->ticks = SDL_GetPerformanceCounter();
+	rec->level = level;
+	rec->file = file;
+	rec->line = line;
+	va_start(ap, fmt);
+	vsnprintf(rec->msg, sizeof(rec->msg), fmt, ap);
+	va_end(ap);
+	SDL_AtomicSet(&r->tail, (int)((unsigned)t + 1));
+	if (SDL_AtomicCAS(&logger.sleeping, 1, 0))
+		SDL_SemPost(logger.wake);
+}
+
+void logFlush(void) {
+	if (!SDL_AtomicGet(&logger.running)) {
+		fflush(stdout);
+		return;
+	}
+	SDL_LockMutex(logger.drain);
+	logDrain();
+	SDL_UnlockMutex(logger.drain);
+}
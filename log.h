@@ -0,0 +1,38 @@
+// asynchronous logging backend of infof/errorf (util.h)
+// Records are formatted on the calling thread into a ring buffer owned by
+// that thread (single producer, single consumer, no locks), and a background
+// thread writes them to stdout or a file in timestamp order. When a ring is
+// full, debug and info records are dropped and counted, errors wait for
+// space. Before logInit and after logDestroy records are written
+// synchronously.
+// requires:
+// #include <stdio.h>
+
+#define LOG_RING_SIZE 256 // records per thread, must be a power of 2
+#define LOG_MESSAGE_SIZE 512 // longer messages are truncated
+#define LOG_DRAIN_MS 10 // time between writes of the background thread
+
+typedef enum LogLevel {
+	LOG_DEBUG,
+	LOG_INFO,
+	LOG_ERROR,
+} LogLevel;
+
+// starts the background thread, path is the file to append to, NULL for stdout
+// returns 0 if the file can't be opened, in which case stdout is used
+char logInit(const char *path);
+
+// writes the remaining records and stops the background thread
+void logDestroy(void);
+
+// records below the level are discarded, can be called from any thread
+void logSetLevel(LogLevel level);
+
+// returns -1 if the name is unknown
+int logParseLevel(const char *name);
+
+void logWrite(LogLevel level, const char *file, int line, const char *fmt, ...)
+	__attribute__((format(printf, 4, 5)));
+
+// writes all records logged so far before returning
+void logFlush(void);
@@ -9,15 +9,94 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "log.h"
 #include "util.h"
 #include "frame.h"
 #include "swapchain.h"
+#include "capture.h"
+#include "bindless.h"
+#include "shader.h"
+#include "pipeline.h"
+#include "jobs.h"
+#include "texture.h"
+#include "transform.h"
+#include "bvh.h"
+#include "scene.h"
+#include "lod.h"
+#include "queue.h"
+#include "occlusion.h"
+#include "defrag.h"
+#include "particles.h"
+#include "lights.h"
+#include "replay.h"
 
-#include "shaders_out/shader.vert.h"
-#include "shaders_out/shader.frag.h"
 #include "vulkan_core.h"
 
+#define FRAMES_IN_FLIGHT 2
+// longest time the main thread blocks while nothing is drawn, it checks for
+// redraws requested by other threads when it wakes up
+#define IDLE_WAIT_MS 250
+#define IDLE_STATS_MS 2000
+#define DEFRAG_BYTES_PER_PASS (16 << 20)
+// render queue key fields, the demo has one of each
+#define QUEUE_PASS_OPAQUE 0
+#define QUEUE_PIPELINE_SCENE 0
+#define QUEUE_MATERIAL_DEFAULT 0
+
+// command line options
+typedef struct Options {
+	const char *captureDir; // NULL if capture is disabled
+	CaptureFormat captureFormat;
+	uint32_t objects; // number of objects in the demo scene
+	uint32_t threads; // job system workers
+	const char *texture; // KTX2 or DDS file, NULL for a generated texture
+	uint32_t textureBudget; // MiB
+	char onDemand; // only draw when something changed
+	char flat; // draw without textures and vertex colors
+	char noOcclusion; // only cull against the view frustum
+	uint32_t particles; // 0 disables the particle system
+	uint32_t lights; // 0 disables the clustered lighting
+	float defragBudget; // ms per frame, 0 disables defragmentation
+	uint32_t sphere; // segments of a generated sphere mesh, 0 for the built-in mesh
+	float lodThreshold; // pixels of screen-space error, 0 disables the levels of detail
+	const char *logFile; // NULL for stdout
+	LogLevel logLevel;
+	const char *recordFile; // input is recorded to this file if not NULL
+	const char *replayFile; // input is replayed from this file if not NULL
+} Options;
+
+// per-frame copy of the world matrices, read by shader.vert
+typedef struct FrameObjects {
+	VkBuffer buf;
+	VmaAllocation alloc;
+	mat4 *data; // persistently mapped
+	uint32_t index; // bindless buffer index
+	uint32_t stale; // lowest index not yet written since the last update
+	DefragBuffer defrag; // rewritten when moved
+} FrameObjects;
+
+typedef enum RenderRequestType {
+	RENDER_FRAME,
+	RENDER_RESIZE,
+	RENDER_QUIT,
+} RenderRequestType;
+
+// sent from the main thread to the render thread
+typedef struct RenderRequest {
+	RenderRequestType type;
+	uint32_t image; // acquired swapchain image, for RENDER_FRAME
+	uint32_t drawReadySem; // index of the semaphore signalled by the acquisition
+} RenderRequest;
+
+// SDL_UserEvent codes of events sent from the render thread to the main thread
+typedef enum RenderReply {
+	RENDER_SUBMITTED, // data1 is the image to present
+	RENDER_RESIZED,
+	RENDER_DONE, // the render thread has exited
+} RenderReply;
+
 typedef struct State { // TODO: Some members are probably unneeded
+	Options opt;
 	SDL_Window *window;
 	VkPhysicalDevice vpd;
 	VkDevice vdev;
@@ -28,16 +107,59 @@ typedef struct State { // TODO: Some members are probably unneeded
 	uint32_t qfi;
 	VkQueue queue;
 	VkPipeline pl;
+	Bindless bindless;
+	VkPipelineLayout plly;
+	VkShaderStageFlags pushStages; // of the push constant range
+	char occlusionSupported; // occlusion culling can be used
+	char multiDraw; // the render queue can merge draws into indirect multi-draws
+	SDL_atomic_t occlusion; // occlusion culling is enabled, toggled with o
 	VkSurfaceKHR vsurface;
+	VkSurfaceFormatKHR surffmt;
 	Swapchain sc;
-	// vertex buffer
+	// mesh data, copied to the buffers
+	vec3 *vertexData;
+	uint32_t vertexCount;
+	uint32_t *indexData; // the mesh's levels of detail follow it
+	uint32_t indexCount;
+	// vertex buffer, persistently mapped
 	VkBuffer vb;
 	VmaAllocation vba;
-	// index buffer
+	DefragBuffer vbd;
+	// index buffer, persistently mapped
 	VkBuffer ib;
 	VmaAllocation iba;
+	DefragBuffer ibd;
+	Mesh mesh; // of the demo scene, with its levels of detail
+	Scene scene;
+	Texture tex;
+	// startup
+	uint64_t startTicks; // when main was entered
+	SDL_Thread *assets; // runs loadAssets, joined by beginVulkan
+	// communication with the render thread
+	SDL_sem *request; // posted when req is set
+	RenderRequest req;
+	uint32_t renderEvent; // event type of render thread replies
+	SDL_mutex *inputLock;
+	char pick; // a pick request at pickX, pickY (ndc) is pending
+	float pickX, pickY;
+	SDL_atomic_t dirty; // a redraw was requested, see markDirty
+	float fixedDt; // simulation timestep when recording or replaying, 0 for the elapsed time
+	// idle statistics since the last printIdle (guarded by statsLock)
+	SDL_mutex *statsLock;
+	uint64_t renderWaitTicks; // render thread blocked on requests and fences
+	char gpuTimed; // the queue supports timestamps
+	uint64_t gpuTime; // ns
+	uint32_t drawnFrames;
 } State;
 
+// logs the duration of an initialization phase which began at start and the
+// time since main was entered, phases on worker threads overlap the others
+void startupTime(State *s, const char *phase, uint64_t start) {
+	uint64_t now = SDL_GetPerformanceCounter();
+	double f = SDL_GetPerformanceFrequency();
+	infof("startup: %s took %.1f ms, at %.1f ms", phase, 1000.0 * (now - start) / f, 1000.0 * (now - s->startTicks) / f);
+}
+
 vec3 vertices[] = {
 	{0.0f, 0.0f, 0.0f},
 	{0.0f, 0.5f, 0.0f},
@@ -156,7 +278,8 @@ void createDepthBuffer(State *s) {
 	ici.mipLevels = 1;
 	ici.arrayLayers = 1;
 	ici.samples = VK_SAMPLE_COUNT_1_BIT;
-	ici.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	// sampled when the depth pyramid is built
+	ici.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
 	ici.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	ici.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 
@@ -180,10 +303,78 @@ void createDepthBuffer(State *s) {
 	infof("depth buffer created");
 }
 
-// initialize vulkan
+// Prepares the mesh, its levels of detail, the scene and the texture on a
+// worker thread while the device is created. The levels are only built if
+// they are used. The texture's format is checked once the device exists.
+int loadAssets(void *data) {
+	State *s = data;
+	uint64_t start = SDL_GetPerformanceCounter();
+	if (s->opt.sphere > 0) {
+		sceneGenerateSphere(s->opt.sphere, (vec3){0.0f, 0.45f, 0.0f}, 0.4f, &s->vertexData, &s->vertexCount, &s->indexData, &s->indexCount);
+	} else {
+		s->vertexCount = LENGTH(vertices);
+		s->indexCount = LENGTH(indices);
+		s->vertexData = malloc(sizeof(vertices));
+		mustPtr(s->vertexData, "vertex data, len = %"PRIu32, s->vertexCount);
+		s->indexData = malloc(sizeof(indices));
+		mustPtr(s->indexData, "index data, len = %"PRIu32, s->indexCount);
+		memcpy(s->vertexData, vertices, sizeof(vertices));
+		memcpy(s->indexData, indices, sizeof(indices));
+	}
+	Mesh *mesh = &s->mesh;
+	*mesh = (Mesh){0, s->indexCount, {}, 0, {}};
+	glm_vec3_copy(s->vertexData[0], mesh->bounds.min);
+	glm_vec3_copy(s->vertexData[0], mesh->bounds.max);
+	for (uint32_t i = 1; i < s->vertexCount; i++) {
+		glm_vec3_minv(mesh->bounds.min, s->vertexData[i], mesh->bounds.min);
+		glm_vec3_maxv(mesh->bounds.max, s->vertexData[i], mesh->bounds.max);
+	}
+	startupTime(s, "mesh", start);
+
+	if (s->opt.lodThreshold > 0) {
+		start = SDL_GetPerformanceCounter();
+		lodBuildChain(mesh, s->vertexData, s->vertexCount, &s->indexData, &s->indexCount);
+		infof("mesh: %"PRIu32" triangles, %"PRIu32" levels of detail down to %"PRIu32" triangles",
+			mesh->indexCount / 3, mesh->lodCount, mesh->lods[mesh->lodCount - 1].indexCount / 3);
+		startupTime(s, "levels of detail", start);
+	}
+
+	start = SDL_GetPerformanceCounter();
+	sceneInitDemo(&s->scene, s->opt.objects, *mesh);
+	startupTime(s, "scene", start);
+
+	start = SDL_GetPerformanceCounter();
+	if (s->opt.texture == NULL || !textureLoad(&s->tex, s->opt.texture))
+		textureGenerateChecker(&s->tex, TEXTURE_CHECKER_SIZE);
+	startupTime(s, "texture", start);
+	return 0;
+}
+
+// Creates the bindless set, the shared pipeline layout and the scene
+// pipeline on a worker thread while the swapchain and the buffers are
+// created. Nothing else uses them until beginVulkan has joined it.
+int createPipelines(void *data) {
+	State *s = data;
+	uint64_t start = SDL_GetPerformanceCounter();
+	bindlessInit(&s->bindless, s->vdev, s->vpd, FRAMES_IN_FLIGHT);
+	s->plly = pipelineLayoutCreate(s->vdev, &s->bindless);
+	s->pushStages = pipelinePushConstantStages();
+	uint32_t features = s->opt.flat ? 0 : PIPELINE_TEXTURED | PIPELINE_VERTEX_COLORS;
+	if (s->opt.lights > 0)
+		features |= PIPELINE_CLUSTERED;
+	s->pl = pipelineCreateScene(s->vdev, VK_NULL_HANDLE, s->plly, s->surffmt.format, VK_FORMAT_D32_SFLOAT, features);
+	startupTime(s, "pipelines", start);
+	return 0;
+}
+
+// Initializes vulkan. The work that doesn't depend on each other is split
+// between threads: the assets are loaded (s->assets) while the instance and
+// the device are created, and the pipelines are created while the swapchain,
+// the depth buffer and the geometry buffers are.
 void beginVulkan(State *s) {
 	// create instance
 	
+	uint64_t start = SDL_GetPerformanceCounter();
 	VkApplicationInfo ai = {};
 	ai.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
 	ai.apiVersion = VK_API_VERSION_1_3;
@@ -218,9 +409,11 @@ void beginVulkan(State *s) {
 	VkInstance instance;
 	must(vkCreateInstance(&ii, NULL, &instance));
 	infof("vulkan instance created");
+	startupTime(s, "instance", start);
 	
 	// choose physical device
 
+	start = SDL_GetPerformanceCounter();
 	uint32_t physdc;
 	must(vkEnumeratePhysicalDevices(instance, &physdc, NULL));
 	infof("vulkan devices count: %"PRIu32, physdc);
@@ -271,12 +464,40 @@ void beginVulkan(State *s) {
 	qci.queueCount = 1;
 	qci.pQueuePriorities = (float[]){1.0f};
 
-	// no device features are used
+	// enable block compressed textures if available
+
+	VkPhysicalDeviceFeatures supported;
+	vkGetPhysicalDeviceFeatures(s->vpd, &supported);
+	VkPhysicalDeviceFeatures features = {};
+	features.textureCompressionBC = supported.textureCompressionBC;
+
+	// the render queue merges draws into indirect multi-draws
+	s->multiDraw = supported.multiDrawIndirect && supported.drawIndirectFirstInstance;
+	features.multiDrawIndirect = s->multiDraw;
+	features.drawIndirectFirstInstance = s->multiDraw;
+
+	// occlusion culling draws indirectly
+	if (!s->opt.noOcclusion) {
+		s->occlusionSupported = occlusionFeatures(s->vpd, &features);
+		if (!s->occlusionSupported)
+			errorf("occlusion culling disabled: multiDrawIndirect and drawIndirectFirstInstance are not supported");
+	}
+	SDL_AtomicSet(&s->occlusion, s->occlusionSupported);
 
 	// create device
 
+	VkPhysicalDeviceDescriptorIndexingFeatures dif = {};
+	if (!bindlessFeatures(s->vpd, &dif))
+		panicf("gpu doesn't support descriptor indexing");
+
+	VkPhysicalDeviceTimelineSemaphoreFeatures tsf = {};
+	tsf.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+	tsf.pNext = &dif;
+	tsf.timelineSemaphore = VK_TRUE;
+
 	VkPhysicalDeviceSynchronization2Features s2f = {};
 	s2f.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES;
+	s2f.pNext = &tsf;
 	s2f.synchronization2 = VK_TRUE;
 
 	VkPhysicalDeviceDynamicRenderingFeatures drf = {};
@@ -291,15 +512,18 @@ void beginVulkan(State *s) {
 	di.pQueueCreateInfos = (VkDeviceQueueCreateInfo[]){qci};
 	di.enabledExtensionCount = LENGTH(dextensions);
 	di.ppEnabledExtensionNames = dextensions;
+	di.pEnabledFeatures = &features;
 	
 	VkDevice dev;
 	must(vkCreateDevice(s->vpd, &di, NULL, &dev));
 	s->vdev = dev;
 
 	infof("vulkan device created");
+	startupTime(s, "device", start);
 
 	// create VMA allocator
 
+	start = SDL_GetPerformanceCounter();
 	VmaAllocatorCreateInfo aci = {};
 	aci.physicalDevice = s->vpd;
 	aci.device = s->vdev;
@@ -316,199 +540,327 @@ void beginVulkan(State *s) {
 	if (SDL_Vulkan_CreateSurface(s->window, instance, &s->vsurface) != SDL_TRUE) {
 		panicf("failed to create a vulkan surface using sdl2");
 	}
+	VkSurfaceFormatKHR surffmt = swapchainGetFormat(s->vpd, s->vsurface);
+	s->surffmt = surffmt;
+	startupTime(s, "allocator and surface", start);
+
+	// the pipelines only need the device and the color format
 
-	// create shaders
-
-	VkShaderModuleCreateInfo vsmci = {};
-	vsmci.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	vsmci.codeSize = shader_vert_len;
-	vsmci.pCode = (uint32_t *)shader_vert; // TODO: Alignment?
-	VkShaderModule vsm;
-	must(vkCreateShaderModule(dev, &vsmci, NULL, &vsm));
-	VkPipelineShaderStageCreateInfo vspsci = {};
-	vspsci.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	vspsci.stage = VK_SHADER_STAGE_VERTEX_BIT;
-	vspsci.module = vsm;
-	vspsci.pName = "main";
-
-	VkShaderModuleCreateInfo fsmci = {};
-	fsmci.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	fsmci.codeSize = shader_frag_len;
-	fsmci.pCode = (uint32_t *)shader_frag; // TODO: Alignment?
-	VkShaderModule fsm;
-	must(vkCreateShaderModule(dev, &fsmci, NULL, &fsm));
-	VkPipelineShaderStageCreateInfo fspsci = {};
-	fspsci.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	fspsci.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	fspsci.module = fsm;
-	fspsci.pName = "main";
-
-	VkPipelineShaderStageCreateInfo psci[] = {vspsci, fspsci};
+	SDL_Thread *pipelines = SDL_CreateThread(createPipelines, "pipelines", s);
+	mustPtr(pipelines, "pipeline creation thread: %s", SDL_GetError());
 
 	// create swapchain
 
-	VkSurfaceFormatKHR surffmt = swapchainGetFormat(s->vpd, s->vsurface);
+	start = SDL_GetPerformanceCounter();
 	swapchainConfigure(&s->sc, s->vpd, s->vsurface, 3, (VkExtent2D){1920, 1080});
 	swapchainInit(&s->sc, s->vdev, s->vsurface, surffmt);
+	startupTime(s, "swapchain", start);
 
 	// create depth buffer
 
+	start = SDL_GetPerformanceCounter();
 	createDepthBuffer(s);
+	startupTime(s, "depth buffer", start);
+
+	// the buffers are sized for the mesh
+
+	start = SDL_GetPerformanceCounter();
+	SDL_WaitThread(s->assets, NULL);
+	s->assets = NULL;
+	startupTime(s, "waiting for the assets", start);
 
 	// create vertex buffer
 
+	start = SDL_GetPerformanceCounter();
 	VkBufferCreateInfo vbci = {};
 	vbci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	vbci.size = sizeof(vertices);
-	vbci.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	vbci.size = s->vertexCount * sizeof(vec3);
+	vbci.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | DEFRAG_BUFFER_USAGE;
 	vbci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	VmaAllocationCreateInfo vbaci = {};
-	vbaci.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+	vbaci.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
 	vbaci.usage = VMA_MEMORY_USAGE_AUTO;
 	vbaci.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
-	must(vmaCreateBuffer(s->vma, &vbci, &vbaci, &s->vb, &s->vba, NULL));
+	VmaAllocationInfo vbai;
+	must(vmaCreateBuffer(s->vma, &vbci, &vbaci, &s->vb, &s->vba, &vbai));
 
 	// create index buffer
 
 	VkBufferCreateInfo ibci = {};
 	ibci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	ibci.size = sizeof(indices);
-	ibci.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+	ibci.size = s->indexCount * sizeof(uint32_t);
+	ibci.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | DEFRAG_BUFFER_USAGE;
 	ibci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	VmaAllocationCreateInfo ibaci = {};
-	ibaci.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+	ibaci.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
 	ibaci.usage = VMA_MEMORY_USAGE_AUTO;
 	ibaci.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
-	must(vmaCreateBuffer(s->vma, &ibci, &ibaci, &s->ib, &s->iba, NULL));
+	VmaAllocationInfo ibai;
+	must(vmaCreateBuffer(s->vma, &ibci, &ibaci, &s->ib, &s->iba, &ibai));
 
 	// TODO: Consider using a single allocation/buffer instead of separate ones.
 
-	// fill vertex buffer
-
-	void *vbdata;
-	must(vmaMapMemory(s->vma, s->vba, &vbdata));
-	memcpy(vbdata, vertices, sizeof(vertices));
-	vmaUnmapMemory(s->vma, s->vba);
-
-	// fill index buffer
-
-	void *ibdata;
-	must(vmaMapMemory(s->vma, s->iba, &ibdata));
-	memcpy(ibdata, indices, sizeof(indices));
-	vmaUnmapMemory(s->vma, s->iba);
-
-	// create graphics pipeline
-
-	VkPipelineRenderingCreateInfo plrci = {};
-	plrci.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
-	plrci.colorAttachmentCount = 1;
-	plrci.pColorAttachmentFormats = &surffmt.format;
-	plrci.depthAttachmentFormat = VK_FORMAT_D32_SFLOAT;
-
-	VkGraphicsPipelineCreateInfo plci = {};
-	plci.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	plci.pNext = &plrci;
-	plci.stageCount = LENGTH(psci);
-	plci.pStages = psci;
-	plci.pVertexInputState = &(VkPipelineVertexInputStateCreateInfo){
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-		.vertexBindingDescriptionCount = 1,
-		.pVertexBindingDescriptions = &(VkVertexInputBindingDescription){
-			0, sizeof(vec3), VK_VERTEX_INPUT_RATE_VERTEX
-		},
-		.vertexAttributeDescriptionCount = 1,
-		.pVertexAttributeDescriptions = &(VkVertexInputAttributeDescription){
-			0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0
-		},
-	};
-	plci.pInputAssemblyState = &(VkPipelineInputAssemblyStateCreateInfo){
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-		.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
-		.primitiveRestartEnable = VK_FALSE,
-	};
-	// const VkPipelineTessellationStateCreateInfo*     pTessellationState;
-	plci.pViewportState = &(VkPipelineViewportStateCreateInfo){
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
-		.viewportCount = 1,
-		.scissorCount = 1,
-	};
-	plci.pRasterizationState = &(VkPipelineRasterizationStateCreateInfo){
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
-		.polygonMode = VK_POLYGON_MODE_FILL,
-		.cullMode = VK_CULL_MODE_NONE,
-		.lineWidth = 1.0f,
-	};
-	plci.pMultisampleState = &(VkPipelineMultisampleStateCreateInfo){
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-		.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
-	};
-	plci.pDepthStencilState = &(VkPipelineDepthStencilStateCreateInfo){
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
-		.depthTestEnable = VK_TRUE,
-		.depthWriteEnable = VK_TRUE,
-		.depthCompareOp = VK_COMPARE_OP_LESS,
-	};
-	plci.pColorBlendState = &(VkPipelineColorBlendStateCreateInfo){
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
-		.attachmentCount = 1,
-		.pAttachments = &(VkPipelineColorBlendAttachmentState){
-			.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
-			.blendEnable = VK_TRUE,
-			.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
-			.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
-			.colorBlendOp = VK_BLEND_OP_ADD,
-			.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
-			.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
-			.alphaBlendOp = VK_BLEND_OP_ADD,
-		},
-		.blendConstants = {0, 0, 0, 0},
-	};
-	VkDynamicState dyns[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
-	plci.pDynamicState = &(VkPipelineDynamicStateCreateInfo){
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
-		.dynamicStateCount = LENGTH(dyns),
-		.pDynamicStates = (VkDynamicState *)&dyns,
-	};
-	VkPipelineLayoutCreateInfo pllyci = {};
-	pllyci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	VkPipelineLayout plly;
-	must(vkCreatePipelineLayout(dev, &pllyci, NULL, &plly));
-	plci.layout = plly;
-	// plci.renderPass = s->rp;
-	// plci.subpass = 0;
-	plci.basePipelineHandle = VK_NULL_HANDLE;
-	plci.basePipelineIndex = 0;
-	must(vkCreateGraphicsPipelines(dev, VK_NULL_HANDLE, 1, &plci, NULL, &s->pl));
+	// fill the buffers, they stay mapped and are copied on the gpu when moved
+
+	memcpy(vbai.pMappedData, s->vertexData, vbci.size);
+	memcpy(ibai.pMappedData, s->indexData, ibci.size);
+	s->vbd = (DefragBuffer){.info = vbci, .buf = &s->vb, .copy = 1};
+	s->ibd = (DefragBuffer){.info = ibci, .buf = &s->ib, .copy = 1};
+	startupTime(s, "geometry upload", start);
+
+	start = SDL_GetPerformanceCounter();
+	SDL_WaitThread(pipelines, NULL);
+	startupTime(s, "waiting for the pipelines", start);
 }
 
 // cleanup vulkan
 void endVulkan(State *s) {
 	vkDeviceWaitIdle(s->vdev);
+	bindlessDestroy(&s->bindless);
 }
 
-void printFramerate() {
+// returns 1 if the framerate was printed, every 2 s or every interval frames
+// if it isn't 0
+char printFramerate(uint32_t interval) {
 	static uint32_t frames = 0;
 	static uint32_t lastCalculation = 0;
 	uint32_t now = SDL_GetTicks(); // ms
 	frames += 1;
-	if (now - lastCalculation >= 2000) {
+	if (interval > 0 ? frames >= interval : now - lastCalculation >= 2000) {
 		infof("framerate: %"PRIu32, (1000 * frames)/(now - lastCalculation));
 		frames = 0;
 		lastCalculation = now;
+		return 1;
 	}
+	return 0;
 }
 
-void eventLoop(State *s) {
-	SDL_Event e;
-	char quit = 0;
-	char resize = 0;
-	uint32_t schimgi = 0;
-	uint32_t drawReadySemIndex = 0;
+// the contents aren't copied when the buffer is moved, it's written again
+void frameObjectsMoved(void *arg) {
+	FrameObjects *fo = arg;
+	fo->stale = 0;
+}
+
+void frameObjectsInit(FrameObjects *fo, uint32_t count, State *s) {
+	VkBufferCreateInfo bci = {};
+	bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bci.size = s->scene.tf.capacity * sizeof(mat4);
+	bci.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VmaAllocationCreateInfo aci = {};
+	aci.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+	aci.usage = VMA_MEMORY_USAGE_AUTO;
+	aci.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	for (uint32_t i = 0; i < count; i++) {
+		VmaAllocationInfo ai;
+		must(vmaCreateBuffer(s->vma, &bci, &aci, &fo[i].buf, &fo[i].alloc, &ai));
+		fo[i].data = ai.pMappedData;
+		fo[i].stale = 0;
+		fo[i].index = bindlessAddBuffer(&s->bindless, fo[i].buf, 0, VK_WHOLE_SIZE);
+		fo[i].defrag = (DefragBuffer){bci, &fo[i].buf, &fo[i].index, (void **)&fo[i].data, 0, frameObjectsMoved, &fo[i]};
+	}
+}
+
+// copies the world matrices updated since this frame's buffer was last written
+void frameObjectsWrite(FrameObjects *fo, const Transforms *tf) {
+	if (fo->stale < tf->count)
+		memcpy(fo->data + fo->stale, tf->world + fo->stale, (tf->count - fo->stale) * sizeof(mat4));
+	fo->stale = tf->count;
+}
+
+// simulation of one frame, run as a job while the previous frame is recorded
+typedef struct Simulation {
+	Scene *scene;
+	BvhCuller *culler;
+	float dt; // seconds
+	float aspect;
+	float height; // of the viewport, pixels
+	float lodThreshold; // pixels
+	char animate; // the scene is static in on-demand mode
+	// results
+	uint32_t *visible;
+	uint32_t *lods; // level of detail of each visible object
+	uint32_t visibleCount;
+	uint64_t triangles; // of the visible objects
+	RenderQueue *queue; // draws of the visible objects
+	uint32_t updated; // lowest updated transform
+	// statistics
+	uint64_t updateTicks;
+	uint64_t cullTicks;
+	uint64_t lodTicks;
+	uint64_t queueTicks;
+} Simulation;
+
+// queues the draws of the visible objects, sorted by state and front to back
+void simulateQueue(Simulation *sim) {
+	Scene *s = sim->scene;
+	queueClear(sim->queue);
+	for (uint32_t i = 0; i < sim->visibleCount; i++) {
+		const Object *o = &s->objects[sim->visible[i]];
+		const MeshLod *l = &s->meshes[o->mesh].lods[sim->lods[i]];
+		const Aabb *b = &s->bvh.boxes[sim->visible[i]];
+		vec3 c;
+		glm_vec3_center((float *)b->min, (float *)b->max, c);
+		uint64_t key = queueKey(QUEUE_PASS_OPAQUE, QUEUE_PIPELINE_SCENE, QUEUE_MATERIAL_DEFAULT,
+			glm_vec3_distance(c, s->cam.pos), o->mesh * MESH_LODS_MAX + sim->lods[i]);
+		queuePush(sim->queue, key, (QueueDraw){l->indexCount, l->firstIndex, o->node});
+	}
+	queueSort(sim->queue);
+}
+
+void simulate(void *arg) {
+	Simulation *sim = arg;
+	uint64_t start = SDL_GetPerformanceCounter();
+	sim->updated = sim->animate ? sceneUpdate(sim->scene, sim->dt) : sim->scene->tf.count;
+	cameraUpdate(&sim->scene->cam, sim->aspect);
+	uint64_t cullStart = SDL_GetPerformanceCounter();
+	sim->visibleCount = sceneCull(sim->scene, sim->culler, sim->visible);
+	uint64_t lodStart = SDL_GetPerformanceCounter();
+	sim->triangles = sceneSelectLods(sim->scene, sim->visible, sim->visibleCount, sim->height, sim->lodThreshold, sim->lods);
+	uint64_t queueStart = SDL_GetPerformanceCounter();
+	simulateQueue(sim);
+	sim->updateTicks += cullStart - start;
+	sim->cullTicks += lodStart - cullStart;
+	sim->lodTicks += queueStart - lodStart;
+	sim->queueTicks += SDL_GetPerformanceCounter() - queueStart;
+}
+
+// requests a redraw in on-demand mode, can be called from any thread
+void markDirty(State *s) {
+	SDL_AtomicSet(&s->dirty, 1);
+}
+
+// sends an event with the reply to the main thread
+void renderReply(State *s, RenderReply code, uint32_t image) {
+	SDL_Event e = {};
+	e.type = s->renderEvent;
+	e.user.code = code;
+	e.user.data1 = (void *)(uintptr_t)image;
+	if (SDL_PushEvent(&e) < 0)
+		panicf("SDL_PushEvent: %s", SDL_GetError());
+}
+
+// Records and submits frames for the images acquired by the main thread.
+// The scene is simulated and culled on the job system one frame ahead, while
+// the previous frame is being recorded.
+int renderLoop(void *data) {
+	State *s = data;
+	uint64_t frameNumber = 0;
+	uint64_t setupStart = SDL_GetPerformanceCounter();
 
 	Frames frames = {};
-	frames.count = 2;
+	frames.count = FRAMES_IN_FLIGHT;
 	framesInit(&frames, s->vdev, s->qfi);
 	Frame *frame;
+	// time the gpu work of each frame if the queue supports it
+	uint32_t qfpCount;
+	vkGetPhysicalDeviceQueueFamilyProperties(s->vpd, &qfpCount, NULL);
+	VkQueueFamilyProperties *qfp = calloc(qfpCount, sizeof(VkQueueFamilyProperties));
+	mustPtr(qfp, "queue family properties, len = %"PRIu32, qfpCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(s->vpd, &qfpCount, qfp);
+	VkPhysicalDeviceProperties pdp;
+	vkGetPhysicalDeviceProperties(s->vpd, &pdp);
+	float timestampPeriod = 0;
+	if (qfp[s->qfi].timestampValidBits > 0) {
+		timestampPeriod = pdp.limits.timestampPeriod;
+		framesInitTimestamps(&frames, s->vdev, timestampPeriod);
+		SDL_LockMutex(s->statsLock);
+		s->gpuTimed = 1;
+		SDL_UnlockMutex(s->statsLock);
+	}
+	free(qfp);
+
+	FrameObjects *fobjs = calloc(frames.count, sizeof(FrameObjects));
+	mustPtr(fobjs, "frame objects array, len = %"PRIu32, frames.count);
+	frameObjectsInit(fobjs, frames.count, s);
+
+
+	Particles particles = {};
+	if (s->opt.particles > 0)
+		particlesInit(&particles, s->vdev, s->vma, &s->bindless, s->opt.particles, s->surffmt.format, VK_FORMAT_D32_SFLOAT);
+
+	// the lights are scattered over the scene, up to a bit above it
+	Lights lights = {};
+	if (s->opt.lights > 0) {
+		Aabb area = s->scene.bvh.nodes[0].box;
+		area.max[1] += 0.5f;
+		lightsInit(&lights, s->vdev, s->vma, &s->bindless, frames.count, s->opt.lights, &area);
+	}
+
+	// buffers that can be moved by the defragmentation
+	Defrag defrag;
+	defragInit(&defrag, s->vdev, s->vma, &s->bindless, frames.count, s->opt.defragBudget, DEFRAG_BYTES_PER_PASS);
+	if (s->opt.defragBudget > 0) {
+		defragRegister(&defrag, s->vba, &s->vbd);
+		defragRegister(&defrag, s->iba, &s->ibd);
+		for (uint32_t i = 0; i < frames.count; i++)
+			defragRegister(&defrag, fobjs[i].alloc, &fobjs[i].defrag);
+		if (s->opt.particles > 0)
+			particlesDefrag(&particles, &defrag);
+		defragPrintStats(&defrag);
+	}
+
+	Occlusion occ = {};
+	char occluding = s->occlusionSupported;
+	if (occluding) {
+		occlusionInit(&occ, s->vdev, s->vma, &s->bindless, frames.count, s->scene.objectCount, pdp.limits.maxDrawIndirectCount, timestampPeriod);
+		occlusionResize(&occ, s->dbiv, s->sc.extent, frameNumber);
+	}
+
+	// this thread waits for the simulation, so it helps running jobs
+	JobSystem jobs;
+	jobsInit(&jobs, s->opt.threads, 1);
+	jobsRegister(&jobs);
+
+	// the levels of texture files are read by jobs
+	TextureStreamer streamer;
+	textureStreamerInit(&streamer, s->vdev, s->vma, &s->bindless, &jobs, frames.count, 32 << 20, (VkDeviceSize)s->opt.textureBudget << 20);
+	textureStreamerAdd(&streamer, &s->tex);
+
+	BvhCuller culler;
+	bvhCullerInit(&culler, &jobs);
+	// one list is drawn while the other is filled by the simulation
+	uint32_t *visible[2], *lods[2];
+	RenderQueue queues[2];
+	for (uint32_t i = 0; i < LENGTH(visible); i++) {
+		visible[i] = calloc(s->scene.objectCount, sizeof(uint32_t));
+		mustPtr(visible[i], "visible objects array, len = %"PRIu32, s->scene.objectCount);
+		lods[i] = calloc(s->scene.objectCount, sizeof(uint32_t));
+		mustPtr(lods[i], "levels of detail array, len = %"PRIu32, s->scene.objectCount);
+		queueInit(&queues[i], s->scene.objectCount);
+	}
+	QueueRecorder recorder;
+	queueRecorderInit(&recorder, s->vma, frames.count, s->scene.objectCount, s->multiDraw, pdp.limits.maxDrawIndirectCount, s->plly, s->pushStages, &s->vb, &s->ib);
+	recorder.pipelines[QUEUE_PIPELINE_SCENE] = s->pl;
+	uint32_t materials[1]; // bindless texture indices, set every frame
+	recorder.materials = materials;
+
+	PushConstants pc = {};
+	Simulation sim = {};
+	sim.scene = &s->scene;
+	sim.culler = &culler;
+	sim.animate = !s->opt.onDemand;
+	sim.lodThreshold = s->opt.lodThreshold;
+	JobCounter simDone = {};
+	uint64_t lastTicks = SDL_GetPerformanceCounter();
+	uint64_t recordTicks = 0;
+	uint32_t statFrames = 0;
+
+	Capture capture = {};
+	char capturing = 0;
+	if (s->opt.captureDir != NULL) {
+		if (!captureSupported(s->surffmt.format)) {
+			errorf("capture disabled: swapchain format %d is not 8-bit RGBA or BGRA", s->surffmt.format);
+		} else if (s->sc.usage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) {
+			capture.dir = s->opt.captureDir;
+			capture.format = s->opt.captureFormat;
+			// each frame in flight can have one copy pending on the gpu and one being encoded
+			captureInit(&capture, s->vdev, s->vma, 2 * frames.count, s->surffmt.format, s->sc.extent);
+			capturing = 1;
+		} else {
+			errorf("capture disabled: swapchain images can't be used as a transfer source");
+		}
+	}
 
 	VkRenderingAttachmentInfo ati = {};
 	ati.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
@@ -523,7 +875,8 @@ void eventLoop(State *s) {
 	dti.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
 	dti.imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
 	dti.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	dti.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	// the depth pyramid is built from it
+	dti.storeOp = occluding ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	dti.clearValue = (VkClearValue){
 		.depthStencil = (VkClearDepthStencilValue){.depth = 1.0f}, // TODO: ?
 	};
@@ -579,8 +932,10 @@ void eventLoop(State *s) {
 	};
 	VkImageMemoryBarrier2 dmb1 = {};
 	dmb1.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
-	dmb1.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
-	dmb1.srcAccessMask = VK_ACCESS_2_NONE;
+	// the previous frame may still be drawing to it or reducing it
+	dmb1.srcStageMask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT
+		| VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	dmb1.srcAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 	dmb1.dstStageMask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
 	dmb1.dstAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 	dmb1.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -593,7 +948,7 @@ void eventLoop(State *s) {
 		.baseArrayLayer = 0,
 		.layerCount = 1,
 	};
-	VkImageMemoryBarrier2 imbs[] = {imb1, imb2, dmb1};
+	VkImageMemoryBarrier2 imbs[] = {imb1, dmb1};
 
 	VkDependencyInfo di = {};
 	di.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
@@ -601,23 +956,34 @@ void eventLoop(State *s) {
 	di.imageMemoryBarrierCount = LENGTH(imbs);
 	di.pImageMemoryBarriers = imbs;
 
-	while (!quit) {
-		while (SDL_PollEvent(&e) != 0) {
-			if (e.type == SDL_QUIT)
-				quit = 1;
-			else if (e.type == SDL_WINDOWEVENT) {
-				if (e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
-					resize = 1;
-				}
-			}
-		}
-
-		frame = framesNext(&frames);
+	// transition to the present layout after rendering
+	VkDependencyInfo pdi = {};
+	pdi.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+	pdi.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+	pdi.imageMemoryBarrierCount = 1;
+	pdi.pImageMemoryBarriers = &imb2;
+
+	// simulate the first frame
+	sim.visible = visible[0];
+	sim.lods = lods[0];
+	sim.queue = &queues[0];
+	sim.aspect = (float)s->sc.extent.width / s->sc.extent.height;
+	sim.height = s->sc.extent.height;
+	jobsRun(&jobs, simulate, &sim, &simDone);
+	startupTime(s, "render thread setup", setupStart);
+
+	for (;;) {
+		uint64_t waitStart = SDL_GetPerformanceCounter();
+		SDL_SemWait(s->request);
+		SDL_LockMutex(s->statsLock);
+		s->renderWaitTicks += SDL_GetPerformanceCounter() - waitStart;
+		SDL_UnlockMutex(s->statsLock);
+		RenderRequest req = s->req;
+		if (req.type == RENDER_QUIT)
+			break;
 
-		if (resize) {
-			// TODO: What if the size becomes 0x0?
-			// TODO: Sometimes after resizing the window, the swapchain is being continuously recreated without drawing anything.
-			resize = 0;
+		if (req.type == RENDER_RESIZE) {
+			// not requested while the window has no area, see windowHidden
 			must(vkDeviceWaitIdle(s->vdev));
 			// destroy depth buffer
 			vkDestroyImageView(s->vdev, s->dbiv, NULL);
@@ -626,69 +992,208 @@ void eventLoop(State *s) {
 			swapchainResize(&s->sc, s->vdev, s->vpd, s->vsurface);
 			// recreate depth buffer
 			createDepthBuffer(s);
+			if (occluding)
+				occlusionResize(&occ, s->dbiv, s->sc.extent, frameNumber);
+			if (capturing)
+				captureResize(&capture, s->sc.extent);
 			// update variables
 			ri.renderArea.extent = s->sc.extent;
 			vp.width = s->sc.extent.width;
 			vp.height = s->sc.extent.height;
 			scis.extent = s->sc.extent;
-		}
-
-		// acquire image from swap chain, wait for an available command buffer
-
-		drawReadySemIndex = swapchainSemsReserve(&s->sc.drawReady);
-		VkResult ar = vkAcquireNextImageKHR(s->vdev, s->sc.chain, 3000000000, s->sc.drawReady.sem[drawReadySemIndex], VK_NULL_HANDLE, &schimgi);
-		swapchainsSemsAssociate(&s->sc.drawReady, drawReadySemIndex, schimgi);
-		if (ar == VK_SUCCESS) {
-		} else if (ar == VK_ERROR_OUT_OF_DATE_KHR) {
-			resize = 1;
+			renderReply(s, RENDER_RESIZED, 0);
 			continue;
-		} else if (ar != VK_SUBOPTIMAL_KHR) {
-			panicf("failed to acquire swap chain image, VkResult=%d", ar);
 		}
+		uint32_t schimgi = req.image;
+		uint64_t recordStart = SDL_GetPerformanceCounter();
+
+		// take the results of the simulation, the scene isn't modified until
+		// the next one is started
+
+		jobsWait(&jobs, &simDone);
+		SDL_LockMutex(s->inputLock);
+		char pick = s->pick;
+		float pickX = s->pickX, pickY = s->pickY;
+		s->pick = 0;
+		SDL_UnlockMutex(s->inputLock);
+		if (pick) {
+			uint32_t o = scenePick(&s->scene, pickX, pickY);
+			if (o == BVH_NONE)
+				infof("picked nothing");
+			else
+				infof("picked object %"PRIu32" (node %"PRIu32")", o, s->scene.objects[o].node);
+		}
+		uint32_t *drawn = sim.visible;
+		uint32_t *drawnLods = sim.lods;
+		RenderQueue *drawnQueue = sim.queue;
+		uint32_t drawnCount = sim.visibleCount;
+		float dt = sim.animate ? sim.dt : 0; // the particles are frozen in on-demand mode
+		for (uint32_t i = 0; i < frames.count; i++)
+			if (sim.updated < fobjs[i].stale)
+				fobjs[i].stale = sim.updated;
+		glm_mat4_copy(s->scene.cam.viewProj, pc.viewProj);
+		mat4 view;
+		glm_mat4_copy(s->scene.cam.view, view);
+		float ppu = scenePixelsPerUnit(&s->scene, drawn, drawnCount, s->sc.extent.height);
+
+		// wait for an available command buffer
 
+		frame = framesNext(&frames);
+		uint64_t fenceStart = SDL_GetPerformanceCounter();
 		must(vkWaitForFences(s->vdev, 1, &frame->ready, VK_TRUE, 3000000000));
+		uint64_t fenceTicks = SDL_GetPerformanceCounter() - fenceStart;
 		vkResetFences(s->vdev, 1, &frame->ready);
-		printFramerate();
-
-		// record command buffer
+		uint64_t gpuTime = framesGpuTime(&frames, s->vdev);
+		SDL_LockMutex(s->statsLock);
+		s->renderWaitTicks += fenceTicks;
+		s->gpuTime += gpuTime;
+		s->drawnFrames++;
+		SDL_UnlockMutex(s->statsLock);
+		bindlessUpdate(&s->bindless, frameNumber);
 
 		VkCommandBufferBeginInfo cmdbbi = {};
 		cmdbbi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 		cmdbbi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 		must(vkBeginCommandBuffer(frame->cmdbuf, &cmdbbi));
+		framesTimestampBegin(&frames, frame->cmdbuf);
+
+		// moves buffers before their references are used for this frame
+		if (s->opt.defragBudget > 0 && defragUpdate(&defrag, frame->cmdbuf, frameNumber))
+			markDirty(s);
+		FrameObjects *fo = &fobjs[frames.current];
+		frameObjectsWrite(fo, &s->scene.tf);
+		if (s->opt.lights > 0)
+			lightsUpdate(&lights, frames.current, s->scene.time, &s->scene.cam, s->sc.extent);
+		char culling = occluding && SDL_AtomicGet(&s->occlusion);
+		if (occluding) {
+			occlusionCollect(&occ, frames.current);
+			if (culling)
+				occlusionSetCandidates(&occ, frames.current, &s->scene, drawn, drawnLods, drawnCount);
+			else
+				occ.pyramidValid = 0; // outdated once culling is enabled again
+		}
+
+		statFrames++;
+		if (printFramerate(s->fixedDt > 0 ? REPLAY_STATS_FRAMES : 0)) {
+			double f = SDL_GetPerformanceFrequency();
+			infof("scene update: %.3f ms (%"PRIu32" nodes), culling: %.3f ms (%"PRIu32"/%"PRIu32" objects drawn, %"PRIu32" bvh rebuilds), lod selection: %.3f ms (%"PRIu64" triangles), queue: %.3f ms, recording: %.3f ms",
+				1000.0 * sim.updateTicks / f / statFrames, s->scene.tf.count,
+				1000.0 * sim.cullTicks / f / statFrames,
+				drawnCount, s->scene.objectCount, s->scene.bvh.rebuilds,
+				1000.0 * sim.lodTicks / f / statFrames, sim.triangles,
+				1000.0 * sim.queueTicks / f / statFrames,
+				1000.0 * recordTicks / f / statFrames);
+			jobsPrintStats(&jobs);
+			queuePrintStats(&recorder);
+			if (occluding)
+				occlusionPrintStats(&occ);
+			sim.updateTicks = 0;
+			sim.cullTicks = 0;
+			sim.lodTicks = 0;
+			sim.queueTicks = 0;
+			recordTicks = 0;
+			statFrames = 0;
+		}
+
+		// simulate the next frame while this one is recorded
+
+		uint64_t now = SDL_GetPerformanceCounter();
+		sim.dt = s->fixedDt > 0 ? s->fixedDt : (float)(now - lastTicks) / SDL_GetPerformanceFrequency();
+		lastTicks = now;
+		sim.aspect = (float)s->sc.extent.width / s->sc.extent.height;
+		sim.height = s->sc.extent.height;
+		sim.visible = drawn == visible[0] ? visible[1] : visible[0];
+		sim.lods = drawnLods == lods[0] ? lods[1] : lods[0];
+		sim.queue = drawnQueue == &queues[0] ? &queues[1] : &queues[0];
+		jobsRun(&jobs, simulate, &sim, &simDone);
+
+		// record command buffer
+
+		// stream textures for the size they have on screen
+
+		textureRequest(&s->tex, textureLevelForPixels(&s->tex, ppu), frameNumber);
+		// more levels may be streamed in the next frame
+		if (textureStreamerUpdate(&streamer, frame->cmdbuf, frames.current, frameNumber))
+			markDirty(s);
+		if (s->opt.particles > 0)
+			particlesUpdate(&particles, frame->cmdbuf, dt, GLM_VEC3_ZERO);
+		if (s->opt.lights > 0) {
+			lightsAssign(&lights, frame->cmdbuf, frames.current);
+			pc.lights = lightsIndex(&lights, frames.current);
+			pc.clusters = lightsClustersIndex(&lights, frames.current);
+		}
+		pc.objects = fo->index;
+		// never BINDLESS_NONE, the texture may not have an image yet
+		pc.tex = textureIndex(&streamer, &s->tex);
+		materials[QUEUE_MATERIAL_DEFAULT] = pc.tex;
+		if (!culling)
+			queueRecorderBegin(&recorder, frames.current);
 
 		imbs[0].image = s->sc.img[schimgi];
-		imbs[1].image = s->sc.img[schimgi];
-		imbs[2].image = s->dbi;
+		imbs[1].image = s->dbi;
 		vkCmdPipelineBarrier2(frame->cmdbuf, &di);
-		
-		ati.imageView = s->sc.imgv[schimgi];
-		dti.imageView = s->dbiv;
-		vkCmdBeginRendering(frame->cmdbuf, &ri);
 
-		ri.renderArea.extent = s->sc.extent;
-		vp.width = s->sc.extent.width;
-		vp.height = s->sc.extent.height;
-		vkCmdSetViewport(frame->cmdbuf, 0, 1, &vp);
-		vkCmdSetScissor(frame->cmdbuf, 0, 1, &scis);
+		// with occlusion culling the objects visible in the last frame's
+		// depth pyramid are drawn first, the rest is retested against the
+		// pyramid of this frame's depth and drawn in a second pass
+		uint32_t passes = culling ? 2 : 1;
+		for (uint32_t pass = 0; pass < passes; pass++) {
+			if (pass == 1)
+				occlusionBuildPyramid(&occ, frame->cmdbuf, frames.current, s->dbi, s->sc.img[schimgi]);
+			if (culling)
+				occlusionCull(&occ, frame->cmdbuf, frames.current, pass, pc.viewProj);
+
+			ati.imageView = s->sc.imgv[schimgi];
+			dti.imageView = s->dbiv;
+			ati.loadOp = pass == 0 ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
+			dti.loadOp = ati.loadOp;
+			vkCmdBeginRendering(frame->cmdbuf, &ri);
 
-		vkCmdBindPipeline(frame->cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, s->pl);
-		vkCmdBindVertexBuffers(frame->cmdbuf, 0, 1, &s->vb, (VkDeviceSize[]){0});
-		vkCmdBindIndexBuffer(frame->cmdbuf, s->ib, 0, VK_INDEX_TYPE_UINT32);
+			ri.renderArea.extent = s->sc.extent;
+			vp.width = s->sc.extent.width;
+			vp.height = s->sc.extent.height;
+			vkCmdSetViewport(frame->cmdbuf, 0, 1, &vp);
+			vkCmdSetScissor(frame->cmdbuf, 0, 1, &scis);
+
+			bindlessBind(&s->bindless, frame->cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, s->plly);
+			if (culling) {
+				vkCmdBindPipeline(frame->cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, s->pl);
+				vkCmdBindVertexBuffers(frame->cmdbuf, 0, 1, &s->vb, (VkDeviceSize[]){0});
+				vkCmdBindIndexBuffer(frame->cmdbuf, s->ib, 0, VK_INDEX_TYPE_UINT32);
+				vkCmdPushConstants(frame->cmdbuf, s->plly, s->pushStages, 0, sizeof(pc), &pc);
+				occlusionDraw(&occ, frame->cmdbuf, frames.current, pass);
+			} else {
+				queueRecord(&recorder, frame->cmdbuf, drawnQueue, QUEUE_PASS_OPAQUE, &pc);
+			}
+			// blended over everything opaque
+			if (pass == passes - 1 && s->opt.particles > 0) {
+				particlesDraw(&particles, frame->cmdbuf, view, pc.viewProj);
+				queueRecorderInvalidate(&recorder);
+			}
+			vkCmdEndRendering(frame->cmdbuf);
+		}
+		if (culling)
+			occlusionEnd(&occ, frame->cmdbuf, frames.current);
 
-		vkCmdDrawIndexed(frame->cmdbuf, LENGTH(indices), 1, 0, 0, 0);
-		vkCmdEndRendering(frame->cmdbuf);
+		char captured = capturing && captureRecord(&capture, frame->cmdbuf, s->sc.img[schimgi], frameNumber);
+		if (!captured) {
+			imb2.image = s->sc.img[schimgi];
+			vkCmdPipelineBarrier2(frame->cmdbuf, &pdi);
+		}
 
+		framesTimestampEnd(&frames, frame->cmdbuf);
 		must(vkEndCommandBuffer(frame->cmdbuf));
 
 		// submit command buffer
+		// the main thread only presents after this reply, so the queue is
+		// never used by both threads at the same time
 
 		VkSubmitInfo2 si = {};
 		si.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
 		si.waitSemaphoreInfoCount = 1;
 		si.pWaitSemaphoreInfos = &(VkSemaphoreSubmitInfo){
 			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
-			.semaphore = s->sc.drawReady.sem[drawReadySemIndex],
+			.semaphore = s->sc.drawReady.sem[req.drawReadySem],
 			.stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
 		};
 		si.commandBufferInfoCount = 1;
@@ -696,48 +1201,410 @@ void eventLoop(State *s) {
 			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
 			.commandBuffer = frame->cmdbuf,
 		};
-		si.signalSemaphoreInfoCount = 1;
-		si.pSignalSemaphoreInfos = &(VkSemaphoreSubmitInfo){
-			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
-			.semaphore = s->sc.presReady[schimgi],
-			.stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
-			
-		};
+		VkSemaphoreSubmitInfo ssi[2] = {};
+		ssi[0].sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+		ssi[0].semaphore = s->sc.presReady[schimgi];
+		ssi[0].stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+		if (captured)
+			ssi[1] = captureSignal(&capture);
+		si.signalSemaphoreInfoCount = captured ? 2 : 1;
+		si.pSignalSemaphoreInfos = ssi;
 
 		must(vkQueueSubmit2(s->queue, 1, &si, frame->ready));
+		if (captured)
+			captureCommit(&capture);
+		frameNumber++;
+		recordTicks += SDL_GetPerformanceCounter() - recordStart;
+		renderReply(s, RENDER_SUBMITTED, schimgi);
+	}
+
+	jobsWait(&jobs, &simDone);
+	must(vkDeviceWaitIdle(s->vdev));
+	if (s->opt.defragBudget > 0)
+		defragDestroy(&defrag);
+	if (occluding)
+		occlusionDestroy(&occ, frameNumber);
+	if (s->opt.particles > 0)
+		particlesDestroy(&particles, frameNumber);
+	if (s->opt.lights > 0)
+		lightsDestroy(&lights, frameNumber);
+	if (capturing)
+		captureDestroy(&capture);
+	textureStreamerDestroy(&streamer);
+	bvhCullerDestroy(&culler);
+	jobsDestroy(&jobs);
+	queueRecorderDestroy(&recorder);
+	for (uint32_t i = 0; i < LENGTH(visible); i++) {
+		free(visible[i]);
+		free(lods[i]);
+		queueDestroy(&queues[i]);
+	}
+	for (uint32_t i = 0; i < frames.count; i++)
+		vmaDestroyBuffer(s->vma, fobjs[i].buf, fobjs[i].alloc);
+	free(fobjs);
+	framesDestroy(&frames, s->vdev);
+	renderReply(s, RENDER_DONE, 0);
+	return 0;
+}
+
+// acquires the next image and hands it to the render thread, or asks it to
+// resize the swapchain or to quit
+void renderRequest(State *s, char quit, char *resize) {
+	RenderRequest *r = &s->req;
+	r->type = RENDER_FRAME;
+	if (quit) {
+		r->type = RENDER_QUIT;
+	} else if (*resize) {
+		*resize = 0;
+		r->type = RENDER_RESIZE;
+	} else {
+		r->drawReadySem = swapchainSemsReserve(&s->sc.drawReady);
+		VkResult ar = vkAcquireNextImageKHR(s->vdev, s->sc.chain, 3000000000, s->sc.drawReady.sem[r->drawReadySem], VK_NULL_HANDLE, &r->image);
+		swapchainsSemsAssociate(&s->sc.drawReady, r->drawReadySem, r->image);
+		if (ar == VK_SUCCESS) {
+		} else if (ar == VK_ERROR_OUT_OF_DATE_KHR) {
+			r->type = RENDER_RESIZE;
+		} else if (ar != VK_SUBOPTIMAL_KHR) {
+			panicf("failed to acquire swap chain image, VkResult=%d", ar);
+		}
+	}
+	SDL_SemPost(s->request);
+}
 
-		// present swap chain image
-
-		VkPresentInfoKHR pi = {};
-		pi.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-		pi.waitSemaphoreCount = 1;
-		pi.pWaitSemaphores = &s->sc.presReady[schimgi];
-		pi.swapchainCount = 1;
-		pi.pSwapchains = &s->sc.chain;
-		pi.pImageIndices = &schimgi;
-		VkResult pr = vkQueuePresentKHR(s->queue, &pi);
-		if (pr == VK_SUCCESS) {
-		} else if (pr == VK_ERROR_OUT_OF_DATE_KHR || pr == VK_SUBOPTIMAL_KHR) {
+// returns 1 if no part of the window can be seen, nothing is drawn then
+char windowHidden(State *s) {
+	if (SDL_GetWindowFlags(s->window) & (SDL_WINDOW_MINIMIZED | SDL_WINDOW_HIDDEN))
+		return 1;
+	int w, h;
+	SDL_Vulkan_GetDrawableSize(s->window, &w, &h);
+	return w == 0 || h == 0;
+}
+
+// logs how much of the elapsed time the threads and the gpu were idle
+void printIdle(State *s, uint64_t mainWaitTicks, uint64_t elapsed) {
+	SDL_LockMutex(s->statsLock);
+	uint64_t renderWaitTicks = s->renderWaitTicks;
+	uint64_t gpuTime = s->gpuTime;
+	uint32_t drawnFrames = s->drawnFrames;
+	char gpuTimed = s->gpuTimed;
+	s->renderWaitTicks = 0;
+	s->gpuTime = 0;
+	s->drawnFrames = 0;
+	SDL_UnlockMutex(s->statsLock);
+	double ns = 1e9 * elapsed / SDL_GetPerformanceFrequency();
+	char gpu[32] = "untimed";
+	if (gpuTimed)
+		snprintf(gpu, sizeof(gpu), "%.1f%%", gpuTime < ns ? 100.0 - 100.0 * gpuTime / ns : 0.0);
+	infof("idle: main thread %.1f%%, render thread %.1f%%, gpu %s (%"PRIu32" frames drawn)",
+		100.0 * mainWaitTicks / elapsed, renderWaitTicks < elapsed ? 100.0 * renderWaitTicks / elapsed : 100.0,
+		gpu, drawnFrames);
+}
+
+// handles a key or mouse event, live or replayed
+void handleInput(State *s, const SDL_Event *e, char *quit) {
+	if (e->type == SDL_QUIT) {
+		*quit = 1;
+	} else if (e->type == SDL_KEYDOWN && e->key.keysym.sym == SDLK_o && s->occlusionSupported) {
+		char on = !SDL_AtomicGet(&s->occlusion);
+		SDL_AtomicSet(&s->occlusion, on);
+		infof("occlusion culling %s", on ? "enabled" : "disabled");
+		markDirty(s);
+	} else if (e->type == SDL_KEYDOWN || e->type == SDL_MOUSEWHEEL || (e->type == SDL_MOUSEMOTION && e->motion.state != 0)) {
+		markDirty(s);
+	} else if (e->type == SDL_MOUSEBUTTONDOWN && e->button.button == SDL_BUTTON_LEFT) {
+		int w, h;
+		SDL_GetWindowSize(s->window, &w, &h);
+		SDL_LockMutex(s->inputLock);
+		s->pick = 1;
+		s->pickX = 2.0f * e->button.x / w - 1.0f;
+		s->pickY = 2.0f * e->button.y / h - 1.0f;
+		SDL_UnlockMutex(s->inputLock);
+		markDirty(s);
+	}
+}
+
+// Handles events and presents the frames submitted by the render thread.
+// There is at most one request to the render thread outstanding, the next one
+// is sent after its reply arrived, so the swapchain and the queue are never
+// used by both threads at once. Nothing is drawn while the window is hidden,
+// and in on-demand mode only after input, a resize or a call to markDirty.
+// When replaying, the live input and resizes are ignored, the recorded ones
+// are handled once as many frames were requested as when they were recorded,
+// and frames are drawn continuously until the recording ends.
+void eventLoop(State *s) {
+	SDL_Event e;
+	char quit = 0;
+	char resize = 0;
+	char done = 0;
+	char pending = 0; // a request waits for its reply
+	char hidden = windowHidden(s);
+	uint64_t waitTicks = 0; // this thread blocked in SDL
+	uint64_t statsStart = SDL_GetPerformanceCounter();
+	uint64_t statsInterval = SDL_GetPerformanceFrequency() * IDLE_STATS_MS / 1000;
+	uint32_t requested = 0; // frames requested from the render thread
+	char presented = 0;
+	Replay replay = {};
+	char recording = 0, replaying = 0;
+	if (s->opt.replayFile != NULL) {
+		int w, h, cw, ch;
+		if (!replayBegin(&replay, s->opt.replayFile, &w, &h))
+			panicf("can't replay %s", s->opt.replayFile);
+		replaying = 1;
+		SDL_GetWindowSize(s->window, &cw, &ch);
+		if (w != cw || h != ch) {
+			SDL_SetWindowSize(s->window, w, h);
 			resize = 1;
+		}
+	} else if (s->opt.recordFile != NULL) {
+		int w, h;
+		SDL_GetWindowSize(s->window, &w, &h);
+		recording = replayRecordBegin(&replay, s->opt.recordFile, w, h);
+	}
+
+	s->request = SDL_CreateSemaphore(0);
+	mustPtr(s->request, "render request semaphore: %s", SDL_GetError());
+	s->inputLock = SDL_CreateMutex();
+	mustPtr(s->inputLock, "input mutex: %s", SDL_GetError());
+	s->statsLock = SDL_CreateMutex();
+	mustPtr(s->statsLock, "statistics mutex: %s", SDL_GetError());
+	s->renderEvent = SDL_RegisterEvents(1);
+	mustCondition(s->renderEvent != (uint32_t)-1, "sdl user event registered");
+	markDirty(s);
+	SDL_Thread *render = SDL_CreateThread(renderLoop, "render", s);
+	mustPtr(render, "render thread: %s", SDL_GetError());
+
+	while (!done) {
+		if (replaying && !quit) {
+			ReplayRecord rec;
+			while (replayNext(&replay, requested, &rec)) {
+				if (rec.type == REPLAY_RESIZE) {
+					SDL_SetWindowSize(s->window, rec.a, rec.b);
+					resize = 1;
+				} else {
+					SDL_Event re;
+					replayEvent(&rec, &re);
+					handleInput(s, &re, &quit);
+				}
+			}
+			if (replayEnded(&replay))
+				quit = 1;
+		}
+		if (!pending && (quit || (!hidden && (resize || !s->opt.onDemand || replaying || SDL_AtomicSet(&s->dirty, 0))))) {
+			renderRequest(s, quit, &resize);
+			if (s->req.type == RENDER_FRAME)
+				requested++;
+			pending = 1;
+		}
+
+		uint64_t waitStart = SDL_GetPerformanceCounter();
+		int got = pending ? SDL_WaitEvent(&e) : SDL_WaitEventTimeout(&e, IDLE_WAIT_MS);
+		uint64_t now = SDL_GetPerformanceCounter();
+		waitTicks += now - waitStart;
+		if (now - statsStart >= statsInterval) {
+			printIdle(s, waitTicks, now - statsStart);
+			waitTicks = 0;
+			statsStart = now;
+		}
+		if (!got) {
+			// SDL_WaitEventTimeout also returns 0 when it times out
+			if (pending)
+				panicf("SDL_WaitEvent: %s", SDL_GetError());
 			continue;
+		}
+
+		if (e.type == SDL_QUIT) {
+			// closing the window also ends a replay
+			if (recording)
+				replayRecordEvent(&replay, requested, &e);
+			quit = 1;
+		} else if (e.type == SDL_WINDOWEVENT) {
+			if (e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED && !replaying) {
+				if (recording)
+					replayRecordResize(&replay, requested, e.window.data1, e.window.data2);
+				resize = 1;
+			}
+			// shown, hidden, exposed, minimized, restored, ...
+			hidden = windowHidden(s);
+			markDirty(s);
+		} else if (replayIsInput(&e)) {
+			if (!replaying) {
+				if (recording)
+					replayRecordEvent(&replay, requested, &e);
+				handleInput(s, &e, &quit);
+			}
+		} else if (e.type == s->renderEvent && e.user.code == RENDER_SUBMITTED) {
+			pending = 0;
+			if (replaying)
+				replayFrameSubmitted(&replay);
+			// present swap chain image
+			uint32_t schimgi = (uintptr_t)e.user.data1;
+			VkPresentInfoKHR pi = {};
+			pi.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+			pi.waitSemaphoreCount = 1;
+			pi.pWaitSemaphores = &s->sc.presReady[schimgi];
+			pi.swapchainCount = 1;
+			pi.pSwapchains = &s->sc.chain;
+			pi.pImageIndices = &schimgi;
+			VkResult pr = vkQueuePresentKHR(s->queue, &pi);
+			if (!presented) {
+				infof("startup: time to first present %.1f ms",
+					1000.0 * (SDL_GetPerformanceCounter() - s->startTicks) / SDL_GetPerformanceFrequency());
+				presented = 1;
+			}
+			if (pr == VK_SUCCESS) {
+			} else if (pr == VK_ERROR_OUT_OF_DATE_KHR || pr == VK_SUBOPTIMAL_KHR) {
+				resize = 1;
+			} else {
+				panicf("failed to present swap chain image, VkResult=%d", pr);
+			}
+		} else if (e.type == s->renderEvent && e.user.code == RENDER_RESIZED) {
+			pending = 0;
+			// draw the new size at least once
+			markDirty(s);
+		} else if (e.type == s->renderEvent && e.user.code == RENDER_DONE) {
+			done = 1;
+		}
+	}
+
+	SDL_WaitThread(render, NULL);
+	replayEnd(&replay);
+	SDL_DestroyMutex(s->statsLock);
+	SDL_DestroyMutex(s->inputLock);
+	SDL_DestroySemaphore(s->request);
+}
+
+// returns 0 if the device can't sample the format of the loaded texture
+char textureSupported(State *s) {
+	VkFormatProperties fp;
+	vkGetPhysicalDeviceFormatProperties(s->vpd, s->tex.format, &fp);
+	VkFormatFeatureFlags need = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT | VK_FORMAT_FEATURE_TRANSFER_SRC_BIT;
+	if ((fp.optimalTilingFeatures & need) != need) {
+		errorf("texture %s: format %d is not supported by the device", s->tex.name, s->tex.format);
+		return 0;
+	}
+	return 1;
+}
+
+void usage(const char *argv0) {
+	printf("usage: %s [-capture dir] [-captureformat raw|ppm|png] [-objects n] [-threads n] [-texture file.ktx2|file.dds] [-texbudget MiB] [-ondemand] [-flat] [-noocclusion] [-particles n] [-lights n] [-defragbudget ms] [-sphere segments] [-lodthreshold px] [-record file] [-replay file] [-log file] [-loglevel debug|info|error]\n", argv0);
+}
+
+// returns 0 if the options are invalid
+char parseOptions(Options *o, int argc, char *argv[]) {
+	o->captureFormat = CAPTURE_PNG;
+	o->objects = 256;
+	o->threads = SDL_GetCPUCount() > 1 ? SDL_GetCPUCount() - 1 : 1;
+	o->textureBudget = 64;
+	o->lights = 256;
+	o->defragBudget = 0.5f;
+	o->lodThreshold = 1.0f;
+	o->logLevel = LOG_INFO;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-capture") == 0 && i + 1 < argc) {
+			o->captureDir = argv[++i];
+		} else if (strcmp(argv[i], "-captureformat") == 0 && i + 1 < argc) {
+			int f = captureParseFormat(argv[++i]);
+			if (f < 0) {
+				errorf("unknown capture format: %s", argv[i]);
+				return 0;
+			}
+			o->captureFormat = f;
+		} else if (strcmp(argv[i], "-objects") == 0 && i + 1 < argc) {
+			o->objects = strtoul(argv[++i], NULL, 10);
+			if (o->objects == 0) {
+				errorf("-objects must be at least 1");
+				return 0;
+			}
+		} else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+			o->threads = strtoul(argv[++i], NULL, 10);
+			if (o->threads == 0) {
+				errorf("-threads must be at least 1");
+				return 0;
+			}
+		} else if (strcmp(argv[i], "-texture") == 0 && i + 1 < argc) {
+			o->texture = argv[++i];
+		} else if (strcmp(argv[i], "-texbudget") == 0 && i + 1 < argc) {
+			o->textureBudget = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-ondemand") == 0) {
+			o->onDemand = 1;
+		} else if (strcmp(argv[i], "-flat") == 0) {
+			o->flat = 1;
+		} else if (strcmp(argv[i], "-noocclusion") == 0) {
+			o->noOcclusion = 1;
+		} else if (strcmp(argv[i], "-particles") == 0 && i + 1 < argc) {
+			o->particles = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-lights") == 0 && i + 1 < argc) {
+			o->lights = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-defragbudget") == 0 && i + 1 < argc) {
+			o->defragBudget = strtof(argv[++i], NULL);
+		} else if (strcmp(argv[i], "-sphere") == 0 && i + 1 < argc) {
+			o->sphere = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-lodthreshold") == 0 && i + 1 < argc) {
+			o->lodThreshold = strtof(argv[++i], NULL);
+		} else if (strcmp(argv[i], "-record") == 0 && i + 1 < argc) {
+			o->recordFile = argv[++i];
+		} else if (strcmp(argv[i], "-replay") == 0 && i + 1 < argc) {
+			o->replayFile = argv[++i];
+		} else if (strcmp(argv[i], "-log") == 0 && i + 1 < argc) {
+			o->logFile = argv[++i];
+		} else if (strcmp(argv[i], "-loglevel") == 0 && i + 1 < argc) {
+			int l = logParseLevel(argv[++i]);
+			if (l < 0) {
+				errorf("unknown log level: %s", argv[i]);
+				return 0;
+			}
+			o->logLevel = l;
 		} else {
-			panicf("failed to present swap chain image, VkResult=%d", pr);
+			errorf("unknown option: %s", argv[i]);
+			return 0;
 		}
 	}
+	if (o->recordFile != NULL && o->replayFile != NULL) {
+		errorf("-record and -replay can't be used together");
+		return 0;
+	}
+	return 1;
 }
 
-int main() {
+int main(int argc, char *argv[]) {
 	State s = {};
+	s.startTicks = SDL_GetPerformanceCounter();
+	if (!parseOptions(&s.opt, argc, argv)) {
+		usage(argv[0]);
+		return 1;
+	}
+	logSetLevel(s.opt.logLevel);
+	logInit(s.opt.logFile);
+	if (s.opt.recordFile != NULL || s.opt.replayFile != NULL)
+		s.fixedDt = REPLAY_DT;
 	if (beginSdl(&s) != VK_SUCCESS) {
+		logDestroy();
 		return 1;
 	}
 
+	startupTime(&s, "sdl", s.startTicks);
+
+	// the mesh, the scene and the texture are prepared while vulkan is
+	// initialized
+	s.assets = SDL_CreateThread(loadAssets, "assets", &s);
+	mustPtr(s.assets, "asset loading thread: %s", SDL_GetError());
 	beginVulkan(&s);
 
+	if (!textureSupported(&s)) {
+		textureDestroy(&s.tex);
+		textureGenerateChecker(&s.tex, TEXTURE_CHECKER_SIZE);
+	}
+
 	eventLoop(&s);
 
+	sceneDestroy(&s.scene);
+	textureDestroy(&s.tex);
+	free(s.vertexData);
+	free(s.indexData);
+
 	endVulkan(&s);
 
 	endSdl(&s);
+	logDestroy();
 	return 0;
 }
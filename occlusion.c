@@ -0,0 +1,510 @@
+// two-phase occlusion culling against a hierarchical depth buffer
+
+#include <vulkan.h>
+#include <vk_mem_alloc.h>
+#include <cglm/cglm.h>
+#include <SDL.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "log.h"
+#include "util.h"
+#include "jobs.h"
+#include "transform.h"
+#include "bvh.h"
+#include "scene.h"
+#include "bindless.h"
+#include "shader.h"
+#include "pipeline.h"
+#include "occlusion.h"
+
+#include "shaders_out/hiz.comp.h"
+#include "shaders_out/occlusion.comp.h"
+
+// must match occlusion.comp
+typedef struct OcclusionPush {
+	mat4 viewProj;
+	uint32_t candidates;
+	uint32_t state;
+	uint32_t draws;
+	uint32_t pyramid;
+	uint32_t count;
+	uint32_t capacity;
+	uint32_t phase;
+	uint32_t levels;
+	vec2 pyramidSize;
+	uint32_t pyramidValid;
+	uint32_t pad;
+} OcclusionPush;
+
+// must match hiz.comp
+typedef struct OcclusionReducePush {
+	uint32_t srcSize[2];
+	uint32_t dstSize[2];
+} OcclusionReducePush;
+
+// the state buffer starts with the drawn counters of both phases
+#define OCCLUSION_STATE_HEADER 2
+
+char occlusionFeatures(VkPhysicalDevice vpd, VkPhysicalDeviceFeatures *f) {
+	VkPhysicalDeviceFeatures supported;
+	vkGetPhysicalDeviceFeatures(vpd, &supported);
+	if (!supported.multiDrawIndirect || !supported.drawIndirectFirstInstance)
+		return 0;
+	f->multiDrawIndirect = VK_TRUE;
+	f->drawIndirectFirstInstance = VK_TRUE;
+	return 1;
+}
+
+static void occlusionBuffer(Occlusion *o, VkDeviceSize size, VkBufferUsageFlags usage, char mapped,
+		VkBuffer *buf, VmaAllocation *alloc, void **data) {
+	VkBufferCreateInfo bci = {};
+	bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bci.size = size;
+	bci.usage = usage;
+	bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VmaAllocationCreateInfo aci = {};
+	aci.usage = VMA_MEMORY_USAGE_AUTO;
+	if (mapped) {
+		// the state is read back, the candidates are only written
+		aci.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | (usage & VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+			? VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT : VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT);
+		aci.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	}
+	VmaAllocationInfo ai;
+	must(vmaCreateBuffer(o->vma, &bci, &aci, buf, alloc, &ai));
+	if (data != NULL)
+		*data = ai.pMappedData;
+}
+
+void occlusionInit(Occlusion *o, VkDevice dev, VmaAllocator vma, Bindless *b, uint32_t frameCount, uint32_t capacity, uint32_t maxDrawCount, float timestampPeriod) {
+	o->dev = dev;
+	o->vma = vma;
+	o->bindless = b;
+	o->capacity = capacity > 0 ? capacity : 1;
+	o->maxDrawCount = maxDrawCount > 0 ? maxDrawCount : 1;
+	o->frameCount = frameCount;
+	o->pyramid = VK_NULL_HANDLE;
+	o->pyramidValid = 0;
+	o->stats = (OcclusionStats){};
+
+	o->frames = calloc(frameCount, sizeof(OcclusionFrame));
+	mustPtr(o->frames, "occlusion frames, len = %"PRIu32, frameCount);
+	for (uint32_t i = 0; i < frameCount; i++) {
+		OcclusionFrame *f = &o->frames[i];
+		occlusionBuffer(o, o->capacity * sizeof(OcclusionCandidate), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, 1,
+			&f->candidates, &f->candidatesAlloc, (void **)&f->candidateData);
+		occlusionBuffer(o, (OCCLUSION_STATE_HEADER + o->capacity) * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, 1,
+			&f->state, &f->stateAlloc, (void **)&f->stateData);
+		occlusionBuffer(o, 2 * o->capacity * sizeof(VkDrawIndexedIndirectCommand),
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, 0,
+			&f->draws, &f->drawsAlloc, NULL);
+		f->candidatesIndex = bindlessAddBuffer(b, f->candidates, 0, VK_WHOLE_SIZE);
+		f->stateIndex = bindlessAddBuffer(b, f->state, 0, VK_WHOLE_SIZE);
+		f->drawsIndex = bindlessAddBuffer(b, f->draws, 0, VK_WHOLE_SIZE);
+	}
+
+	VkSamplerCreateInfo sci = {};
+	sci.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	sci.magFilter = VK_FILTER_NEAREST;
+	sci.minFilter = VK_FILTER_NEAREST;
+	sci.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	sci.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sci.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sci.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sci.maxLod = VK_LOD_CLAMP_NONE;
+	must(vkCreateSampler(dev, &sci, NULL, &o->sampler));
+
+	// reduction: the previous level (or the depth buffer) and the level written
+	VkDescriptorSetLayoutBinding dslb[2] = {};
+	dslb[0].binding = 0;
+	dslb[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	dslb[0].descriptorCount = 1;
+	dslb[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	dslb[1].binding = 1;
+	dslb[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	dslb[1].descriptorCount = 1;
+	dslb[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	VkDescriptorSetLayoutCreateInfo dslci = {};
+	dslci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	dslci.bindingCount = LENGTH(dslb);
+	dslci.pBindings = dslb;
+	must(vkCreateDescriptorSetLayout(dev, &dslci, NULL, &o->reduceDsl));
+	VkDescriptorPoolCreateInfo dpci = {};
+	dpci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	dpci.maxSets = OCCLUSION_LEVELS_MAX;
+	dpci.poolSizeCount = 2;
+	dpci.pPoolSizes = (VkDescriptorPoolSize[]){
+		{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, OCCLUSION_LEVELS_MAX},
+		{VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, OCCLUSION_LEVELS_MAX},
+	};
+	must(vkCreateDescriptorPool(dev, &dpci, NULL, &o->reducePool));
+	VkDescriptorSetLayout layouts[OCCLUSION_LEVELS_MAX];
+	for (uint32_t i = 0; i < OCCLUSION_LEVELS_MAX; i++)
+		layouts[i] = o->reduceDsl;
+	VkDescriptorSetAllocateInfo dsai = {};
+	dsai.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	dsai.descriptorPool = o->reducePool;
+	dsai.descriptorSetCount = OCCLUSION_LEVELS_MAX;
+	dsai.pSetLayouts = layouts;
+	must(vkAllocateDescriptorSets(dev, &dsai, o->reduceSets));
+
+	// push constant ranges come from the shaders
+	VkPushConstantRange pcr = shaderPushConstants((const ShaderCode *[]){&hiz_comp}, 1);
+	mustCondition(pcr.size <= sizeof(OcclusionReducePush), "the push constants of hiz.comp fit in OcclusionReducePush");
+	VkPipelineLayoutCreateInfo pllyci = {};
+	pllyci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pllyci.setLayoutCount = 1;
+	pllyci.pSetLayouts = &o->reduceDsl;
+	pllyci.pushConstantRangeCount = 1;
+	pllyci.pPushConstantRanges = &pcr;
+	must(vkCreatePipelineLayout(dev, &pllyci, NULL, &o->reduceLayout));
+	o->reducePipeline = pipelineCreateCompute(dev, VK_NULL_HANDLE, o->reduceLayout, &hiz_comp);
+
+	pcr = shaderPushConstants((const ShaderCode *[]){&occlusion_comp}, 1);
+	mustCondition(pcr.size <= sizeof(OcclusionPush), "the push constants of occlusion.comp fit in OcclusionPush");
+	pllyci.pSetLayouts = &b->dsl;
+	pllyci.pPushConstantRanges = &pcr;
+	must(vkCreatePipelineLayout(dev, &pllyci, NULL, &o->cullLayout));
+	o->cullPipeline = pipelineCreateCompute(dev, VK_NULL_HANDLE, o->cullLayout, &occlusion_comp);
+
+	o->timestamps = VK_NULL_HANDLE;
+	if (timestampPeriod > 0) {
+		VkQueryPoolCreateInfo qpci = {};
+		qpci.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		qpci.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		qpci.queryCount = OCCLUSION_TIMESTAMPS * frameCount;
+		must(vkCreateQueryPool(dev, &qpci, NULL, &o->timestamps));
+		o->timestampPeriod = timestampPeriod;
+	}
+
+	infof("occlusion culling enabled (%"PRIu32" candidates per frame)", o->capacity);
+}
+
+static void occlusionDestroyPyramid(Occlusion *o, uint64_t frameNumber) {
+	if (o->pyramid == VK_NULL_HANDLE)
+		return;
+	bindlessRemoveTexture(o->bindless, o->pyramidIndex, frameNumber);
+	for (uint32_t i = 0; i < o->levels; i++)
+		vkDestroyImageView(o->dev, o->levelViews[i], NULL);
+	vkDestroyImageView(o->dev, o->pyramidView, NULL);
+	vmaDestroyImage(o->vma, o->pyramid, o->pyramidAlloc);
+	o->pyramid = VK_NULL_HANDLE;
+}
+
+void occlusionDestroy(Occlusion *o, uint64_t frameNumber) {
+	occlusionDestroyPyramid(o, frameNumber);
+	for (uint32_t i = 0; i < o->frameCount; i++) {
+		OcclusionFrame *f = &o->frames[i];
+		bindlessRemoveBuffer(o->bindless, f->candidatesIndex, frameNumber);
+		bindlessRemoveBuffer(o->bindless, f->stateIndex, frameNumber);
+		bindlessRemoveBuffer(o->bindless, f->drawsIndex, frameNumber);
+		vmaDestroyBuffer(o->vma, f->candidates, f->candidatesAlloc);
+		vmaDestroyBuffer(o->vma, f->state, f->stateAlloc);
+		vmaDestroyBuffer(o->vma, f->draws, f->drawsAlloc);
+	}
+	free(o->frames);
+	o->frames = NULL;
+	if (o->timestamps != VK_NULL_HANDLE)
+		vkDestroyQueryPool(o->dev, o->timestamps, NULL);
+	vkDestroyPipeline(o->dev, o->cullPipeline, NULL);
+	vkDestroyPipelineLayout(o->dev, o->cullLayout, NULL);
+	vkDestroyPipeline(o->dev, o->reducePipeline, NULL);
+	vkDestroyPipelineLayout(o->dev, o->reduceLayout, NULL);
+	vkDestroyDescriptorPool(o->dev, o->reducePool, NULL);
+	vkDestroyDescriptorSetLayout(o->dev, o->reduceDsl, NULL);
+	vkDestroySampler(o->dev, o->sampler, NULL);
+}
+
+// largest power of 2 not above x
+static uint32_t occlusionFloorPow2(uint32_t x) {
+	uint32_t p = 1;
+	while (p * 2 <= x)
+		p *= 2;
+	return p;
+}
+
+static VkExtent2D occlusionLevelExtent(const Occlusion *o, uint32_t level) {
+	return (VkExtent2D){
+		o->size.width >> level ? o->size.width >> level : 1,
+		o->size.height >> level ? o->size.height >> level : 1,
+	};
+}
+
+void occlusionResize(Occlusion *o, VkImageView depth, VkExtent2D extent, uint64_t frameNumber) {
+	occlusionDestroyPyramid(o, frameNumber);
+	o->depthExtent = extent;
+	o->size = (VkExtent2D){occlusionFloorPow2(extent.width), occlusionFloorPow2(extent.height)};
+	o->levels = 1;
+	while (o->levels < OCCLUSION_LEVELS_MAX && ((o->size.width >> o->levels) > 0 || (o->size.height >> o->levels) > 0))
+		o->levels++;
+
+	VkImageCreateInfo ici = {};
+	ici.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	ici.imageType = VK_IMAGE_TYPE_2D;
+	ici.format = VK_FORMAT_R32_SFLOAT;
+	ici.extent = (VkExtent3D){o->size.width, o->size.height, 1};
+	ici.mipLevels = o->levels;
+	ici.arrayLayers = 1;
+	ici.samples = VK_SAMPLE_COUNT_1_BIT;
+	ici.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	ici.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	ici.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	VmaAllocationCreateInfo aci = {};
+	aci.usage = VMA_MEMORY_USAGE_AUTO;
+	must(vmaCreateImage(o->vma, &ici, &aci, &o->pyramid, &o->pyramidAlloc, NULL));
+
+	VkImageViewCreateInfo ivci = {};
+	ivci.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	ivci.image = o->pyramid;
+	ivci.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	ivci.format = VK_FORMAT_R32_SFLOAT;
+	ivci.subresourceRange = (VkImageSubresourceRange){VK_IMAGE_ASPECT_COLOR_BIT, 0, o->levels, 0, 1};
+	must(vkCreateImageView(o->dev, &ivci, NULL, &o->pyramidView));
+	for (uint32_t i = 0; i < o->levels; i++) {
+		ivci.subresourceRange.baseMipLevel = i;
+		ivci.subresourceRange.levelCount = 1;
+		must(vkCreateImageView(o->dev, &ivci, NULL, &o->levelViews[i]));
+	}
+	o->pyramidIndex = bindlessAddTexture(o->bindless, o->sampler, o->pyramidView);
+	o->pyramidValid = 0;
+
+	// level i is reduced from level i - 1, level 0 from the depth buffer
+	VkDescriptorImageInfo src[OCCLUSION_LEVELS_MAX], dst[OCCLUSION_LEVELS_MAX];
+	VkWriteDescriptorSet wds[2 * OCCLUSION_LEVELS_MAX] = {};
+	for (uint32_t i = 0; i < o->levels; i++) {
+		src[i] = (VkDescriptorImageInfo){o->sampler, i == 0 ? depth : o->levelViews[i - 1], VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+		dst[i] = (VkDescriptorImageInfo){VK_NULL_HANDLE, o->levelViews[i], VK_IMAGE_LAYOUT_GENERAL};
+		wds[2 * i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		wds[2 * i].dstSet = o->reduceSets[i];
+		wds[2 * i].dstBinding = 0;
+		wds[2 * i].descriptorCount = 1;
+		wds[2 * i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		wds[2 * i].pImageInfo = &src[i];
+		wds[2 * i + 1] = wds[2 * i];
+		wds[2 * i + 1].dstBinding = 1;
+		wds[2 * i + 1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		wds[2 * i + 1].pImageInfo = &dst[i];
+	}
+	vkUpdateDescriptorSets(o->dev, 2 * o->levels, wds, 0, NULL);
+
+	infof("depth pyramid created (%"PRIu32"x%"PRIu32", %"PRIu32" levels)", o->size.width, o->size.height, o->levels);
+}
+
+void occlusionCollect(Occlusion *o, uint32_t frame) {
+	OcclusionFrame *f = &o->frames[frame];
+	if (!f->submitted)
+		return;
+	f->submitted = 0;
+	// a no-op for host coherent memory
+	must(vmaInvalidateAllocation(o->vma, f->stateAlloc, 0, VK_WHOLE_SIZE));
+	o->stats.frames++;
+	o->stats.candidates += f->count;
+	o->stats.drawn[0] += f->stateData[0];
+	o->stats.drawn[1] += f->stateData[1];
+	if (!f->timed)
+		return;
+	f->timed = 0;
+	uint64_t ts[OCCLUSION_TIMESTAMPS];
+	VkResult r = vkGetQueryPoolResults(o->dev, o->timestamps, OCCLUSION_TIMESTAMPS * frame, OCCLUSION_TIMESTAMPS,
+		sizeof(ts), ts, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+	if (r != VK_SUCCESS)
+		return;
+	for (uint32_t i = 1; i < OCCLUSION_TIMESTAMPS; i++)
+		if (ts[i] < ts[i - 1])
+			return;
+	o->stats.timedFrames++;
+	o->stats.cullNs += (uint64_t)(((ts[1] - ts[0]) + (ts[3] - ts[2])) * (double)o->timestampPeriod);
+	o->stats.drawNs += (uint64_t)(((ts[2] - ts[1]) + (ts[4] - ts[3])) * (double)o->timestampPeriod);
+}
+
+void occlusionSetCandidates(Occlusion *o, uint32_t frame, const Scene *s, const uint32_t *objects, const uint32_t *lods, uint32_t count) {
+	OcclusionFrame *f = &o->frames[frame];
+	f->count = count < o->capacity ? count : o->capacity;
+	for (uint32_t i = 0; i < f->count; i++) {
+		const Object *obj = &s->objects[objects[i]];
+		const MeshLod *l = &s->meshes[obj->mesh].lods[lods[i]];
+		const Aabb *box = &s->bvh.boxes[objects[i]];
+		OcclusionCandidate *c = &f->candidateData[i];
+		glm_vec3_copy((float *)box->min, c->min);
+		glm_vec3_copy((float *)box->max, c->max);
+		c->indexCount = l->indexCount;
+		c->firstIndex = l->firstIndex;
+		c->node = obj->node;
+	}
+	f->stateData[0] = 0;
+	f->stateData[1] = 0;
+	f->submitted = 1;
+}
+
+static void occlusionTimestamp(Occlusion *o, VkCommandBuffer cmd, uint32_t frame, uint32_t i) {
+	if (o->timestamps == VK_NULL_HANDLE)
+		return;
+	if (i == 0)
+		vkCmdResetQueryPool(cmd, o->timestamps, OCCLUSION_TIMESTAMPS * frame, OCCLUSION_TIMESTAMPS);
+	vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, o->timestamps, OCCLUSION_TIMESTAMPS * frame + i);
+}
+
+static void occlusionMemoryBarrier(VkCommandBuffer cmd, VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess,
+		VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess) {
+	VkMemoryBarrier2 mb = {};
+	mb.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+	mb.srcStageMask = srcStage;
+	mb.srcAccessMask = srcAccess;
+	mb.dstStageMask = dstStage;
+	mb.dstAccessMask = dstAccess;
+	VkDependencyInfo di = {};
+	di.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+	di.memoryBarrierCount = 1;
+	di.pMemoryBarriers = &mb;
+	vkCmdPipelineBarrier2(cmd, &di);
+}
+
+void occlusionCull(Occlusion *o, VkCommandBuffer cmd, uint32_t frame, uint32_t phase, mat4 viewProj) {
+	OcclusionFrame *f = &o->frames[frame];
+	if (phase == 0) {
+		occlusionTimestamp(o, cmd, frame, 0);
+	} else {
+		// the flags written by phase 0
+		occlusionMemoryBarrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+			VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+	}
+	OcclusionPush pc = {};
+	glm_mat4_copy(viewProj, pc.viewProj);
+	pc.candidates = f->candidatesIndex;
+	pc.state = f->stateIndex;
+	pc.draws = f->drawsIndex;
+	pc.pyramid = o->pyramidIndex;
+	pc.count = f->count;
+	pc.capacity = o->capacity;
+	pc.phase = phase;
+	pc.levels = o->levels;
+	pc.pyramidSize[0] = o->size.width;
+	pc.pyramidSize[1] = o->size.height;
+	pc.pyramidValid = o->pyramidValid;
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, o->cullPipeline);
+	bindlessBind(o->bindless, cmd, VK_PIPELINE_BIND_POINT_COMPUTE, o->cullLayout);
+	vkCmdPushConstants(cmd, o->cullLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pc), &pc);
+	vkCmdDispatch(cmd, (f->count + OCCLUSION_GROUP_SIZE - 1) / OCCLUSION_GROUP_SIZE, 1, 1);
+	occlusionMemoryBarrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT);
+	occlusionTimestamp(o, cmd, frame, 2 * phase + 1);
+}
+
+void occlusionDraw(Occlusion *o, VkCommandBuffer cmd, uint32_t frame, uint32_t phase) {
+	OcclusionFrame *f = &o->frames[frame];
+	for (uint32_t first = 0; first < f->count; first += o->maxDrawCount) {
+		uint32_t n = f->count - first < o->maxDrawCount ? f->count - first : o->maxDrawCount;
+		vkCmdDrawIndexedIndirect(cmd, f->draws, (phase * o->capacity + first) * sizeof(VkDrawIndexedIndirectCommand),
+			n, sizeof(VkDrawIndexedIndirectCommand));
+	}
+}
+
+static VkImageMemoryBarrier2 occlusionImageBarrier(VkImage img, VkImageAspectFlags aspect, uint32_t level, uint32_t levels,
+		VkImageLayout from, VkImageLayout to,
+		VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess) {
+	VkImageMemoryBarrier2 imb = {};
+	imb.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+	imb.srcStageMask = srcStage;
+	imb.srcAccessMask = srcAccess;
+	imb.dstStageMask = dstStage;
+	imb.dstAccessMask = dstAccess;
+	imb.oldLayout = from;
+	imb.newLayout = to;
+	imb.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imb.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imb.image = img;
+	imb.subresourceRange = (VkImageSubresourceRange){aspect, level, levels, 0, 1};
+	return imb;
+}
+
+static void occlusionImageBarriers(VkCommandBuffer cmd, uint32_t count, const VkImageMemoryBarrier2 *imbs) {
+	VkDependencyInfo di = {};
+	di.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+	di.imageMemoryBarrierCount = count;
+	di.pImageMemoryBarriers = imbs;
+	vkCmdPipelineBarrier2(cmd, &di);
+}
+
+void occlusionBuildPyramid(Occlusion *o, VkCommandBuffer cmd, uint32_t frame, VkImage depth, VkImage color) {
+	occlusionTimestamp(o, cmd, frame, 2);
+	// the previous contents of the pyramid were read by phase 0
+	VkImageMemoryBarrier2 begin[] = {
+		occlusionImageBarrier(color, VK_IMAGE_ASPECT_COLOR_BIT, 0, 1,
+			VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
+			VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+			VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+			VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT),
+		occlusionImageBarrier(depth, VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1,
+			VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+			VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+			VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT),
+		occlusionImageBarrier(o->pyramid, VK_IMAGE_ASPECT_COLOR_BIT, 0, o->levels,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+			VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_NONE,
+			VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT),
+	};
+	occlusionImageBarriers(cmd, LENGTH(begin), begin);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, o->reducePipeline);
+	for (uint32_t i = 0; i < o->levels; i++) {
+		VkExtent2D src = i == 0 ? o->depthExtent : occlusionLevelExtent(o, i - 1);
+		VkExtent2D dst = occlusionLevelExtent(o, i);
+		OcclusionReducePush pc = {{src.width, src.height}, {dst.width, dst.height}};
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, o->reduceLayout, 0, 1, &o->reduceSets[i], 0, NULL);
+		vkCmdPushConstants(cmd, o->reduceLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pc), &pc);
+		vkCmdDispatch(cmd, (dst.width + OCCLUSION_REDUCE_GROUP_SIZE - 1) / OCCLUSION_REDUCE_GROUP_SIZE,
+			(dst.height + OCCLUSION_REDUCE_GROUP_SIZE - 1) / OCCLUSION_REDUCE_GROUP_SIZE, 1);
+		// read by the next level and by phase 1
+		VkImageMemoryBarrier2 done = occlusionImageBarrier(o->pyramid, VK_IMAGE_ASPECT_COLOR_BIT, i, 1,
+			VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+			VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+		occlusionImageBarriers(cmd, 1, &done);
+	}
+
+	// phase 1 draws on top of the depth of phase 0
+	VkImageMemoryBarrier2 end = occlusionImageBarrier(depth, VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1,
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_NONE,
+		VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+		VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+	occlusionImageBarriers(cmd, 1, &end);
+	o->pyramidValid = 1;
+}
+
+void occlusionEnd(Occlusion *o, VkCommandBuffer cmd, uint32_t frame) {
+	// the state is read by occlusionCollect once the frame's fence is signalled
+	occlusionMemoryBarrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT);
+	if (o->timestamps == VK_NULL_HANDLE)
+		return;
+	occlusionTimestamp(o, cmd, frame, 4);
+	o->frames[frame].timed = 1;
+}
+
+void occlusionPrintStats(Occlusion *o) {
+	OcclusionStats *st = &o->stats;
+	if (st->frames == 0)
+		return;
+	double candidates = (double)st->candidates / st->frames;
+	double drawn0 = (double)st->drawn[0] / st->frames;
+	double drawn1 = (double)st->drawn[1] / st->frames;
+	double culled = candidates - drawn0 - drawn1;
+	if (st->timedFrames > 0) {
+		// the culled objects would have cost about as much as the drawn ones
+		double drawMs = st->drawNs / 1e6 / st->timedFrames;
+		double cullMs = st->cullNs / 1e6 / st->timedFrames;
+		double perObject = drawn0 + drawn1 > 0 ? drawMs / (drawn0 + drawn1) : 0;
+		infof("occlusion culling: %.0f candidates, %.0f drawn (%.0f after the retest), %.0f culled; gpu: drawing %.3f ms, culling %.3f ms, ~%.3f ms saved",
+			candidates, drawn0 + drawn1, drawn1, culled, drawMs, cullMs, culled * perObject - cullMs);
+	} else {
+		infof("occlusion culling: %.0f candidates, %.0f drawn (%.0f after the retest), %.0f culled",
+			candidates, drawn0 + drawn1, drawn1, culled);
+	}
+	*st = (OcclusionStats){};
+}
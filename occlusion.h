@@ -0,0 +1,141 @@
+// two-phase occlusion culling against a hierarchical depth buffer
+// The objects that passed frustum culling are candidates. Phase 0 tests them
+// against the depth pyramid of the previous frame and the ones that pass are
+// drawn. The pyramid is then rebuilt from that depth buffer, phase 1 retests
+// the rejected candidates against it and draws the ones that are visible
+// after all. The tests run in compute shaders writing one indirect draw per
+// candidate, culled ones with an instance count of 0.
+// The pyramid is only built once per frame, from the depth of phase 0, and
+// phase 0 of the next frame tests against it, so occluders that were only
+// drawn in phase 1 cull nothing until a later frame draws them in phase 0.
+// That is conservative (it draws more, nothing pops) and saves a second
+// reduction of the depth buffer per frame.
+// requires:
+// #include <vulkan.h>
+// #include <vk_mem_alloc.h>
+// #include <cglm/cglm.h>
+// #include "bindless.h"
+// #include "scene.h"
+
+#define OCCLUSION_LEVELS_MAX 16
+#define OCCLUSION_GROUP_SIZE 64 // local size of occlusion.comp
+#define OCCLUSION_REDUCE_GROUP_SIZE 8 // local size of hiz.comp
+// per frame: phase 0 begin and end, phase 1 begin and end, end of drawing
+#define OCCLUSION_TIMESTAMPS 5
+
+// world space bounds and draw parameters of an object, read by occlusion.comp
+typedef struct OcclusionCandidate {
+	vec3 min;
+	uint32_t indexCount;
+	vec3 max;
+	uint32_t firstIndex;
+	uint32_t node; // instance index
+	uint32_t pad[3];
+} OcclusionCandidate;
+
+typedef struct OcclusionFrame {
+	uint32_t count; // candidates
+	// written by the cpu, persistently mapped
+	VkBuffer candidates;
+	VmaAllocation candidatesAlloc;
+	OcclusionCandidate *candidateData;
+	uint32_t candidatesIndex; // bindless buffer index
+	// objects drawn in both phases, then a flag per candidate, read back
+	VkBuffer state;
+	VmaAllocation stateAlloc;
+	uint32_t *stateData;
+	uint32_t stateIndex;
+	// indirect draws of phase 0, followed by the ones of phase 1
+	VkBuffer draws;
+	VmaAllocation drawsAlloc;
+	uint32_t drawsIndex;
+	char submitted; // not yet collected
+	char timed;
+} OcclusionFrame;
+
+// totals since the last occlusionPrintStats
+typedef struct OcclusionStats {
+	uint32_t frames;
+	uint64_t candidates;
+	uint64_t drawn[2]; // per phase
+	uint32_t timedFrames;
+	uint64_t drawNs; // both render passes
+	uint64_t cullNs; // tests and the pyramid
+} OcclusionStats;
+
+typedef struct Occlusion {
+	VkDevice dev;
+	VmaAllocator vma;
+	Bindless *bindless;
+	uint32_t capacity; // candidates per frame
+	uint32_t maxDrawCount; // VkPhysicalDeviceLimits::maxDrawIndirectCount
+	uint32_t frameCount;
+	OcclusionFrame *frames;
+	// depth pyramid, a power of 2 no larger than the depth buffer
+	VkExtent2D size;
+	uint32_t levels;
+	VkImage pyramid;
+	VmaAllocation pyramidAlloc;
+	VkImageView pyramidView; // all levels, sampled by occlusion.comp
+	VkImageView levelViews[OCCLUSION_LEVELS_MAX];
+	uint32_t pyramidIndex; // bindless texture index
+	char pyramidValid; // holds the depth of phase 0 of the previous frame
+	VkExtent2D depthExtent;
+	VkSampler sampler;
+	// reduction, one descriptor set per level
+	VkDescriptorSetLayout reduceDsl;
+	VkDescriptorPool reducePool;
+	VkDescriptorSet reduceSets[OCCLUSION_LEVELS_MAX];
+	VkPipelineLayout reduceLayout;
+	VkPipeline reducePipeline;
+	// tests
+	VkPipelineLayout cullLayout;
+	VkPipeline cullPipeline;
+	VkQueryPool timestamps; // VK_NULL_HANDLE if disabled
+	float timestampPeriod;
+	OcclusionStats stats;
+} Occlusion;
+
+// checks the device features needed for the indirect draws, enables them in f
+// returns 0 if they aren't supported
+char occlusionFeatures(VkPhysicalDevice vpd, VkPhysicalDeviceFeatures *f);
+
+// capacity is the largest number of candidates in a frame
+// timestampPeriod is VkPhysicalDeviceLimits.timestampPeriod, 0 disables timing
+// maxDrawCount is VkPhysicalDeviceLimits::maxDrawIndirectCount
+void occlusionInit(Occlusion *o, VkDevice dev, VmaAllocator vma, Bindless *b, uint32_t frameCount, uint32_t capacity, uint32_t maxDrawCount, float timestampPeriod);
+
+// caller has to ensure that the resources are no longer in use
+void occlusionDestroy(Occlusion *o, uint64_t frameNumber);
+
+// (re)creates the pyramid for the depth buffer, which must have been created
+// with VK_IMAGE_USAGE_SAMPLED_BIT; the resources must no longer be in use
+void occlusionResize(Occlusion *o, VkImageView depth, VkExtent2D extent, uint64_t frameNumber);
+
+// adds the results of the frame's previous submission to the statistics,
+// its fence must have been waited for
+void occlusionCollect(Occlusion *o, uint32_t frame);
+
+// writes the candidates of the frame, objects are scene object indices
+// drawn with the levels of detail in lods
+void occlusionSetCandidates(Occlusion *o, uint32_t frame, const Scene *s, const uint32_t *objects, const uint32_t *lods, uint32_t count);
+
+// records the test of a phase, outside of a render pass
+void occlusionCull(Occlusion *o, VkCommandBuffer cmd, uint32_t frame, uint32_t phase, mat4 viewProj);
+
+// records the draws of a phase, with the scene pipeline and buffers bound,
+// split into as many draw calls as maxDrawCount requires
+void occlusionDraw(Occlusion *o, VkCommandBuffer cmd, uint32_t frame, uint32_t phase);
+
+// records the reduction of the depth buffer into the pyramid, outside of a
+// render pass; depth is in VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL before and after
+// color is the color attachment of phase 0, its writes are ordered before
+// phase 1, which loads it
+void occlusionBuildPyramid(Occlusion *o, VkCommandBuffer cmd, uint32_t frame, VkImage depth, VkImage color);
+
+// makes the state visible to the host and records the timestamp after the
+// draws of phase 1
+void occlusionEnd(Occlusion *o, VkCommandBuffer cmd, uint32_t frame);
+
+// logs the statistics per frame and resets them
+void occlusionPrintStats(Occlusion *o);
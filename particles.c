@@ -0,0 +1,215 @@
+// gpu particle system
+
+#include <vulkan.h>
+#include <vk_mem_alloc.h>
+#include <cglm/cglm.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "log.h"
+#include "util.h"
+#include "bindless.h"
+#include "shader.h"
+#include "pipeline.h"
+#include "defrag.h"
+#include "particles.h"
+
+#include "shaders_out/particles_prepare.comp.h"
+#include "shaders_out/particles_emit.comp.h"
+#include "shaders_out/particles_simulate.comp.h"
+#include "shaders_out/particles.vert.h"
+#include "shaders_out/particles.frag.h"
+
+// must match particles.comp
+typedef struct ParticlesPush {
+	vec3 origin;
+	float dt;
+	uint32_t control;
+	uint32_t src;
+	uint32_t dst;
+	uint32_t capacity;
+	uint32_t emit; // requested
+	uint32_t seed;
+	uint32_t pad[2];
+} ParticlesPush;
+
+// must match particles.vert
+typedef struct ParticlesDrawPush {
+	mat4 viewProj;
+	vec4 right; // camera axes in world space
+	vec4 up;
+	uint32_t particles;
+	uint32_t pad[3];
+} ParticlesDrawPush;
+
+static VkPipelineLayout particlesLayout(VkDevice dev, const Bindless *b, const ShaderCode *const *shaders, uint32_t count, uint32_t size, VkShaderStageFlags *stages) {
+	VkPushConstantRange pcr = shaderPushConstants(shaders, count);
+	mustCondition(pcr.size <= size, "the push constants of %s fit in %"PRIu32" bytes", shaders[0]->name, size);
+	VkPipelineLayoutCreateInfo pllyci = {};
+	pllyci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pllyci.setLayoutCount = 1;
+	pllyci.pSetLayouts = &b->dsl;
+	pllyci.pushConstantRangeCount = 1;
+	pllyci.pPushConstantRanges = &pcr;
+	VkPipelineLayout plly;
+	must(vkCreatePipelineLayout(dev, &pllyci, NULL, &plly));
+	if (stages != NULL)
+		*stages = pcr.stageFlags;
+	return plly;
+}
+
+static void particlesBuffer(Particles *p, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer *buf, VmaAllocation *alloc,
+		uint32_t *index, DefragBuffer *db) {
+	VkBufferCreateInfo bci = {};
+	bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bci.size = size;
+	bci.usage = usage | DEFRAG_BUFFER_USAGE;
+	bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VmaAllocationCreateInfo aci = {};
+	aci.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+	must(vmaCreateBuffer(p->vma, &bci, &aci, buf, alloc, NULL));
+	*index = bindlessAddBuffer(p->bindless, *buf, 0, VK_WHOLE_SIZE);
+	*db = (DefragBuffer){.info = bci, .buf = buf, .index = index, .copy = 1};
+}
+
+void particlesInit(Particles *p, VkDevice dev, VmaAllocator vma, Bindless *b, uint32_t capacity, VkFormat colorFormat, VkFormat depthFormat) {
+	p->dev = dev;
+	p->vma = vma;
+	p->bindless = b;
+	p->capacity = capacity;
+	p->emitRate = capacity / PARTICLES_LIFETIME;
+	p->emitCarry = 0;
+	p->seed = 0;
+	p->current = 0;
+	p->cleared = 0;
+
+	for (uint32_t i = 0; i < LENGTH(p->lists); i++)
+		particlesBuffer(p, capacity * sizeof(Particle), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			&p->lists[i], &p->listAllocs[i], &p->listIndices[i], &p->defrag[i]);
+	particlesBuffer(p, sizeof(ParticlesControl),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		&p->control, &p->controlAlloc, &p->controlIndex, &p->defrag[2]);
+
+	const ShaderCode *cs[] = {&particles_prepare_comp, &particles_emit_comp, &particles_simulate_comp};
+	p->computeLayout = particlesLayout(dev, b, cs, LENGTH(cs), sizeof(ParticlesPush), NULL);
+	p->prepare = pipelineCreateCompute(dev, VK_NULL_HANDLE, p->computeLayout, &particles_prepare_comp);
+	p->emit = pipelineCreateCompute(dev, VK_NULL_HANDLE, p->computeLayout, &particles_emit_comp);
+	p->simulate = pipelineCreateCompute(dev, VK_NULL_HANDLE, p->computeLayout, &particles_simulate_comp);
+
+	const ShaderCode *gs[] = {&particles_vert, &particles_frag};
+	p->drawLayout = particlesLayout(dev, b, gs, LENGTH(gs), sizeof(ParticlesDrawPush), &p->drawStages);
+	p->draw = pipelineCreateParticles(dev, VK_NULL_HANDLE, p->drawLayout, colorFormat, depthFormat);
+
+	infof("particle system created (%"PRIu32" particles, %.1f MiB)", capacity,
+		2.0 * capacity * sizeof(Particle) / (1 << 20));
+}
+
+void particlesDefrag(Particles *p, Defrag *d) {
+	for (uint32_t i = 0; i < LENGTH(p->lists); i++)
+		defragRegister(d, p->listAllocs[i], &p->defrag[i]);
+	defragRegister(d, p->controlAlloc, &p->defrag[2]);
+}
+
+void particlesDestroy(Particles *p, uint64_t frameNumber) {
+	vkDestroyPipeline(p->dev, p->draw, NULL);
+	vkDestroyPipelineLayout(p->dev, p->drawLayout, NULL);
+	vkDestroyPipeline(p->dev, p->simulate, NULL);
+	vkDestroyPipeline(p->dev, p->emit, NULL);
+	vkDestroyPipeline(p->dev, p->prepare, NULL);
+	vkDestroyPipelineLayout(p->dev, p->computeLayout, NULL);
+	bindlessRemoveBuffer(p->bindless, p->controlIndex, frameNumber);
+	vmaDestroyBuffer(p->vma, p->control, p->controlAlloc);
+	for (uint32_t i = 0; i < LENGTH(p->lists); i++) {
+		bindlessRemoveBuffer(p->bindless, p->listIndices[i], frameNumber);
+		vmaDestroyBuffer(p->vma, p->lists[i], p->listAllocs[i]);
+	}
+}
+
+static void particlesBarrier(VkCommandBuffer cmd, VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess,
+		VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess) {
+	VkMemoryBarrier2 mb = {};
+	mb.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+	mb.srcStageMask = srcStage;
+	mb.srcAccessMask = srcAccess;
+	mb.dstStageMask = dstStage;
+	mb.dstAccessMask = dstAccess;
+	VkDependencyInfo di = {};
+	di.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+	di.memoryBarrierCount = 1;
+	di.pMemoryBarriers = &mb;
+	vkCmdPipelineBarrier2(cmd, &di);
+}
+
+void particlesUpdate(Particles *p, VkCommandBuffer cmd, float dt, vec3 origin) {
+	if (!p->cleared) {
+		// no live particles
+		vkCmdFillBuffer(cmd, p->control, 0, VK_WHOLE_SIZE, 0);
+		particlesBarrier(cmd, VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+			VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+		p->cleared = 1;
+	} else {
+		// the previous draw reads the lists and the control buffer, which the
+		// previous update wrote
+		particlesBarrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT,
+			VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+			VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+	}
+
+	float emit = p->emitRate * dt + p->emitCarry;
+	ParticlesPush pc = {};
+	glm_vec3_copy(origin, pc.origin);
+	pc.dt = dt;
+	pc.control = p->controlIndex;
+	pc.src = p->listIndices[p->current];
+	pc.dst = p->listIndices[!p->current];
+	pc.capacity = p->capacity;
+	pc.emit = emit < p->capacity ? (uint32_t)emit : p->capacity;
+	pc.seed = p->seed++;
+	p->emitCarry = emit - pc.emit;
+	if (p->emitCarry >= 1.0f)
+		p->emitCarry = 0; // the capacity was reached
+
+	bindlessBind(p->bindless, cmd, VK_PIPELINE_BIND_POINT_COMPUTE, p->computeLayout);
+	vkCmdPushConstants(cmd, p->computeLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pc), &pc);
+
+	// the dispatch sizes depend on the number of live particles, which only
+	// the gpu knows
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, p->prepare);
+	vkCmdDispatch(cmd, 1, 1, 1);
+	particlesBarrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+		VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, p->emit);
+	vkCmdDispatchIndirect(cmd, p->control, offsetof(ParticlesControl, emit));
+	particlesBarrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+
+	// compacts the survivors into the other list
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, p->simulate);
+	vkCmdDispatchIndirect(cmd, p->control, offsetof(ParticlesControl, simulate));
+	particlesBarrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT,
+		VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+	p->current = !p->current;
+}
+
+void particlesDraw(Particles *p, VkCommandBuffer cmd, mat4 view, mat4 viewProj) {
+	ParticlesDrawPush pc = {};
+	glm_mat4_copy(viewProj, pc.viewProj);
+	// rows of the view rotation
+	pc.right[0] = view[0][0];
+	pc.right[1] = view[1][0];
+	pc.right[2] = view[2][0];
+	pc.up[0] = view[0][1];
+	pc.up[1] = view[1][1];
+	pc.up[2] = view[2][1];
+	pc.particles = p->listIndices[p->current];
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, p->draw);
+	bindlessBind(p->bindless, cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, p->drawLayout);
+	vkCmdPushConstants(cmd, p->drawLayout, p->drawStages, 0, sizeof(pc), &pc);
+	vkCmdDrawIndirect(cmd, p->control, offsetof(ParticlesControl, draw), 1, sizeof(VkDrawIndirectCommand));
+}
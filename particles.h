@@ -0,0 +1,78 @@
+// gpu particle system
+// The particles stay in device-local storage buffers and are emitted,
+// simulated and compacted by compute shaders, so recording a frame costs the
+// same number of commands whatever the particle count. Two lists are used in
+// turn: the simulation reads the live particles of one and appends the ones
+// that survive to the other, whose length the gpu writes as the instance
+// count of an indirect draw.
+// requires:
+// #include <vulkan.h>
+// #include <vk_mem_alloc.h>
+// #include <cglm/cglm.h>
+// #include "bindless.h"
+// #include "defrag.h"
+
+#define PARTICLES_GROUP_SIZE 256 // local size of particles.comp
+#define PARTICLES_LIFETIME 3.0f // average, seconds
+
+// must match particles.comp and particles.vert
+typedef struct Particle {
+	vec3 pos;
+	float life; // seconds left
+	vec3 vel;
+	float size;
+} Particle;
+
+// written by the gpu, must match particles.comp
+typedef struct ParticlesControl {
+	VkDrawIndirectCommand draw; // instanceCount: particles in the newest list
+	VkDispatchIndirectCommand emit;
+	VkDispatchIndirectCommand simulate;
+	uint32_t alive; // particles left by the last update
+	uint32_t emitted;
+} ParticlesControl;
+
+typedef struct Particles {
+	VkDevice dev;
+	VmaAllocator vma;
+	Bindless *bindless;
+	uint32_t capacity;
+	float emitRate; // particles per second
+	float emitCarry; // fraction of a particle not yet emitted
+	uint32_t seed;
+	// particle lists, device-local
+	VkBuffer lists[2];
+	VmaAllocation listAllocs[2];
+	uint32_t listIndices[2]; // bindless buffer indices
+	uint32_t current; // list holding the live particles
+	VkBuffer control;
+	VmaAllocation controlAlloc;
+	uint32_t controlIndex;
+	char cleared; // the control buffer was zeroed
+	DefragBuffer defrag[3]; // lists and control
+	VkPipelineLayout computeLayout;
+	VkPipeline prepare;
+	VkPipeline emit;
+	VkPipeline simulate;
+	VkPipelineLayout drawLayout;
+	VkShaderStageFlags drawStages; // of the draw push constants
+	VkPipeline draw;
+} Particles;
+
+// capacity is the largest number of live particles, they are emitted at a
+// rate that keeps about that many alive
+void particlesInit(Particles *p, VkDevice dev, VmaAllocator vma, Bindless *b, uint32_t capacity, VkFormat colorFormat, VkFormat depthFormat);
+
+// caller has to ensure that the resources are no longer in use
+void particlesDestroy(Particles *p, uint64_t frameNumber);
+
+// makes the buffers movable by the defragmentation
+void particlesDefrag(Particles *p, Defrag *d);
+
+// records the emission and simulation of dt seconds, outside of a render
+// pass; the particles are emitted at origin
+void particlesUpdate(Particles *p, VkCommandBuffer cmd, float dt, vec3 origin);
+
+// records the draw of the live particles, in a render pass with the depth
+// buffer of the scene
+void particlesDraw(Particles *p, VkCommandBuffer cmd, mat4 view, mat4 viewProj);
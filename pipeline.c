@@ -0,0 +1,201 @@
+// graphics pipelines and their shared layout
+
+#include <vulkan.h>
+#include <cglm/cglm.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "log.h"
+#include "util.h"
+#include "bindless.h"
+#include "shader.h"
+#include "pipeline.h"
+
+#include "shaders_out/scene.vert.h"
+#include "shaders_out/scene.frag.h"
+#include "shaders_out/scene_flat.vert.h"
+#include "shaders_out/scene_flat.frag.h"
+#include "shaders_out/particles.vert.h"
+#include "shaders_out/particles.frag.h"
+
+// every permutation of the scene shaders, they share the pipeline layout
+static const ShaderCode *sceneShaders[] = {&scene_vert, &scene_frag, &scene_flat_vert, &scene_flat_frag};
+
+// checks that a binding used by a shader is in the bindless set
+static char bindlessBinding(const ShaderBinding *sb) {
+	if (sb->set != 0)
+		return 0;
+	if (sb->binding == BINDLESS_BINDING_BUFFERS)
+		return sb->type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	if (sb->binding == BINDLESS_BINDING_TEXTURES)
+		return sb->type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	return 0;
+}
+
+VkPipelineLayout pipelineLayoutCreate(VkDevice dev, const Bindless *b) {
+	for (uint32_t i = 0; i < LENGTH(sceneShaders); i++)
+		for (uint32_t j = 0; j < sceneShaders[i]->bindingCount; j++)
+			mustCondition(bindlessBinding(&sceneShaders[i]->bindings[j]), "%s: binding %"PRIu32" of set %"PRIu32" is in the bindless set",
+				sceneShaders[i]->name, sceneShaders[i]->bindings[j].binding, sceneShaders[i]->bindings[j].set);
+	VkPushConstantRange pcr = shaderPushConstants(sceneShaders, LENGTH(sceneShaders));
+	mustCondition(pcr.size <= sizeof(PushConstants), "the push constants of the shaders (%"PRIu32" bytes) fit in PushConstants", pcr.size);
+
+	VkPipelineLayoutCreateInfo pllyci = {};
+	pllyci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pllyci.setLayoutCount = 1;
+	pllyci.pSetLayouts = &b->dsl;
+	pllyci.pushConstantRangeCount = pcr.size > 0 ? 1 : 0;
+	pllyci.pPushConstantRanges = &pcr;
+	VkPipelineLayout plly;
+	must(vkCreatePipelineLayout(dev, &pllyci, NULL, &plly));
+	return plly;
+}
+
+VkShaderStageFlags pipelinePushConstantStages(void) {
+	return shaderPushConstants(sceneShaders, LENGTH(sceneShaders)).stageFlags;
+}
+
+// additive pipelines test against the depth buffer without writing it
+static VkPipeline pipelineCreateGraphics(VkDevice dev, VkPipelineCache cache, VkPipelineLayout layout, const ShaderCode *vs, const ShaderCode *fs,
+		const VkSpecializationInfo *spi, VkFormat colorFormat, VkFormat depthFormat, char additive) {
+	VkShaderModule vsm = shaderModule(dev, vs);
+	VkPipelineShaderStageCreateInfo vspsci = {};
+	vspsci.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	vspsci.stage = VK_SHADER_STAGE_VERTEX_BIT;
+	vspsci.module = vsm;
+	vspsci.pName = "main";
+	vspsci.pSpecializationInfo = spi;
+
+	VkShaderModule fsm = shaderModule(dev, fs);
+	VkPipelineShaderStageCreateInfo fspsci = {};
+	fspsci.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	fspsci.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	fspsci.module = fsm;
+	fspsci.pName = "main";
+	fspsci.pSpecializationInfo = spi;
+
+	VkPipelineShaderStageCreateInfo psci[] = {vspsci, fspsci};
+
+	VkPipelineRenderingCreateInfo plrci = {};
+	plrci.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+	plrci.colorAttachmentCount = 1;
+	plrci.pColorAttachmentFormats = &colorFormat;
+	plrci.depthAttachmentFormat = depthFormat;
+
+	VkGraphicsPipelineCreateInfo plci = {};
+	plci.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	plci.pNext = &plrci;
+	plci.stageCount = LENGTH(psci);
+	plci.pStages = psci;
+	VkVertexInputBindingDescription vibd;
+	VkVertexInputAttributeDescription viad[SHADER_INPUTS_MAX];
+	shaderVertexInput(vs, &vibd, viad);
+	plci.pVertexInputState = &(VkPipelineVertexInputStateCreateInfo){
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+		.vertexBindingDescriptionCount = vs->inputCount > 0 ? 1 : 0,
+		.pVertexBindingDescriptions = &vibd,
+		.vertexAttributeDescriptionCount = vs->inputCount,
+		.pVertexAttributeDescriptions = viad,
+	};
+	plci.pInputAssemblyState = &(VkPipelineInputAssemblyStateCreateInfo){
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+		.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+		.primitiveRestartEnable = VK_FALSE,
+	};
+	// const VkPipelineTessellationStateCreateInfo*     pTessellationState;
+	plci.pViewportState = &(VkPipelineViewportStateCreateInfo){
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+		.viewportCount = 1,
+		.scissorCount = 1,
+	};
+	plci.pRasterizationState = &(VkPipelineRasterizationStateCreateInfo){
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+		.polygonMode = VK_POLYGON_MODE_FILL,
+		.cullMode = VK_CULL_MODE_NONE,
+		.lineWidth = 1.0f,
+	};
+	plci.pMultisampleState = &(VkPipelineMultisampleStateCreateInfo){
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+		.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+	};
+	plci.pDepthStencilState = &(VkPipelineDepthStencilStateCreateInfo){
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+		.depthTestEnable = VK_TRUE,
+		.depthWriteEnable = additive ? VK_FALSE : VK_TRUE,
+		.depthCompareOp = VK_COMPARE_OP_LESS,
+	};
+	plci.pColorBlendState = &(VkPipelineColorBlendStateCreateInfo){
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+		.attachmentCount = 1,
+		.pAttachments = &(VkPipelineColorBlendAttachmentState){
+			.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+			.blendEnable = VK_TRUE,
+			.srcColorBlendFactor = additive ? VK_BLEND_FACTOR_ONE : VK_BLEND_FACTOR_SRC_ALPHA,
+			.dstColorBlendFactor = additive ? VK_BLEND_FACTOR_ONE : VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+			.colorBlendOp = VK_BLEND_OP_ADD,
+			.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+			.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
+			.alphaBlendOp = VK_BLEND_OP_ADD,
+		},
+		.blendConstants = {0, 0, 0, 0},
+	};
+	VkDynamicState dyns[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+	plci.pDynamicState = &(VkPipelineDynamicStateCreateInfo){
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+		.dynamicStateCount = LENGTH(dyns),
+		.pDynamicStates = (VkDynamicState *)&dyns,
+	};
+	plci.layout = layout;
+	plci.basePipelineHandle = VK_NULL_HANDLE;
+	plci.basePipelineIndex = 0;
+	VkPipeline pl;
+	must(vkCreateGraphicsPipelines(dev, cache, 1, &plci, NULL, &pl));
+
+	// the modules are no longer needed once the pipeline exists
+	vkDestroyShaderModule(dev, vsm, NULL);
+	vkDestroyShaderModule(dev, fsm, NULL);
+	return pl;
+}
+
+VkPipeline pipelineCreateScene(VkDevice dev, VkPipelineCache cache, VkPipelineLayout layout, VkFormat colorFormat, VkFormat depthFormat, uint32_t features) {
+	const ShaderCode *vs = features & PIPELINE_TEXTURED ? &scene_vert : &scene_flat_vert;
+	const ShaderCode *fs = features & PIPELINE_TEXTURED ? &scene_frag : &scene_flat_frag;
+
+	// toggles that don't need a permutation are specialization constants, so
+	// the driver removes the unused branches
+	VkBool32 constants[] = {
+		features & PIPELINE_VERTEX_COLORS ? VK_TRUE : VK_FALSE,
+		features & PIPELINE_CLUSTERED ? VK_TRUE : VK_FALSE,
+	};
+	VkSpecializationMapEntry spme[] = {
+		{PIPELINE_SPEC_VERTEX_COLORS, 0, sizeof(VkBool32)},
+		{PIPELINE_SPEC_CLUSTERED, sizeof(VkBool32), sizeof(VkBool32)},
+	};
+	VkSpecializationInfo spi = {};
+	spi.mapEntryCount = LENGTH(spme);
+	spi.pMapEntries = spme;
+	spi.dataSize = sizeof(constants);
+	spi.pData = constants;
+	return pipelineCreateGraphics(dev, cache, layout, vs, fs, &spi, colorFormat, depthFormat, 0);
+}
+
+VkPipeline pipelineCreateParticles(VkDevice dev, VkPipelineCache cache, VkPipelineLayout layout, VkFormat colorFormat, VkFormat depthFormat) {
+	return pipelineCreateGraphics(dev, cache, layout, &particles_vert, &particles_frag, NULL, colorFormat, depthFormat, 1);
+}
+
+VkPipeline pipelineCreateCompute(VkDevice dev, VkPipelineCache cache, VkPipelineLayout layout, const ShaderCode *cs) {
+	mustCondition(cs->stage == VK_SHADER_STAGE_COMPUTE_BIT, "%s is a compute shader", cs->name);
+	VkComputePipelineCreateInfo cpci = {};
+	cpci.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	cpci.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	cpci.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	cpci.stage.module = shaderModule(dev, cs);
+	cpci.stage.pName = "main";
+	cpci.layout = layout;
+	VkPipeline pl;
+	must(vkCreateComputePipelines(dev, cache, 1, &cpci, NULL, &pl));
+	vkDestroyShaderModule(dev, cpci.stage.module, NULL);
+	return pl;
+}
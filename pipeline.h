@@ -0,0 +1,43 @@
+// graphics pipelines and their shared layout
+// requires:
+// #include <vulkan.h>
+// #include <cglm/cglm.h>
+// #include "bindless.h"
+// #include "shader.h"
+
+// scene pipeline features
+#define PIPELINE_TEXTURED (1 << 0) // shader permutation, built with -DTEXTURED
+#define PIPELINE_VERTEX_COLORS (1 << 1) // specialization constant
+#define PIPELINE_CLUSTERED (1 << 2) // specialization constant, lit by the clustered lights (lights.h)
+
+// specialization constant ids, must match the shaders
+#define PIPELINE_SPEC_VERTEX_COLORS 0
+#define PIPELINE_SPEC_CLUSTERED 1
+
+// push constants used by shader.vert and shader.frag
+typedef struct PushConstants {
+	mat4 viewProj;
+	uint32_t objects; // bindless buffer index of the world matrices
+	uint32_t tex; // bindless texture index
+	uint32_t lights; // bindless buffer indices of the frame's lights and clusters (lights.h)
+	uint32_t clusters;
+} PushConstants;
+
+// all pipelines share this layout: the bindless set and the push constants
+// the shaders' reflection data is checked against both
+VkPipelineLayout pipelineLayoutCreate(VkDevice dev, const Bindless *b);
+
+// stages to pass to vkCmdPushConstants with the shared layout
+VkShaderStageFlags pipelinePushConstantStages(void);
+
+// creates the pipeline drawing the scene meshes with dynamic rendering, the
+// vertex input comes from the vertex shader (vec3 positions), features are
+// PIPELINE_* flags, cache may be VK_NULL_HANDLE
+VkPipeline pipelineCreateScene(VkDevice dev, VkPipelineCache cache, VkPipelineLayout layout, VkFormat colorFormat, VkFormat depthFormat, uint32_t features);
+
+// creates the pipeline drawing particles (particles.h) as additive camera
+// facing quads, depth tested but not written, without vertex input
+VkPipeline pipelineCreateParticles(VkDevice dev, VkPipelineCache cache, VkPipelineLayout layout, VkFormat colorFormat, VkFormat depthFormat);
+
+// creates a compute pipeline, cache may be VK_NULL_HANDLE
+VkPipeline pipelineCreateCompute(VkDevice dev, VkPipelineCache cache, VkPipelineLayout layout, const ShaderCode *cs);
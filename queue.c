@@ -0,0 +1,267 @@
+// sorted render queue
+
+#include <vulkan.h>
+#include <vk_mem_alloc.h>
+#include <cglm/cglm.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "log.h"
+#include "util.h"
+#include "bindless.h"
+#include "shader.h"
+#include "pipeline.h"
+#include "queue.h"
+
+#define QUEUE_RADIX_BITS 8
+#define QUEUE_RADIX (1 << QUEUE_RADIX_BITS)
+
+#define QUEUE_MASK(bits) ((1ull << (bits)) - 1)
+
+static uint32_t queueKeyPass(uint64_t key) {
+	return key >> (64 - QUEUE_PASS_BITS);
+}
+
+static uint32_t queueStatePipeline(uint64_t state) {
+	return (state >> QUEUE_MATERIAL_BITS) & QUEUE_MASK(QUEUE_PIPELINE_BITS);
+}
+
+static uint32_t queueStateMaterial(uint64_t state) {
+	return state & QUEUE_MASK(QUEUE_MATERIAL_BITS);
+}
+
+void queueInit(RenderQueue *q, uint32_t capacity) {
+	*q = (RenderQueue){};
+	q->capacity = capacity;
+	// at least one item, so that no allocation returns NULL
+	uint32_t n = capacity > 0 ? capacity : 1;
+	q->keys = calloc(n, sizeof(uint64_t));
+	mustPtr(q->keys, "render queue keys, len = %"PRIu32, n);
+	q->draws = calloc(n, sizeof(QueueDraw));
+	mustPtr(q->draws, "render queue draws, len = %"PRIu32, n);
+	q->sorted = calloc(n, sizeof(uint64_t));
+	mustPtr(q->sorted, "render queue sorted keys, len = %"PRIu32, n);
+	q->payloads = calloc(n, sizeof(uint32_t));
+	mustPtr(q->payloads, "render queue payloads, len = %"PRIu32, n);
+	q->tmpKeys = calloc(n, sizeof(uint64_t));
+	mustPtr(q->tmpKeys, "render queue sort keys, len = %"PRIu32, n);
+	q->tmpPayloads = calloc(n, sizeof(uint32_t));
+	mustPtr(q->tmpPayloads, "render queue sort payloads, len = %"PRIu32, n);
+}
+
+void queueDestroy(RenderQueue *q) {
+	free(q->keys);
+	free(q->draws);
+	free(q->sorted);
+	free(q->payloads);
+	free(q->tmpKeys);
+	free(q->tmpPayloads);
+}
+
+void queueClear(RenderQueue *q) {
+	q->count = 0;
+}
+
+uint64_t queueKey(uint32_t pass, uint32_t pipeline, uint32_t material, float depth, uint32_t mesh) {
+	// the bits of a positive float grow with its value, the exponent and the
+	// top of the mantissa make a logarithmic depth
+	uint32_t bits;
+	memcpy(&bits, &depth, sizeof(bits));
+	uint64_t key = pass & QUEUE_MASK(QUEUE_PASS_BITS);
+	key = key << QUEUE_PIPELINE_BITS | (pipeline & QUEUE_MASK(QUEUE_PIPELINE_BITS));
+	key = key << QUEUE_MATERIAL_BITS | (material & QUEUE_MASK(QUEUE_MATERIAL_BITS));
+	key = key << QUEUE_DEPTH_BITS | ((bits >> (31 - QUEUE_DEPTH_BITS)) & QUEUE_MASK(QUEUE_DEPTH_BITS));
+	key = key << QUEUE_MESH_BITS | (mesh & QUEUE_MASK(QUEUE_MESH_BITS));
+	return key;
+}
+
+void queuePush(RenderQueue *q, uint64_t key, QueueDraw draw) {
+	q->keys[q->count] = key;
+	q->draws[q->count] = draw;
+	q->count++;
+}
+
+// least significant digit first, digits shared by all keys are skipped
+void queueSort(RenderQueue *q) {
+	memcpy(q->sorted, q->keys, q->count * sizeof(uint64_t));
+	for (uint32_t i = 0; i < q->count; i++)
+		q->payloads[i] = i;
+	if (q->count < 2)
+		return;
+
+	uint64_t *keys = q->sorted, *tmpKeys = q->tmpKeys;
+	uint32_t *payloads = q->payloads, *tmpPayloads = q->tmpPayloads;
+	for (uint32_t shift = 0; shift < 64; shift += QUEUE_RADIX_BITS) {
+		uint32_t offsets[QUEUE_RADIX] = {};
+		for (uint32_t i = 0; i < q->count; i++)
+			offsets[(keys[i] >> shift) & (QUEUE_RADIX - 1)]++;
+		if (offsets[(keys[0] >> shift) & (QUEUE_RADIX - 1)] == q->count)
+			continue;
+		uint32_t sum = 0;
+		for (uint32_t d = 0; d < QUEUE_RADIX; d++) {
+			uint32_t c = offsets[d];
+			offsets[d] = sum;
+			sum += c;
+		}
+		for (uint32_t i = 0; i < q->count; i++) {
+			uint32_t j = offsets[(keys[i] >> shift) & (QUEUE_RADIX - 1)]++;
+			tmpKeys[j] = keys[i];
+			tmpPayloads[j] = payloads[i];
+		}
+		uint64_t *k = keys;
+		keys = tmpKeys;
+		tmpKeys = k;
+		uint32_t *p = payloads;
+		payloads = tmpPayloads;
+		tmpPayloads = p;
+	}
+	// keep the arrays owned by their fields
+	q->sorted = keys;
+	q->tmpKeys = tmpKeys;
+	q->payloads = payloads;
+	q->tmpPayloads = tmpPayloads;
+}
+
+void queueRecorderInit(QueueRecorder *r, VmaAllocator vma, uint32_t frameCount, uint32_t capacity, char multiDraw, uint32_t maxDrawCount,
+		VkPipelineLayout layout, VkShaderStageFlags pushStages, const VkBuffer *vb, const VkBuffer *ib) {
+	*r = (QueueRecorder){};
+	r->vma = vma;
+	r->capacity = capacity > 0 ? capacity : 1;
+	r->multiDraw = multiDraw;
+	r->maxDrawCount = maxDrawCount > 0 ? maxDrawCount : 1;
+	r->frameCount = frameCount;
+	r->layout = layout;
+	r->pushStages = pushStages;
+	r->vb = vb;
+	r->ib = ib;
+	r->boundState = UINT64_MAX;
+	r->frames = calloc(frameCount, sizeof(QueueFrame));
+	mustPtr(r->frames, "render queue frames, len = %"PRIu32, frameCount);
+
+	VkBufferCreateInfo bci = {};
+	bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bci.size = r->capacity * sizeof(VkDrawIndexedIndirectCommand);
+	bci.usage = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+	bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VmaAllocationCreateInfo aci = {};
+	aci.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+	aci.usage = VMA_MEMORY_USAGE_AUTO;
+	aci.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	for (uint32_t i = 0; i < frameCount; i++) {
+		QueueFrame *f = &r->frames[i];
+		VmaAllocationInfo ai;
+		must(vmaCreateBuffer(vma, &bci, &aci, &f->buf, &f->alloc, &ai));
+		f->commands = ai.pMappedData;
+	}
+}
+
+void queueRecorderDestroy(QueueRecorder *r) {
+	for (uint32_t i = 0; i < r->frameCount; i++)
+		vmaDestroyBuffer(r->vma, r->frames[i].buf, r->frames[i].alloc);
+	free(r->frames);
+}
+
+void queueRecorderBegin(QueueRecorder *r, uint32_t frame) {
+	r->current = frame;
+	r->frames[frame].used = 0;
+	r->stats.frames++;
+	queueRecorderInvalidate(r);
+}
+
+void queueRecorderInvalidate(QueueRecorder *r) {
+	r->boundState = UINT64_MAX;
+	r->buffersBound = 0;
+}
+
+// binds the pipeline and material of state which aren't bound yet
+static void queueBind(QueueRecorder *r, VkCommandBuffer cmd, uint64_t state, PushConstants *pc) {
+	if (!r->buffersBound) {
+		vkCmdBindVertexBuffers(cmd, 0, 1, r->vb, (VkDeviceSize[]){0});
+		vkCmdBindIndexBuffer(cmd, *r->ib, 0, VK_INDEX_TYPE_UINT32);
+		r->buffersBound = 1;
+		r->stats.binds += 2;
+	}
+	char none = r->boundState == UINT64_MAX;
+	if (none || queueStatePipeline(state) != queueStatePipeline(r->boundState)) {
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, r->pipelines[queueStatePipeline(state)]);
+		r->stats.binds++;
+	}
+	if (none || queueStateMaterial(state) != queueStateMaterial(r->boundState)) {
+		pc->tex = r->materials[queueStateMaterial(state)];
+		vkCmdPushConstants(cmd, r->layout, r->pushStages, 0, sizeof(*pc), pc);
+		r->stats.binds++;
+	}
+	r->boundState = state;
+}
+
+void queueRecord(QueueRecorder *r, VkCommandBuffer cmd, const RenderQueue *q, uint32_t pass, PushConstants *pc) {
+	// binds needed by drawing in push order, binding only what changes
+	uint64_t last = UINT64_MAX;
+	for (uint32_t i = 0; i < q->count; i++) {
+		if (queueKeyPass(q->keys[i]) != pass)
+			continue;
+		uint64_t state = q->keys[i] >> QUEUE_STATE_SHIFT;
+		if (last == UINT64_MAX)
+			r->stats.unsortedBinds += 4; // buffers, pipeline and material
+		else
+			r->stats.unsortedBinds += (queueStatePipeline(state) != queueStatePipeline(last)) + (queueStateMaterial(state) != queueStateMaterial(last));
+		last = state;
+	}
+
+	// the passes are the most significant bits
+	uint32_t i = 0;
+	while (i < q->count && queueKeyPass(q->sorted[i]) < pass)
+		i++;
+	QueueFrame *f = &r->frames[r->current];
+	while (i < q->count && queueKeyPass(q->sorted[i]) == pass) {
+		uint64_t state = q->sorted[i] >> QUEUE_STATE_SHIFT;
+		queueBind(r, cmd, state, pc);
+
+		// one command per run of instances of the same index range
+		uint32_t first = f->used;
+		for (; i < q->count && q->sorted[i] >> QUEUE_STATE_SHIFT == state; i++) {
+			const QueueDraw *d = &q->draws[q->payloads[i]];
+			r->stats.draws++;
+			if (f->used > first) {
+				VkDrawIndexedIndirectCommand *c = &f->commands[f->used - 1];
+				if (c->firstIndex == d->firstIndex && c->indexCount == d->indexCount && c->firstInstance + c->instanceCount == d->instance) {
+					c->instanceCount++;
+					continue;
+				}
+			}
+			mustCondition(f->used < r->capacity, "render queue has room for the draw (capacity %"PRIu32")", r->capacity);
+			f->commands[f->used++] = (VkDrawIndexedIndirectCommand){d->indexCount, 1, d->firstIndex, 0, d->instance};
+		}
+
+		uint32_t n = f->used - first;
+		r->stats.commands += n;
+		if (r->multiDraw) {
+			for (uint32_t j = first; j < f->used; j += r->maxDrawCount) {
+				uint32_t count = f->used - j < r->maxDrawCount ? f->used - j : r->maxDrawCount;
+				vkCmdDrawIndexedIndirect(cmd, f->buf, j * sizeof(VkDrawIndexedIndirectCommand), count, sizeof(VkDrawIndexedIndirectCommand));
+				r->stats.drawCalls++;
+			}
+		} else {
+			for (uint32_t j = first; j < f->used; j++) {
+				const VkDrawIndexedIndirectCommand *c = &f->commands[j];
+				vkCmdDrawIndexed(cmd, c->indexCount, c->instanceCount, c->firstIndex, c->vertexOffset, c->firstInstance);
+			}
+			r->stats.drawCalls += n;
+		}
+	}
+}
+
+void queuePrintStats(QueueRecorder *r) {
+	QueueStats *s = &r->stats;
+	if (s->frames == 0)
+		return;
+	double f = s->frames;
+	// drawing every object with its own draw call and binds is the baseline
+	infof("render queue: %.1f draws in %.1f draw calls (%.1f commands, %s), %.1f binds; saved %.1f draw calls and %.1f binds (%.1f binds in unsorted order)",
+		s->draws / f, s->drawCalls / f, s->commands / f, r->multiDraw ? "multi-draw" : "instanced",
+		s->binds / f, (s->draws - s->drawCalls) / f, (4 * s->draws - s->binds) / f, s->unsortedBinds / f);
+	*s = (QueueStats){};
+}
@@ -0,0 +1,120 @@
+// sorted render queue
+// Every draw is a 64-bit key holding its render state and depth, and a
+// payload with its draw parameters. The keys are radix sorted, so draws with
+// the same state end up next to each other, front to back. The recorder walks
+// the sorted draws, binds only the state that changes and merges runs of
+// draws sharing it into one indirect multi-draw (or instanced draws if
+// multi-draw isn't supported), consecutive instances of the same range
+// becoming one instanced command.
+// requires:
+// #include <vulkan.h>
+// #include <vk_mem_alloc.h>
+// #include <cglm/cglm.h>
+// #include "bindless.h"
+// #include "shader.h"
+// #include "pipeline.h"
+
+// key layout, from the most significant bits: pass, pipeline, material,
+// depth, mesh; the state is everything above the depth
+// The depth is coarse (16 steps per doubling of the distance), which is
+// enough for drawing front to back and lets draws of the same mesh meet.
+#define QUEUE_PASS_BITS 4
+#define QUEUE_PIPELINE_BITS 8
+#define QUEUE_MATERIAL_BITS 16
+#define QUEUE_DEPTH_BITS 12
+#define QUEUE_MESH_BITS 24
+#define QUEUE_STATE_SHIFT (QUEUE_DEPTH_BITS + QUEUE_MESH_BITS)
+#define QUEUE_PIPELINES_MAX (1 << QUEUE_PIPELINE_BITS)
+
+// draw parameters of a key
+typedef struct QueueDraw {
+	uint32_t indexCount;
+	uint32_t firstIndex;
+	uint32_t instance; // firstInstance, the transform node of scene draws
+} QueueDraw;
+
+// filled and sorted by one thread, then recorded by another
+typedef struct RenderQueue {
+	uint32_t capacity;
+	uint32_t count;
+	uint64_t *keys; // in push order
+	QueueDraw *draws; // in push order
+	uint64_t *sorted; // keys, after queueSort
+	uint32_t *payloads; // indices into draws, sorted with the keys
+	uint64_t *tmpKeys; // radix sort scratch
+	uint32_t *tmpPayloads;
+} RenderQueue;
+
+typedef struct QueueStats {
+	uint32_t frames;
+	uint64_t draws; // queued
+	uint64_t drawCalls; // vkCmdDraw* issued
+	uint64_t commands; // indirect commands written, after instance merging
+	uint64_t binds; // vkCmdBind* and material push constants issued
+	uint64_t unsortedBinds; // needed when drawing in push order, on changes only
+} QueueStats;
+
+typedef struct QueueFrame {
+	VkBuffer buf; // indirect commands
+	VmaAllocation alloc;
+	VkDrawIndexedIndirectCommand *commands; // mapped
+	uint32_t used; // commands written this frame
+} QueueFrame;
+
+// records sorted queues, one indirect buffer per frame in flight
+typedef struct QueueRecorder {
+	VmaAllocator vma;
+	uint32_t capacity; // commands per frame
+	char multiDraw; // multiDrawIndirect and drawIndirectFirstInstance are enabled
+	uint32_t maxDrawCount; // VkPhysicalDeviceLimits::maxDrawIndirectCount
+	uint32_t frameCount;
+	QueueFrame *frames;
+	uint32_t current; // frame being recorded
+	VkPipeline pipelines[QUEUE_PIPELINES_MAX]; // by the key's pipeline
+	const uint32_t *materials; // bindless texture index by the key's material
+	VkPipelineLayout layout;
+	VkShaderStageFlags pushStages;
+	const VkBuffer *vb, *ib; // shared by all draws, read when bound since defragmentation replaces them
+	// state bound in the current command buffer
+	uint64_t boundState; // UINT64_MAX if none
+	char buffersBound;
+	QueueStats stats;
+} QueueRecorder;
+
+void queueInit(RenderQueue *q, uint32_t capacity);
+
+void queueDestroy(RenderQueue *q);
+
+void queueClear(RenderQueue *q);
+
+// builds a key, depth is the view space distance, greater than 0
+uint64_t queueKey(uint32_t pass, uint32_t pipeline, uint32_t material, float depth, uint32_t mesh);
+
+// adds a draw, the queue must have room for it
+void queuePush(RenderQueue *q, uint64_t key, QueueDraw draw);
+
+// sorts the draws by their keys
+void queueSort(RenderQueue *q);
+
+// capacity is the largest number of draws recorded in a frame, the
+// pipelines and materials have to be set before recording
+// longer runs of multi-draw commands are split into draws of maxDrawCount
+void queueRecorderInit(QueueRecorder *r, VmaAllocator vma, uint32_t frameCount, uint32_t capacity, char multiDraw, uint32_t maxDrawCount,
+	VkPipelineLayout layout, VkShaderStageFlags pushStages, const VkBuffer *vb, const VkBuffer *ib);
+
+// caller has to ensure that the buffers are no longer in use
+void queueRecorderDestroy(QueueRecorder *r);
+
+// starts the commands of a frame recording queues, its fence must have been
+// waited for
+void queueRecorderBegin(QueueRecorder *r, uint32_t frame);
+
+// forgets the bound state, after commands that bind their own
+void queueRecorderInvalidate(QueueRecorder *r);
+
+// records the draws of a pass, in a render pass with the bindless set bound;
+// pc holds the push constants of the frame, its material is set per draw
+void queueRecord(QueueRecorder *r, VkCommandBuffer cmd, const RenderQueue *q, uint32_t pass, PushConstants *pc);
+
+// logs and resets the statistics of the recorded frames
+void queuePrintStats(QueueRecorder *r);
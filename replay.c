@@ -0,0 +1,215 @@
+// input recording and replay
+
+#include <SDL.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "log.h"
+#include "util.h"
+#include "replay.h"
+
+char replayRecordBegin(Replay *r, const char *path, int width, int height) {
+	*r = (Replay){};
+	r->file = fopen(path, "wb");
+	if (r->file == NULL) {
+		errorf("replay: failed to create %s", path);
+		return 0;
+	}
+	r->path = path;
+	r->recording = 1;
+	ReplayHeader h = {REPLAY_MAGIC, REPLAY_VERSION, width, height};
+	fwrite(&h, sizeof(h), 1, r->file);
+	infof("recording input to %s", path);
+	return 1;
+}
+
+// reads the next record, hasNext is 0 at the end of the file
+static void replayRead(Replay *r) {
+	r->hasNext = fread(&r->next, sizeof(r->next), 1, r->file) == 1;
+}
+
+char replayBegin(Replay *r, const char *path, int *width, int *height) {
+	*r = (Replay){};
+	r->file = fopen(path, "rb");
+	if (r->file == NULL) {
+		errorf("replay: failed to open %s", path);
+		return 0;
+	}
+	r->path = path;
+	ReplayHeader h;
+	if (fread(&h, sizeof(h), 1, r->file) != 1 || h.magic != REPLAY_MAGIC || h.version != REPLAY_VERSION) {
+		errorf("replay %s: invalid header", path);
+		fclose(r->file);
+		r->file = NULL;
+		return 0;
+	}
+	*width = h.width;
+	*height = h.height;
+	replayRead(r);
+	infof("replaying input from %s", path);
+	return 1;
+}
+
+char replayIsInput(const SDL_Event *e) {
+	switch (e->type) {
+		case SDL_KEYDOWN:
+		case SDL_KEYUP:
+		case SDL_MOUSEBUTTONDOWN:
+		case SDL_MOUSEBUTTONUP:
+		case SDL_MOUSEMOTION:
+		case SDL_MOUSEWHEEL:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+static void replayWrite(Replay *r, ReplayRecord *rec) {
+	if (fwrite(rec, sizeof(*rec), 1, r->file) != 1)
+		errorf("replay %s: write failed", r->path);
+}
+
+void replayRecordEvent(Replay *r, uint32_t frame, const SDL_Event *e) {
+	ReplayRecord rec = {};
+	rec.frame = frame;
+	switch (e->type) {
+		case SDL_QUIT:
+			rec.type = REPLAY_QUIT;
+			break;
+		case SDL_KEYDOWN:
+		case SDL_KEYUP:
+			rec.type = REPLAY_KEY;
+			rec.down = e->type == SDL_KEYDOWN;
+			rec.mod = e->key.keysym.mod;
+			rec.a = e->key.keysym.sym;
+			rec.b = e->key.keysym.scancode;
+			break;
+		case SDL_MOUSEBUTTONDOWN:
+		case SDL_MOUSEBUTTONUP:
+			rec.type = REPLAY_BUTTON;
+			rec.down = e->type == SDL_MOUSEBUTTONDOWN;
+			rec.a = e->button.button;
+			rec.b = e->button.x;
+			rec.c = e->button.y;
+			break;
+		case SDL_MOUSEMOTION:
+			rec.type = REPLAY_MOTION;
+			rec.down = e->motion.state;
+			rec.a = e->motion.x;
+			rec.b = e->motion.y;
+			rec.c = e->motion.xrel;
+			rec.d = e->motion.yrel;
+			break;
+		case SDL_MOUSEWHEEL:
+			rec.type = REPLAY_WHEEL;
+			rec.a = e->wheel.x;
+			rec.b = e->wheel.y;
+			break;
+		default:
+			return;
+	}
+	replayWrite(r, &rec);
+}
+
+void replayRecordResize(Replay *r, uint32_t frame, int width, int height) {
+	ReplayRecord rec = {};
+	rec.frame = frame;
+	rec.type = REPLAY_RESIZE;
+	rec.a = width;
+	rec.b = height;
+	replayWrite(r, &rec);
+}
+
+char replayNext(Replay *r, uint32_t frame, ReplayRecord *rec) {
+	if (!r->hasNext || r->next.frame > frame)
+		return 0;
+	*rec = r->next;
+	replayRead(r);
+	return 1;
+}
+
+char replayEnded(Replay *r) {
+	return !r->hasNext;
+}
+
+void replayEvent(const ReplayRecord *rec, SDL_Event *e) {
+	*e = (SDL_Event){};
+	switch (rec->type) {
+		case REPLAY_QUIT:
+			e->type = SDL_QUIT;
+			break;
+		case REPLAY_KEY:
+			e->type = rec->down ? SDL_KEYDOWN : SDL_KEYUP;
+			e->key.state = rec->down ? SDL_PRESSED : SDL_RELEASED;
+			e->key.keysym.mod = rec->mod;
+			e->key.keysym.sym = rec->a;
+			e->key.keysym.scancode = rec->b;
+			break;
+		case REPLAY_BUTTON:
+			e->type = rec->down ? SDL_MOUSEBUTTONDOWN : SDL_MOUSEBUTTONUP;
+			e->button.state = rec->down ? SDL_PRESSED : SDL_RELEASED;
+			e->button.button = rec->a;
+			e->button.x = rec->b;
+			e->button.y = rec->c;
+			break;
+		case REPLAY_MOTION:
+			e->type = SDL_MOUSEMOTION;
+			e->motion.state = rec->down;
+			e->motion.x = rec->a;
+			e->motion.y = rec->b;
+			e->motion.xrel = rec->c;
+			e->motion.yrel = rec->d;
+			break;
+		case REPLAY_WHEEL:
+			e->type = SDL_MOUSEWHEEL;
+			e->wheel.x = rec->a;
+			e->wheel.y = rec->b;
+			break;
+		default:
+			panicf("replay: record type %d has no event", rec->type);
+	}
+}
+
+void replayFrameSubmitted(Replay *r) {
+	uint64_t now = SDL_GetPerformanceCounter();
+	if (r->lastSubmit != 0) {
+		if (r->frameCount == r->frameCapacity) {
+			r->frameCapacity = r->frameCapacity ? 2 * r->frameCapacity : 1024;
+			r->frameTicks = realloc(r->frameTicks, r->frameCapacity * sizeof(uint64_t));
+			mustPtr(r->frameTicks, "replay frame times, len = %"PRIu32, r->frameCapacity);
+		}
+		r->frameTicks[r->frameCount++] = now - r->lastSubmit;
+	}
+	r->lastSubmit = now;
+}
+
+static int compareTicks(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+// frame time in ms at quantile q of the sorted frame times
+static double replayQuantile(Replay *r, double q) {
+	uint32_t i = (uint32_t)(q * (r->frameCount - 1) + 0.5);
+	return 1000.0 * r->frameTicks[i] / SDL_GetPerformanceFrequency();
+}
+
+void replayEnd(Replay *r) {
+	if (r->file != NULL)
+		fclose(r->file);
+	if (!r->recording && r->frameCount > 0) {
+		uint64_t total = 0;
+		for (uint32_t i = 0; i < r->frameCount; i++)
+			total += r->frameTicks[i];
+		qsort(r->frameTicks, r->frameCount, sizeof(uint64_t), compareTicks);
+		double f = SDL_GetPerformanceFrequency();
+		infof("replay %s: %"PRIu32" frames in %.3f s, frame time mean %.3f ms, median %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms",
+			r->path, r->frameCount + 1, total / f, 1000.0 * total / f / r->frameCount,
+			replayQuantile(r, 0.5), replayQuantile(r, 0.95), replayQuantile(r, 0.99), replayQuantile(r, 1.0));
+	}
+	free(r->frameTicks);
+	*r = (Replay){};
+}
@@ -0,0 +1,80 @@
+// input recording and replay
+// A recording holds the input events and window resizes of a session, each
+// with the number of frames requested before it was handled. A replay feeds
+// them back at the same frames and draws continuously, and both use a fixed
+// simulation timestep, so every replay of a file renders the same frames and
+// the frame times of different builds can be compared.
+// requires:
+// #include <SDL.h>
+// #include <stdio.h>
+
+#define REPLAY_MAGIC 0x50525444 // "DTRP"
+#define REPLAY_VERSION 1
+#define REPLAY_DT (1.0f / 60.0f) // seconds of simulation per frame
+// frames between the framerate statistics, instead of wall-clock seconds
+#define REPLAY_STATS_FRAMES 120
+
+typedef enum ReplayType {
+	REPLAY_QUIT,
+	REPLAY_KEY, // down, mod, a = keycode, b = scancode
+	REPLAY_BUTTON, // down, a = button, b = x, c = y
+	REPLAY_MOTION, // down = button state, a = x, b = y, c = xrel, d = yrel
+	REPLAY_WHEEL, // a = x, b = y
+	REPLAY_RESIZE, // a = width, b = height, of the window
+} ReplayType;
+
+// one event as stored in the file, in host byte order
+typedef struct ReplayRecord {
+	uint32_t frame; // frames requested before the event
+	uint8_t type; // ReplayType
+	uint8_t down;
+	uint16_t mod;
+	int32_t a, b, c, d;
+} ReplayRecord;
+
+typedef struct ReplayHeader {
+	uint32_t magic;
+	uint32_t version;
+	int32_t width, height; // of the window when the recording started
+} ReplayHeader;
+
+typedef struct Replay {
+	FILE *file;
+	const char *path;
+	char recording; // else replaying
+	ReplayRecord next; // first record not yet returned by replayNext
+	char hasNext;
+	// frame times of a replay, between the submissions of the frames
+	uint64_t lastSubmit; // performance counter, 0 before the first frame
+	uint64_t *frameTicks;
+	uint32_t frameCount, frameCapacity;
+} Replay;
+
+// returns 0 if the file can't be created
+char replayRecordBegin(Replay *r, const char *path, int width, int height);
+
+// returns 0 if the file can't be read, sets the window size to restore
+char replayBegin(Replay *r, const char *path, int *width, int *height);
+
+// returns 1 if e is an input event that is recorded
+char replayIsInput(const SDL_Event *e);
+
+// records an event accepted by replayIsInput, or SDL_QUIT
+void replayRecordEvent(Replay *r, uint32_t frame, const SDL_Event *e);
+
+void replayRecordResize(Replay *r, uint32_t frame, int width, int height);
+
+// returns the next record for frames up to frame, 0 if there is none yet
+char replayNext(Replay *r, uint32_t frame, ReplayRecord *rec);
+
+// returns 1 once all records were returned
+char replayEnded(Replay *r);
+
+// converts a record other than REPLAY_RESIZE to the event it was made from
+void replayEvent(const ReplayRecord *rec, SDL_Event *e);
+
+// notes the submission of a replayed frame
+void replayFrameSubmitted(Replay *r);
+
+// closes the file, a replay logs its frame times
+void replayEnd(Replay *r);
@@ -0,0 +1,250 @@
+// scene contents: meshes, drawable objects and the camera
+
+#include <SDL.h>
+#include <cglm/cglm.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <inttypes.h>
+
+#include "log.h"
+#include "util.h"
+#include "jobs.h"
+#include "transform.h"
+#include "bvh.h"
+#include "scene.h"
+#include "lod.h"
+
+#define SCENE_GROUP_SIZE 16
+#define SCENE_GROUP_SPACING 4.0f
+#define SCENE_RING_RADIUS 1.5f
+// the bvh is rebuilt when refitting made it this much more expensive
+#define SCENE_BVH_MAX_GROWTH 0.5f
+
+void cameraUpdate(Camera *c, float aspect) {
+	vec3 dir = {
+		cosf(c->pitch) * sinf(c->yaw),
+		sinf(c->pitch),
+		-cosf(c->pitch) * cosf(c->yaw),
+	};
+	glm_look(c->pos, dir, (vec3){0.0f, 1.0f, 0.0f}, c->view);
+	glm_perspective(c->fovy, aspect, c->near, c->far, c->proj);
+	c->proj[1][1] *= -1.0f; // vulkan clip space has y pointing down
+	glm_mat4_mul(c->proj, c->view, c->viewProj);
+}
+
+// transforms a model space box by an affine matrix
+static void aabbTransform(const Aabb *box, mat4 m, Aabb *out) {
+	for (int k = 0; k < 3; k++) {
+		float c = m[3][k], e = 0;
+		for (int j = 0; j < 3; j++) {
+			float bc = 0.5f * (box->min[j] + box->max[j]);
+			float be = 0.5f * (box->max[j] - box->min[j]);
+			c += m[j][k] * bc;
+			e += fabsf(m[j][k]) * be;
+		}
+		out->min[k] = c - e;
+		out->max[k] = c + e;
+	}
+}
+
+void sceneGenerateSphere(uint32_t segments, vec3 center, float radius, vec3 **positions, uint32_t *vertexCount, uint32_t **indices, uint32_t *indexCount) {
+	// rings of vertices between the poles, without a seam
+	uint32_t rings = segments / 2 > 2 ? segments / 2 : 2;
+	uint32_t sectors = segments > 3 ? segments : 3;
+	*vertexCount = 2 + (rings - 1) * sectors;
+	*indexCount = 6 * sectors * (rings - 1);
+	*positions = malloc(*vertexCount * sizeof(vec3));
+	mustPtr(*positions, "sphere positions, len = %"PRIu32, *vertexCount);
+	*indices = malloc(*indexCount * sizeof(uint32_t));
+	mustPtr(*indices, "sphere indices, len = %"PRIu32, *indexCount);
+
+	vec3 *p = *positions;
+	glm_vec3_add(center, (vec3){0.0f, radius, 0.0f}, p[0]);
+	for (uint32_t r = 1; r < rings; r++) {
+		float theta = GLM_PIf * r / rings;
+		for (uint32_t s = 0; s < sectors; s++) {
+			float phi = 2.0f * GLM_PIf * s / sectors;
+			// bumps give the simplification something to lose
+			float rr = radius * (1.0f + 0.08f * sinf(6.0f * theta) * sinf(5.0f * phi));
+			vec3 d = {sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)};
+			float *v = p[1 + (r - 1) * sectors + s];
+			glm_vec3_copy(center, v);
+			glm_vec3_muladds(d, rr, v);
+		}
+	}
+	uint32_t bottom = *vertexCount - 1;
+	glm_vec3_add(center, (vec3){0.0f, -radius, 0.0f}, p[bottom]);
+
+	uint32_t *i = *indices;
+	for (uint32_t s = 0; s < sectors; s++) {
+		uint32_t s1 = (s + 1) % sectors;
+		*i++ = 0;
+		*i++ = 1 + s1;
+		*i++ = 1 + s;
+		for (uint32_t r = 1; r + 1 < rings; r++) {
+			uint32_t a = 1 + (r - 1) * sectors, b = a + sectors;
+			*i++ = a + s;
+			*i++ = a + s1;
+			*i++ = b + s;
+			*i++ = b + s;
+			*i++ = a + s1;
+			*i++ = b + s1;
+		}
+		uint32_t last = 1 + (rings - 2) * sectors;
+		*i++ = bottom;
+		*i++ = last + s;
+		*i++ = last + s1;
+	}
+}
+
+// updates the boxes of objects whose node is at or after first
+static void sceneUpdateBounds(Scene *s, uint32_t first) {
+	for (uint32_t i = 0; i < s->objectCount; i++) {
+		Object *o = &s->objects[i];
+		if (o->node >= first)
+			aabbTransform(&s->meshes[o->mesh].bounds, s->tf.world[o->node], &s->bvh.boxes[i]);
+	}
+}
+
+void sceneInitDemo(Scene *s, uint32_t objectCount, Mesh mesh) {
+	s->meshCount = 1;
+	s->meshes = calloc(1, sizeof(Mesh));
+	mustPtr(s->meshes, "scene meshes array, len = 1");
+	s->meshes[0] = mesh;
+	if (mesh.lodCount == 0) {
+		s->meshes[0].lods[0] = (MeshLod){mesh.firstIndex, mesh.indexCount, 0.0f};
+		s->meshes[0].lodCount = 1;
+	}
+
+	s->groupCount = (objectCount + SCENE_GROUP_SIZE - 1) / SCENE_GROUP_SIZE;
+	// at least one item, so that no allocation returns NULL
+	s->groups = calloc(s->groupCount > 0 ? s->groupCount : 1, sizeof(uint32_t));
+	mustPtr(s->groups, "scene groups array, len = %"PRIu32, s->groupCount);
+	s->objectCount = objectCount;
+	s->objects = calloc(objectCount > 0 ? objectCount : 1, sizeof(Object));
+	mustPtr(s->objects, "scene objects array, len = %"PRIu32, objectCount);
+
+	transformsInit(&s->tf, s->groupCount + objectCount);
+	uint32_t side = (uint32_t)ceilf(sqrtf(s->groupCount));
+	float half = 0.5f * SCENE_GROUP_SPACING * (side - 1);
+	uint32_t o = 0;
+	for (uint32_t g = 0; g < s->groupCount; g++) {
+		vec3 gpos = {
+			SCENE_GROUP_SPACING * (g % side) - half,
+			0.0f,
+			SCENE_GROUP_SPACING * (g / side) - half,
+		};
+		s->groups[g] = transformsAdd(&s->tf, TRANSFORM_NO_PARENT, gpos, GLM_QUAT_IDENTITY, GLM_VEC3_ONE);
+		for (uint32_t i = 0; i < SCENE_GROUP_SIZE && o < objectCount; i++, o++) {
+			float a = 2.0f * GLM_PIf * i / SCENE_GROUP_SIZE;
+			vec3 pos = {SCENE_RING_RADIUS * cosf(a), 0.0f, SCENE_RING_RADIUS * sinf(a)};
+			versor rot;
+			glm_quatv(rot, -a, GLM_YUP);
+			s->objects[o].node = transformsAdd(&s->tf, s->groups[g], pos, rot, GLM_VEC3_ONE);
+			s->objects[o].mesh = 0;
+		}
+	}
+
+	transformsUpdate(&s->tf);
+	bvhInit(&s->bvh, objectCount);
+	sceneUpdateBounds(s, 0);
+	bvhBuild(&s->bvh);
+
+	s->time = 0;
+	s->cam.pos[0] = 0.0f;
+	s->cam.pos[1] = 2.0f + half;
+	s->cam.pos[2] = 2.0f + 2.0f * half;
+	s->cam.yaw = 0.0f;
+	s->cam.pitch = -0.6f;
+	s->cam.fovy = glm_rad(60.0f);
+	s->cam.near = 0.1f;
+	s->cam.far = 10.0f + 4.0f * half;
+
+	infof("demo scene created (%"PRIu32" objects, %"PRIu32" nodes)", s->objectCount, s->tf.count);
+}
+
+void sceneDestroy(Scene *s) {
+	transformsDestroy(&s->tf);
+	bvhDestroy(&s->bvh);
+	free(s->meshes);
+	free(s->objects);
+	free(s->groups);
+}
+
+uint32_t sceneUpdate(Scene *s, float dt) {
+	s->time += dt;
+	// only every fourth group spins, the others stay clean
+	for (uint32_t g = 0; g < s->groupCount; g += 4) {
+		versor rot;
+		glm_quatv(rot, s->time * (0.5f + 0.1f * (g % 7)), GLM_YUP);
+		transformsSetRot(&s->tf, s->groups[g], rot);
+	}
+	uint32_t first = transformsUpdate(&s->tf);
+	if (first < s->tf.count) {
+		sceneUpdateBounds(s, first);
+		bvhUpdate(&s->bvh, SCENE_BVH_MAX_GROWTH);
+	}
+	return first;
+}
+
+uint32_t sceneCull(Scene *s, BvhCuller *c, uint32_t *out) {
+	Frustum f;
+	frustumFromMatrix(&f, s->cam.viewProj);
+	return bvhCullerRun(c, &s->bvh, &f, out);
+}
+
+float scenePixelsPerUnit(Scene *s, const uint32_t *objects, uint32_t count, float height) {
+	float nearest = s->cam.far;
+	for (uint32_t i = 0; i < count; i++) {
+		const Aabb *b = &s->bvh.boxes[objects[i]];
+		vec3 c = {
+			0.5f * (b->min[0] + b->max[0]),
+			0.5f * (b->min[1] + b->max[1]),
+			0.5f * (b->min[2] + b->max[2]),
+		};
+		float d = glm_vec3_distance(c, s->cam.pos);
+		if (d < nearest)
+			nearest = d;
+	}
+	if (nearest < s->cam.near)
+		nearest = s->cam.near;
+	return height / (2.0f * nearest * tanf(0.5f * s->cam.fovy));
+}
+
+uint64_t sceneSelectLods(Scene *s, const uint32_t *objects, uint32_t count, float height, float threshold, uint32_t *lods) {
+	float k = height / (2.0f * tanf(0.5f * s->cam.fovy));
+	uint64_t triangles = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		Object *o = &s->objects[objects[i]];
+		const Mesh *m = &s->meshes[o->mesh];
+		// the nearest point of the bounding sphere decides
+		const Aabb *b = &s->bvh.boxes[objects[i]];
+		vec3 c;
+		glm_vec3_center((float *)b->min, (float *)b->max, c);
+		float d = glm_vec3_distance(c, s->cam.pos) - 0.5f * glm_vec3_distance((float *)b->min, (float *)b->max);
+		if (d < s->cam.near)
+			d = s->cam.near;
+		mat4 *w = &s->tf.world[o->node];
+		float scale = glm_max(glm_vec3_norm((*w)[0]), glm_max(glm_vec3_norm((*w)[1]), glm_vec3_norm((*w)[2])));
+		o->lod = lodSelect(m, o->lod, k * scale / d, threshold);
+		lods[i] = o->lod;
+		triangles += m->lods[o->lod].indexCount / 3;
+	}
+	return triangles;
+}
+
+uint32_t scenePick(Scene *s, float x, float y) {
+	mat4 inv;
+	glm_mat4_inv(s->cam.viewProj, inv);
+	vec4 near, far;
+	glm_mat4_mulv(inv, (vec4){x, y, 0.0f, 1.0f}, near);
+	glm_mat4_mulv(inv, (vec4){x, y, 1.0f, 1.0f}, far);
+	vec3 origin, dir;
+	glm_vec3_scale(near, 1.0f / near[3], origin);
+	glm_vec3_scale(far, 1.0f / far[3], dir);
+	glm_vec3_sub(dir, origin, dir);
+	float t;
+	return bvhRaycast(&s->bvh, origin, dir, &t);
+}
@@ -0,0 +1,94 @@
+// scene contents: meshes, drawable objects and the camera
+// requires:
+// #include <cglm/cglm.h>
+// #include <SDL.h>
+// #include "jobs.h"
+// #include "transform.h"
+// #include "bvh.h"
+
+#define MESH_LODS_MAX 8
+
+// a simplified version of a mesh, using the same vertices
+typedef struct MeshLod {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error; // largest distance to the full mesh, in model space
+} MeshLod;
+
+// range of the shared index buffer
+typedef struct Mesh {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	Aabb bounds; // in model space
+	// levels of detail, lods[0] is the full mesh and each level has about
+	// half the triangles of the previous one (lod.h)
+	uint32_t lodCount; // sceneInitDemo adds lods[0] if 0
+	MeshLod lods[MESH_LODS_MAX];
+} Mesh;
+
+// a transform node drawn with a mesh
+// the node index is used as the instance index, so the vertex shader can
+// fetch the world matrix
+typedef struct Object {
+	uint32_t node;
+	uint32_t mesh;
+	uint32_t lod; // selected level of detail, see sceneSelectLods
+} Object;
+
+typedef struct Camera {
+	vec3 pos;
+	float yaw, pitch; // radians
+	float fovy; // radians
+	float near, far;
+	mat4 view;
+	mat4 proj;
+	mat4 viewProj;
+} Camera;
+
+typedef struct Scene {
+	Transforms tf;
+	uint32_t meshCount;
+	Mesh *meshes;
+	uint32_t objectCount;
+	Object *objects;
+	Bvh bvh; // items are object indices
+	uint32_t groupCount; // animated group nodes of the demo scene
+	uint32_t *groups;
+	Camera cam;
+	float time; // seconds
+} Scene;
+
+void cameraUpdate(Camera *c, float aspect);
+
+// creates a bumpy sphere with segments^2 triangles, the positions and
+// indices are allocated with malloc
+void sceneGenerateSphere(uint32_t segments, vec3 center, float radius, vec3 **positions, uint32_t *vertexCount, uint32_t **indices, uint32_t *indexCount);
+
+// builds a grid of rotating groups, each with a ring of objects using mesh
+void sceneInitDemo(Scene *s, uint32_t objectCount, Mesh mesh);
+
+void sceneDestroy(Scene *s);
+
+// advances the animation by dt seconds, updates the world matrices and the bvh
+// returns the lowest updated transform index
+uint32_t sceneUpdate(Scene *s, float dt);
+
+// writes the indices of objects intersecting the camera frustum to out
+// (which must hold s->objectCount items), returns their number
+uint32_t sceneCull(Scene *s, BvhCuller *c, uint32_t *out);
+
+// returns the number of pixels covered by one world unit at the nearest of
+// the given objects, height is the viewport height
+float scenePixelsPerUnit(Scene *s, const uint32_t *objects, uint32_t count, float height);
+
+// selects the level of detail of the given objects whose error on screen
+// stays below threshold pixels, height is the viewport height; an object
+// only changes its level once the error passes the threshold by
+// LOD_HYSTERESIS (lod.h), so that it doesn't switch back and forth
+// writes the levels to lods (count items) and returns the number of
+// triangles drawn with them
+uint64_t sceneSelectLods(Scene *s, const uint32_t *objects, uint32_t count, float height, float threshold, uint32_t *lods);
+
+// returns the object under the point in normalized device coordinates
+// (x and y in [-1, 1]), or BVH_NONE
+uint32_t scenePick(Scene *s, float x, float y);
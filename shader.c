@@ -0,0 +1,42 @@
+// compiled shaders and their reflection data
+
+#include <vulkan.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "log.h"
+#include "util.h"
+#include "shader.h"
+
+VkShaderModule shaderModule(VkDevice dev, const ShaderCode *s) {
+	VkShaderModuleCreateInfo smci = {};
+	smci.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	smci.codeSize = s->size;
+	smci.pCode = s->code;
+	VkShaderModule sm;
+	must(vkCreateShaderModule(dev, &smci, NULL, &sm));
+	return sm;
+}
+
+void shaderVertexInput(const ShaderCode *vs, VkVertexInputBindingDescription *binding, VkVertexInputAttributeDescription *attrs) {
+	mustCondition(vs->stage == VK_SHADER_STAGE_VERTEX_BIT, "%s is a vertex shader", vs->name);
+	uint32_t offset = 0;
+	for (uint32_t i = 0; i < vs->inputCount; i++) {
+		attrs[i] = (VkVertexInputAttributeDescription){vs->inputs[i].location, 0, vs->inputs[i].format, offset};
+		offset += vs->inputs[i].size;
+	}
+	*binding = (VkVertexInputBindingDescription){0, offset, VK_VERTEX_INPUT_RATE_VERTEX};
+}
+
+VkPushConstantRange shaderPushConstants(const ShaderCode *const *shaders, uint32_t count) {
+	VkPushConstantRange r = {};
+	for (uint32_t i = 0; i < count; i++) {
+		if (shaders[i]->pushConstantSize == 0)
+			continue;
+		r.stageFlags |= shaders[i]->stage;
+		if (shaders[i]->pushConstantSize > r.size)
+			r.size = shaders[i]->pushConstantSize;
+	}
+	return r;
+}
@@ -0,0 +1,44 @@
+// compiled shaders and their reflection data
+// buildShaders.sh generates a header in shaders_out for every shader
+// permutation, with the optimized SPIR-V and a ShaderCode describing its
+// interface (tools/spvheader.c), so pipeline state is derived from the
+// shaders instead of being repeated in C.
+// requires:
+// #include <vulkan.h>
+
+#define SHADER_INPUTS_MAX 16
+
+typedef struct ShaderInput {
+	uint32_t location;
+	VkFormat format;
+	uint32_t size; // bytes
+} ShaderInput;
+
+typedef struct ShaderBinding {
+	uint32_t set;
+	uint32_t binding;
+	VkDescriptorType type;
+	uint32_t count; // 0 for runtime sized arrays
+} ShaderBinding;
+
+typedef struct ShaderCode {
+	const char *name;
+	VkShaderStageFlagBits stage;
+	const uint32_t *code;
+	size_t size; // bytes
+	uint32_t inputCount; // stage inputs with a location, sorted by location
+	const ShaderInput *inputs;
+	uint32_t pushConstantSize; // 0 if push constants aren't used
+	uint32_t bindingCount;
+	const ShaderBinding *bindings;
+} ShaderCode;
+
+VkShaderModule shaderModule(VkDevice dev, const ShaderCode *s);
+
+// fills the vertex input state of a vertex shader, all inputs are read from
+// binding 0, tightly packed in location order
+// attrs must have room for SHADER_INPUTS_MAX descriptions
+void shaderVertexInput(const ShaderCode *vs, VkVertexInputBindingDescription *binding, VkVertexInputAttributeDescription *attrs);
+
+// range covering the push constants of all the shaders which use them
+VkPushConstantRange shaderPushConstants(const ShaderCode *const *shaders, uint32_t count);
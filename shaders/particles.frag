@@ -0,0 +1,15 @@
+#version 450
+
+// round additive sprites
+
+layout(location = 0) in vec2 fragCorner;
+layout(location = 1) in vec3 fragColor;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    float a = 1.0 - dot(fragCorner, fragCorner);
+    if (a <= 0.0)
+        discard;
+    outColor = vec4(fragColor * a, 1.0);
+}
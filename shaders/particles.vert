@@ -0,0 +1,44 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// camera facing quads, one instance per particle and no vertex input
+
+layout(location = 0) out vec2 fragCorner;
+layout(location = 1) out vec3 fragColor;
+
+// must match Particle (particles.h)
+struct Particle {
+    vec3 pos;
+    float life; // seconds left
+    vec3 vel;
+    float size;
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer Particles {
+    Particle p[];
+} particles[];
+
+// must match ParticlesDrawPush (particles.c)
+layout(push_constant) uniform Push {
+    mat4 viewProj;
+    vec4 right; // camera axes in world space
+    vec4 up;
+    uint particles;
+    uint pad0;
+    uint pad1;
+    uint pad2;
+} pc;
+
+const vec2 corners[6] = vec2[](
+    vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0),
+    vec2(-1.0, -1.0), vec2(1.0, 1.0), vec2(-1.0, 1.0));
+
+void main() {
+    Particle p = particles[pc.particles].p[gl_InstanceIndex];
+    vec2 c = corners[gl_VertexIndex];
+    vec3 pos = p.pos + (c.x * pc.right.xyz + c.y * pc.up.xyz) * p.size;
+    gl_Position = pc.viewProj * vec4(pos, 1.0);
+    fragCorner = c;
+    // fades out during the last second
+    fragColor = mix(vec3(1.0, 0.3, 0.05), vec3(1.0, 0.9, 0.4), clamp(p.life * 0.5, 0.0, 1.0)) * min(p.life, 1.0);
+}
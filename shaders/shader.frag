@@ -1,9 +1,104 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// permutations (buildShaders.sh): TEXTURED
+// specialization constants, ids must match PIPELINE_SPEC_* (pipeline.h)
+layout(constant_id = 1) const bool clustered = false;
 
 layout(location = 0) in vec3 fragColor;
+#ifdef TEXTURED
+layout(location = 1) in vec2 fragUV;
+#endif
+layout(location = 2) in vec3 fragWorld;
 
 layout(location = 0) out vec4 outColor;
 
+// must match shader.vert
+layout(push_constant) uniform PushConstants {
+    mat4 viewProj;
+    uint objects;
+    uint tex;
+    uint lights;
+    uint clusters;
+} pc;
+
+#ifdef TEXTURED
+// bindless textures
+layout(set = 0, binding = 1) uniform sampler2D textures[];
+#endif
+
+// must match lights.h
+#define CLUSTERS_X 16u
+#define CLUSTERS_Y 9u
+#define CLUSTERS_Z 24u
+#define PER_CLUSTER_MAX 255u
+#define AMBIENT 0.1
+
+// must match Light (lights.h)
+struct Light {
+    vec3 pos; // world space
+    float radius;
+    vec3 color;
+    float pad;
+};
+
+// must match LightsHeader (lights.h)
+layout(std430, set = 0, binding = 0) readonly buffer Lights {
+    mat4 view;
+    mat4 invProj;
+    float near;
+    float far;
+    float sliceScale;
+    float sliceBias;
+    uint width;
+    uint height;
+    uint count;
+    uint pad;
+    Light l[];
+} lights[];
+
+// written by clusters.comp
+layout(std430, set = 0, binding = 0) readonly buffer Clusters {
+    uint data[];
+} clusters[];
+
+// sum of the lights of the fragment's cluster, two-sided since the meshes
+// have no normals and aren't culled
+vec3 lighting() {
+    float near = lights[pc.lights].near, far = lights[pc.lights].far;
+    // view space depth from the [0, 1] depth of the perspective projection
+    float z = near * far / (far - gl_FragCoord.z * (far - near));
+    float slice = log(z) * lights[pc.lights].sliceScale + lights[pc.lights].sliceBias;
+    uvec3 c;
+    c.xy = uvec2(gl_FragCoord.xy / vec2(lights[pc.lights].width, lights[pc.lights].height) * vec2(CLUSTERS_X, CLUSTERS_Y));
+    c.xy = min(c.xy, uvec2(CLUSTERS_X, CLUSTERS_Y) - 1u);
+    c.z = uint(clamp(slice, 0.0, float(CLUSTERS_Z - 1u)));
+    uint base = (c.x + CLUSTERS_X * (c.y + CLUSTERS_Y * c.z)) * (PER_CLUSTER_MAX + 1u);
+
+    vec3 n = normalize(cross(dFdx(fragWorld), dFdy(fragWorld)));
+    vec3 sum = vec3(AMBIENT);
+    uint count = clusters[pc.clusters].data[base];
+    for (uint i = 0u; i < count; i++) {
+        Light l = lights[pc.lights].l[clusters[pc.clusters].data[base + 1u + i]];
+        vec3 d = l.pos - fragWorld;
+        float d2 = dot(d, d);
+        float r2 = l.radius * l.radius;
+        if (d2 >= r2)
+            continue;
+        // smooth falloff reaching 0 at the radius
+        float falloff = 1.0 - d2 / r2;
+        sum += l.color * falloff * falloff * abs(dot(n, d * inversesqrt(max(d2, 1e-8))));
+    }
+    return sum;
+}
+
 void main() {
-    outColor = vec4(fragColor, 1.0);
+#ifdef TEXTURED
+    vec3 color = fragColor * texture(textures[pc.tex], fragUV).rgb;
+#else
+    vec3 color = fragColor;
+#endif
+    if (clustered)
+        color *= lighting();
+    outColor = vec4(color, 1.0);
 }
@@ -1,10 +1,49 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// permutations (buildShaders.sh): TEXTURED
+// specialization constants, ids must match PIPELINE_SPEC_* (pipeline.h)
+layout(constant_id = 0) const bool vertexColors = true;
 
 layout(location = 0) in vec3 inPosition;
 
 layout(location = 0) out vec3 fragColor;
+#ifdef TEXTURED
+layout(location = 1) out vec2 fragUV;
+#endif
+layout(location = 2) out vec3 fragWorld; // lit by the clustered lights
+
+// must match shader.frag
+layout(push_constant) uniform PushConstants {
+    mat4 viewProj;
+    uint objects;
+    uint tex;
+    uint lights;
+    uint clusters;
+} pc;
+
+// bindless storage buffers, the world matrices are indexed by the transform
+// node (firstInstance)
+layout(std430, set = 0, binding = 0) readonly buffer Objects {
+    mat4 world[];
+} objects[];
+
+// a color per vertex from an integer hash, cheaper than evaluating sin
+vec3 vertexColor(uint i) {
+    i = (i ^ 61u) ^ (i >> 16);
+    i *= 9u;
+    i ^= i >> 4;
+    i *= 0x27d4eb2du;
+    i ^= i >> 15;
+    return vec3(float(i & 0xffu) / 255.0, 0.5, float((i >> 8) & 0xffu) / 255.0);
+}
 
 void main() {
-    gl_Position = vec4(inPosition, 1.0);
-    fragColor = vec3(0.5 * sin(gl_VertexIndex*1234.1254) + 0.5, 0.5, 0.5 * sin(gl_VertexIndex*943.0143 + 2.242) + 0.5);
+    vec4 world = objects[pc.objects].world[gl_InstanceIndex] * vec4(inPosition, 1.0);
+    gl_Position = pc.viewProj * world;
+    fragWorld = world.xyz;
+#ifdef TEXTURED
+    fragUV = inPosition.xy; // the mesh has no texture coordinates, use a planar mapping
+#endif
+    fragColor = vertexColors ? vertexColor(uint(gl_VertexIndex)) : vec3(1.0);
 }
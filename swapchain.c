@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <inttypes.h>
 
+#include "log.h"
 #include "util.h"
 #include "swapchain.h"
 
@@ -66,6 +67,9 @@ void swapchainConfigure(Swapchain *sc, VkPhysicalDevice pd, VkSurfaceKHR surf, u
 		minCount = caps.maxImageCount;
 	sc->count = minCount;
 
+	// transfer source is needed for frame capture
+	sc->usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | (caps.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+
 	if ((targetExtent.width == 0 || targetExtent.height == 0)
 			&& (caps.currentExtent.width != 0xFFFFFFFF || caps.currentExtent.height != 0xFFFFFFFF)) {
 		targetExtent = caps.currentExtent;
@@ -93,7 +97,7 @@ void swapchainInit(Swapchain *sc, VkDevice dev, VkSurfaceKHR surf, VkSurfaceForm
 	schci.imageColorSpace = surffmt.colorSpace;
 	schci.imageExtent = sc->extent;
 	schci.imageArrayLayers = 1;
-	schci.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	schci.imageUsage = sc->usage;
 	schci.preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
 	schci.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 	schci.presentMode = VK_PRESENT_MODE_MAILBOX_KHR; // TODO: use FIFO Relaxed, with FIFO as fallback
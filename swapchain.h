@@ -30,6 +30,7 @@ typedef struct Swapchain {
 	uint32_t count;
 	VkSwapchainKHR chain;
 	VkExtent2D extent;
+	VkImageUsageFlags usage;
 	VkImage *img;
 	VkImageView *imgv;
 	SwapchainSems drawReady; // image is ready to be drawn to
@@ -0,0 +1,739 @@
+// streamed textures with mip-level residency
+
+#include <SDL.h>
+#include <vulkan.h>
+#include <vk_mem_alloc.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+
+#include "log.h"
+#include "util.h"
+#include "bindless.h"
+#include "jobs.h"
+#include "texture.h"
+
+// staging offsets must be aligned to the texel block size and to 4
+#define TEXTURE_STAGING_ALIGN 16
+
+// returns 0 if the format is not supported
+static char textureFormatInfo(VkFormat f, uint32_t *bw, uint32_t *bh, uint32_t *bs) {
+	*bw = *bh = 4;
+	switch (f) {
+		case VK_FORMAT_R8G8B8A8_UNORM:
+		case VK_FORMAT_R8G8B8A8_SRGB:
+		case VK_FORMAT_B8G8R8A8_UNORM:
+		case VK_FORMAT_B8G8R8A8_SRGB:
+			*bw = *bh = 1;
+			*bs = 4;
+			return 1;
+		case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+		case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+		case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+		case VK_FORMAT_BC4_UNORM_BLOCK:
+		case VK_FORMAT_BC4_SNORM_BLOCK:
+			*bs = 8;
+			return 1;
+		case VK_FORMAT_BC2_UNORM_BLOCK:
+		case VK_FORMAT_BC2_SRGB_BLOCK:
+		case VK_FORMAT_BC3_UNORM_BLOCK:
+		case VK_FORMAT_BC3_SRGB_BLOCK:
+		case VK_FORMAT_BC5_UNORM_BLOCK:
+		case VK_FORMAT_BC5_SNORM_BLOCK:
+		case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+		case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+		case VK_FORMAT_BC7_UNORM_BLOCK:
+		case VK_FORMAT_BC7_SRGB_BLOCK:
+			*bs = 16;
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+static uint64_t textureLevelSize(const Texture *t, uint32_t w, uint32_t h) {
+	uint64_t bx = (w + t->blockWidth - 1) / t->blockWidth;
+	uint64_t by = (h + t->blockHeight - 1) / t->blockHeight;
+	return bx * by * t->blockSize;
+}
+
+// fills the level sizes and the mip tail start from levels[0] and levelCount
+// offsets are filled in by the caller
+static char textureSetLayout(Texture *t, VkFormat format, uint32_t width, uint32_t height, uint32_t levelCount) {
+	if (!textureFormatInfo(format, &t->blockWidth, &t->blockHeight, &t->blockSize)) {
+		errorf("texture %s: unsupported format %d", t->name, format);
+		return 0;
+	}
+	if (levelCount == 0 || levelCount > TEXTURE_MAX_LEVELS || width == 0 || height == 0) {
+		errorf("texture %s: unsupported size %"PRIu32"x%"PRIu32" with %"PRIu32" levels", t->name, width, height, levelCount);
+		return 0;
+	}
+	t->format = format;
+	t->levelCount = levelCount;
+	t->tail = levelCount - 1;
+	for (uint32_t i = 0; i < levelCount; i++) {
+		TextureLevel *l = &t->levels[i];
+		l->width = width >> i ? width >> i : 1;
+		l->height = height >> i ? height >> i : 1;
+		l->size = textureLevelSize(t, l->width, l->height);
+		if (i < t->tail && l->width <= TEXTURE_TAIL_SIZE && l->height <= TEXTURE_TAIL_SIZE)
+			t->tail = i;
+	}
+	t->resident = levelCount;
+	t->wanted = t->tail;
+	t->lastUsed = 0;
+	t->readLimit = 0;
+	t->reading = levelCount;
+	t->readData = NULL;
+	t->img = VK_NULL_HANDLE;
+	t->view = VK_NULL_HANDLE;
+	t->index = BINDLESS_NONE;
+	t->bytes = 0;
+	return 1;
+}
+
+// KTX2 file header, followed by the level index
+typedef struct Ktx2Header {
+	uint8_t identifier[12];
+	uint32_t vkFormat;
+	uint32_t typeSize;
+	uint32_t pixelWidth;
+	uint32_t pixelHeight;
+	uint32_t pixelDepth;
+	uint32_t layerCount;
+	uint32_t faceCount;
+	uint32_t levelCount;
+	uint32_t supercompressionScheme;
+	uint32_t dfdByteOffset;
+	uint32_t dfdByteLength;
+	uint32_t kvdByteOffset;
+	uint32_t kvdByteLength;
+	uint64_t sgdByteOffset;
+	uint64_t sgdByteLength;
+} Ktx2Header;
+
+typedef struct Ktx2Level {
+	uint64_t byteOffset;
+	uint64_t byteLength;
+	uint64_t uncompressedByteLength;
+} Ktx2Level;
+
+static char textureLoadKtx2(Texture *t, FILE *f) {
+	static const uint8_t id[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+	Ktx2Header h;
+	if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.identifier, id, sizeof(id)) != 0) {
+		errorf("texture %s: invalid ktx2 header", t->name);
+		return 0;
+	}
+	if (h.supercompressionScheme != 0 || h.pixelDepth > 1 || h.layerCount > 1 || h.faceCount != 1) {
+		errorf("texture %s: only 2d textures without supercompression are supported", t->name);
+		return 0;
+	}
+	if (!textureSetLayout(t, h.vkFormat, h.pixelWidth, h.pixelHeight, h.levelCount))
+		return 0;
+	for (uint32_t i = 0; i < h.levelCount; i++) {
+		Ktx2Level l;
+		if (fread(&l, sizeof(l), 1, f) != 1) {
+			errorf("texture %s: truncated level index", t->name);
+			return 0;
+		}
+		if (l.byteLength != t->levels[i].size) {
+			errorf("texture %s: level %"PRIu32" has %"PRIu64" bytes, %"PRIu64" expected", t->name, i, l.byteLength, t->levels[i].size);
+			return 0;
+		}
+		t->levels[i].offset = l.byteOffset;
+	}
+	return 1;
+}
+
+// DDS header without the magic number
+typedef struct DdsHeader {
+	uint32_t size;
+	uint32_t flags;
+	uint32_t height;
+	uint32_t width;
+	uint32_t pitchOrLinearSize;
+	uint32_t depth;
+	uint32_t mipMapCount;
+	uint32_t reserved1[11];
+	struct {
+		uint32_t size;
+		uint32_t flags;
+		uint32_t fourCC;
+		uint32_t rgbBitCount;
+		uint32_t rBitMask, gBitMask, bBitMask, aBitMask;
+	} pf;
+	uint32_t caps, caps2, caps3, caps4;
+	uint32_t reserved2;
+} DdsHeader;
+
+typedef struct DdsHeaderDx10 {
+	uint32_t dxgiFormat;
+	uint32_t resourceDimension;
+	uint32_t miscFlag;
+	uint32_t arraySize;
+	uint32_t miscFlags2;
+} DdsHeaderDx10;
+
+#define FOURCC(a, b, c, d) ((uint32_t)(a) | (uint32_t)(b) << 8 | (uint32_t)(c) << 16 | (uint32_t)(d) << 24)
+#define DDPF_FOURCC 0x4
+#define DDPF_RGB 0x40
+
+static VkFormat ddsDxgiFormat(uint32_t dxgi) {
+	switch (dxgi) {
+		case 28: return VK_FORMAT_R8G8B8A8_UNORM;
+		case 29: return VK_FORMAT_R8G8B8A8_SRGB;
+		case 71: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+		case 72: return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+		case 74: return VK_FORMAT_BC2_UNORM_BLOCK;
+		case 75: return VK_FORMAT_BC2_SRGB_BLOCK;
+		case 77: return VK_FORMAT_BC3_UNORM_BLOCK;
+		case 78: return VK_FORMAT_BC3_SRGB_BLOCK;
+		case 80: return VK_FORMAT_BC4_UNORM_BLOCK;
+		case 81: return VK_FORMAT_BC4_SNORM_BLOCK;
+		case 83: return VK_FORMAT_BC5_UNORM_BLOCK;
+		case 84: return VK_FORMAT_BC5_SNORM_BLOCK;
+		case 87: return VK_FORMAT_B8G8R8A8_UNORM;
+		case 91: return VK_FORMAT_B8G8R8A8_SRGB;
+		case 95: return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+		case 96: return VK_FORMAT_BC6H_SFLOAT_BLOCK;
+		case 98: return VK_FORMAT_BC7_UNORM_BLOCK;
+		case 99: return VK_FORMAT_BC7_SRGB_BLOCK;
+		default: return VK_FORMAT_UNDEFINED;
+	}
+}
+
+static char textureLoadDds(Texture *t, FILE *f) {
+	uint32_t magic;
+	DdsHeader h;
+	if (fread(&magic, 4, 1, f) != 1 || magic != FOURCC('D', 'D', 'S', ' ')
+			|| fread(&h, sizeof(h), 1, f) != 1 || h.size != sizeof(h)) {
+		errorf("texture %s: invalid dds header", t->name);
+		return 0;
+	}
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	if (h.pf.flags & DDPF_FOURCC) {
+		switch (h.pf.fourCC) {
+			case FOURCC('D', 'X', 'T', '1'): format = VK_FORMAT_BC1_RGBA_UNORM_BLOCK; break;
+			case FOURCC('D', 'X', 'T', '3'): format = VK_FORMAT_BC2_UNORM_BLOCK; break;
+			case FOURCC('D', 'X', 'T', '5'): format = VK_FORMAT_BC3_UNORM_BLOCK; break;
+			case FOURCC('A', 'T', 'I', '1'):
+			case FOURCC('B', 'C', '4', 'U'): format = VK_FORMAT_BC4_UNORM_BLOCK; break;
+			case FOURCC('A', 'T', 'I', '2'):
+			case FOURCC('B', 'C', '5', 'U'): format = VK_FORMAT_BC5_UNORM_BLOCK; break;
+			case FOURCC('D', 'X', '1', '0'): {
+				DdsHeaderDx10 dx10;
+				if (fread(&dx10, sizeof(dx10), 1, f) != 1 || dx10.arraySize > 1) {
+					errorf("texture %s: invalid or array dx10 header", t->name);
+					return 0;
+				}
+				format = ddsDxgiFormat(dx10.dxgiFormat);
+				break;
+			}
+		}
+	} else if ((h.pf.flags & DDPF_RGB) && h.pf.rgbBitCount == 32) {
+		format = h.pf.rBitMask == 0xFF ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_B8G8R8A8_UNORM;
+	}
+	uint32_t levelCount = h.mipMapCount ? h.mipMapCount : 1;
+	if (!textureSetLayout(t, format, h.width, h.height, levelCount))
+		return 0;
+	// levels are stored one after another, the most detailed first
+	uint64_t off = ftell(f);
+	for (uint32_t i = 0; i < levelCount; i++) {
+		t->levels[i].offset = off;
+		off += t->levels[i].size;
+	}
+	return 1;
+}
+
+char textureLoad(Texture *t, const char *path) {
+	memset(t, 0, sizeof(*t));
+	snprintf(t->name, sizeof(t->name), "%s", path);
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		errorf("texture %s: failed to open", path);
+		return 0;
+	}
+	uint8_t magic[4] = {};
+	if (fread(magic, 1, 4, f) != 4) {
+		errorf("texture %s: file too short", path);
+		fclose(f);
+		return 0;
+	}
+	rewind(f);
+	char ok;
+	if (memcmp(magic, "DDS ", 4) == 0)
+		ok = textureLoadDds(t, f);
+	else
+		ok = textureLoadKtx2(t, f);
+	if (!ok) {
+		fclose(f);
+		return 0;
+	}
+	t->file = f;
+	infof("texture %s: %"PRIu32"x%"PRIu32", %"PRIu32" levels, format %d, mip tail from level %"PRIu32,
+		path, t->levels[0].width, t->levels[0].height, t->levelCount, t->format, t->tail);
+	return 1;
+}
+
+void textureGenerateChecker(Texture *t, uint32_t size) {
+	memset(t, 0, sizeof(*t));
+	snprintf(t->name, sizeof(t->name), "checker%"PRIu32, size);
+	uint32_t levelCount = 1;
+	while ((size >> levelCount) > 0 && levelCount < TEXTURE_MAX_LEVELS)
+		levelCount++;
+	mustCondition(textureSetLayout(t, VK_FORMAT_R8G8B8A8_SRGB, size, size, levelCount), "checker texture layout is valid");
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < levelCount; i++) {
+		t->levels[i].offset = total;
+		total += t->levels[i].size;
+	}
+	t->mem = malloc(total);
+	mustPtr(t->mem, "checker texture, len = %"PRIu64, total);
+
+	// level 0 is an 8x8 checkerboard, the others are box filtered
+	uint8_t *p = t->mem;
+	uint32_t cell = size / 8 ? size / 8 : 1;
+	for (uint32_t y = 0; y < size; y++)
+		for (uint32_t x = 0; x < size; x++, p += 4) {
+			char on = ((x / cell) + (y / cell)) & 1;
+			p[0] = on ? 230 : 40;
+			p[1] = on ? 230 : 90;
+			p[2] = on ? 230 : 160;
+			p[3] = 255;
+		}
+	for (uint32_t i = 1; i < levelCount; i++) {
+		const TextureLevel *sl = &t->levels[i - 1], *dl = &t->levels[i];
+		const uint8_t *src = t->mem + sl->offset;
+		uint8_t *dst = t->mem + dl->offset;
+		for (uint32_t y = 0; y < dl->height; y++)
+			for (uint32_t x = 0; x < dl->width; x++)
+				for (uint32_t c = 0; c < 4; c++) {
+					uint32_t x0 = 2*x < sl->width ? 2*x : sl->width - 1, x1 = 2*x + 1 < sl->width ? 2*x + 1 : x0;
+					uint32_t y0 = 2*y < sl->height ? 2*y : sl->height - 1, y1 = 2*y + 1 < sl->height ? 2*y + 1 : y0;
+					uint32_t sum = src[4*(y0*sl->width + x0) + c] + src[4*(y0*sl->width + x1) + c]
+						+ src[4*(y1*sl->width + x0) + c] + src[4*(y1*sl->width + x1) + c];
+					dst[4*(y*dl->width + x) + c] = (sum + 2) / 4;
+				}
+	}
+}
+
+void textureDestroy(Texture *t) {
+	if (t->file != NULL)
+		fclose(t->file);
+	free(t->mem);
+	t->file = NULL;
+	t->mem = NULL;
+}
+
+void textureStreamerInit(TextureStreamer *ts, VkDevice dev, VmaAllocator vma, Bindless *bindless, JobSystem *jobs, uint32_t framesInFlight, VkDeviceSize stagingSize, VkDeviceSize budget) {
+	ts->dev = dev;
+	ts->vma = vma;
+	ts->bindless = bindless;
+	ts->jobs = jobs;
+	ts->framesInFlight = framesInFlight;
+	ts->budget = budget;
+	ts->used = 0;
+	ts->count = 0;
+	ts->garbageCount = 0;
+	ts->garbageCapacity = TEXTURE_GARBAGE_INITIAL;
+	ts->garbage = calloc(ts->garbageCapacity, sizeof(TextureGarbage));
+	mustPtr(ts->garbage, "texture garbage array, len = %"PRIu32, ts->garbageCapacity);
+	ts->uploaded = 0;
+	ts->evictions = 0;
+	ts->stagingPart = stagingSize / framesInFlight / TEXTURE_STAGING_ALIGN * TEXTURE_STAGING_ALIGN;
+
+	VkBufferCreateInfo bci = {};
+	bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bci.size = ts->stagingPart * framesInFlight;
+	bci.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VmaAllocationCreateInfo aci = {};
+	aci.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+	aci.usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST;
+	VmaAllocationInfo ai;
+	must(vmaCreateBuffer(vma, &bci, &aci, &ts->staging, &ts->stagingAlloc, &ai));
+	ts->stagingData = ai.pMappedData;
+
+	VkSamplerCreateInfo sci = {};
+	sci.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	sci.magFilter = VK_FILTER_LINEAR;
+	sci.minFilter = VK_FILTER_LINEAR;
+	sci.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	sci.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	sci.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	sci.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	sci.minLod = 0;
+	sci.maxLod = VK_LOD_CLAMP_NONE;
+	must(vkCreateSampler(dev, &sci, NULL, &ts->sampler));
+
+	textureGenerateChecker(&ts->fallback, TEXTURE_FALLBACK_SIZE);
+	textureStreamerAdd(ts, &ts->fallback);
+
+	infof("texture streamer created (budget %"PRIu64" MiB, %"PRIu64" KiB staging per frame)",
+		budget >> 20, ts->stagingPart >> 10);
+}
+
+static void textureFreeImage(TextureStreamer *ts, VkImage img, VmaAllocation alloc, VkImageView view) {
+	vkDestroyImageView(ts->dev, view, NULL);
+	vmaDestroyImage(ts->vma, img, alloc);
+}
+
+void textureStreamerDestroy(TextureStreamer *ts) {
+	for (uint32_t i = 0; i < ts->garbageCount; i++)
+		textureFreeImage(ts, ts->garbage[i].img, ts->garbage[i].alloc, ts->garbage[i].view);
+	ts->garbageCount = 0;
+	free(ts->garbage);
+	ts->garbage = NULL;
+	for (uint32_t i = 0; i < ts->count; i++) {
+		Texture *t = ts->textures[i];
+		jobsWait(ts->jobs, &t->read);
+		free(t->readData);
+		t->readData = NULL;
+		t->reading = t->levelCount;
+		if (t->img != VK_NULL_HANDLE)
+			textureFreeImage(ts, t->img, t->alloc, t->view);
+		t->img = VK_NULL_HANDLE;
+		t->index = BINDLESS_NONE;
+		t->resident = t->levelCount;
+	}
+	textureDestroy(&ts->fallback);
+	vkDestroySampler(ts->dev, ts->sampler, NULL);
+	vmaDestroyBuffer(ts->vma, ts->staging, ts->stagingAlloc);
+	infof("texture streamer: %"PRIu64" MiB uploaded, %"PRIu32" evictions", ts->uploaded >> 20, ts->evictions);
+}
+
+void textureStreamerAdd(TextureStreamer *ts, Texture *t) {
+	mustCondition(ts->count < TEXTURE_MAX, "texture count below %d", TEXTURE_MAX);
+	ts->textures[ts->count++] = t;
+	t->wanted = t->tail;
+}
+
+uint32_t textureLevelForPixels(const Texture *t, float pixels) {
+	if (pixels <= 0)
+		return t->levelCount - 1;
+	float level = log2f(t->levels[0].width / pixels);
+	if (level <= 0)
+		return 0;
+	if (level >= t->levelCount - 1)
+		return t->levelCount - 1;
+	return (uint32_t)level;
+}
+
+void textureRequest(Texture *t, uint32_t level, uint64_t frame) {
+	if (level < t->wanted)
+		t->wanted = level;
+	t->lastUsed = frame;
+}
+
+uint32_t textureIndex(const TextureStreamer *ts, const Texture *t) {
+	return t->index != BINDLESS_NONE ? t->index : ts->fallback.index;
+}
+
+// bytes of the levels first..levelCount-1
+static VkDeviceSize textureLevelsSize(const Texture *t, uint32_t first) {
+	VkDeviceSize n = 0;
+	for (uint32_t i = first; i < t->levelCount; i++)
+		n += t->levels[i].size;
+	return n;
+}
+
+static void textureAddGarbage(TextureStreamer *ts, Texture *t, uint64_t frame) {
+	if (ts->garbageCount == ts->garbageCapacity) {
+		ts->garbageCapacity *= 2;
+		ts->garbage = realloc(ts->garbage, ts->garbageCapacity * sizeof(TextureGarbage));
+		mustPtr(ts->garbage, "texture garbage array, len = %"PRIu32, ts->garbageCapacity);
+	}
+	ts->garbage[ts->garbageCount++] = (TextureGarbage){t->img, t->alloc, t->view, frame};
+}
+
+// Recreates the image of t holding the levels first..levelCount-1. Levels
+// that were resident are copied from the old image, the others are copied
+// from memory or the completed read into the staging buffer at *stagingOff.
+static void textureRebuild(TextureStreamer *ts, Texture *t, VkCommandBuffer cmd, uint32_t first, VkDeviceSize *stagingOff, uint64_t frame) {
+	const TextureLevel *base = &t->levels[first];
+	uint32_t mips = t->levelCount - first;
+
+	VkImage img;
+	VmaAllocation alloc;
+	VkImageCreateInfo ici = {};
+	ici.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	ici.imageType = VK_IMAGE_TYPE_2D;
+	ici.format = t->format;
+	ici.extent = (VkExtent3D){base->width, base->height, 1};
+	ici.mipLevels = mips;
+	ici.arrayLayers = 1;
+	ici.samples = VK_SAMPLE_COUNT_1_BIT;
+	ici.tiling = VK_IMAGE_TILING_OPTIMAL;
+	ici.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	ici.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	ici.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	VmaAllocationCreateInfo aci = {};
+	aci.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+	VmaAllocationInfo ai;
+	must(vmaCreateImage(ts->vma, &ici, &aci, &img, &alloc, &ai));
+
+	VkImageView view;
+	VkImageViewCreateInfo ivci = {};
+	ivci.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	ivci.image = img;
+	ivci.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	ivci.format = t->format;
+	ivci.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	ivci.subresourceRange.baseMipLevel = 0;
+	ivci.subresourceRange.levelCount = mips;
+	ivci.subresourceRange.baseArrayLayer = 0;
+	ivci.subresourceRange.layerCount = 1;
+	must(vkCreateImageView(ts->dev, &ivci, NULL, &view));
+
+	char hasOld = t->img != VK_NULL_HANDLE;
+	VkDeviceSize readOff = *stagingOff; // the read data has the layout of the staging range
+	VkImageMemoryBarrier2 imb[2] = {};
+	imb[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+	imb[0].srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+	imb[0].srcAccessMask = VK_ACCESS_2_NONE;
+	imb[0].dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+	imb[0].dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+	imb[0].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imb[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	imb[0].image = img;
+	imb[0].subresourceRange = ivci.subresourceRange;
+	if (hasOld) {
+		// the old image may still be sampled by earlier submissions
+		imb[1].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+		imb[1].srcStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+		imb[1].srcAccessMask = VK_ACCESS_2_NONE;
+		imb[1].dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+		imb[1].dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT;
+		imb[1].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imb[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		imb[1].image = t->img;
+		imb[1].subresourceRange = ivci.subresourceRange;
+		imb[1].subresourceRange.levelCount = t->levelCount - t->resident;
+	}
+	vkCmdPipelineBarrier2(cmd, &(VkDependencyInfo){
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.imageMemoryBarrierCount = hasOld ? 2 : 1,
+		.pImageMemoryBarriers = imb,
+	});
+
+	for (uint32_t l = first; l < t->levelCount; l++) {
+		const TextureLevel *lv = &t->levels[l];
+		VkImageSubresourceLayers dst = {VK_IMAGE_ASPECT_COLOR_BIT, l - first, 0, 1};
+		if (hasOld && l >= t->resident) {
+			VkImageCopy ic = {};
+			ic.srcSubresource = (VkImageSubresourceLayers){VK_IMAGE_ASPECT_COLOR_BIT, l - t->resident, 0, 1};
+			ic.dstSubresource = dst;
+			ic.extent = (VkExtent3D){lv->width, lv->height, 1};
+			vkCmdCopyImage(cmd, t->img, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, img, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &ic);
+			continue;
+		}
+		uint8_t *dstp = ts->stagingData + *stagingOff;
+		if (t->file != NULL)
+			memcpy(dstp, t->readData + (*stagingOff - readOff), lv->size);
+		else
+			memcpy(dstp, t->mem + lv->offset, lv->size);
+		VkBufferImageCopy bic = {};
+		bic.bufferOffset = *stagingOff;
+		bic.imageSubresource = dst;
+		bic.imageExtent = (VkExtent3D){lv->width, lv->height, 1};
+		vkCmdCopyBufferToImage(cmd, ts->staging, img, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &bic);
+		*stagingOff += (lv->size + TEXTURE_STAGING_ALIGN - 1) / TEXTURE_STAGING_ALIGN * TEXTURE_STAGING_ALIGN;
+		ts->uploaded += lv->size;
+	}
+
+	VkImageMemoryBarrier2 ready = imb[0];
+	ready.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+	ready.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+	ready.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+	ready.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+	ready.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	ready.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	vkCmdPipelineBarrier2(cmd, &(VkDependencyInfo){
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.imageMemoryBarrierCount = 1,
+		.pImageMemoryBarriers = &ready,
+	});
+
+	if (hasOld) {
+		textureAddGarbage(ts, t, frame);
+		bindlessRemoveTexture(ts->bindless, t->index, frame);
+	}
+	ts->used = ts->used - t->bytes + ai.size;
+	t->img = img;
+	t->alloc = alloc;
+	t->view = view;
+	t->index = bindlessAddTexture(ts->bindless, ts->sampler, view);
+	t->bytes = ai.size;
+	t->resident = first;
+}
+
+// staging space needed to make the levels first..resident-1 resident
+static VkDeviceSize textureUploadSize(const Texture *t, uint32_t first) {
+	VkDeviceSize n = 0;
+	for (uint32_t i = first; i < t->resident && i < t->levelCount; i++)
+		n += (t->levels[i].size + TEXTURE_STAGING_ALIGN - 1) / TEXTURE_STAGING_ALIGN * TEXTURE_STAGING_ALIGN;
+	return n;
+}
+
+// returns 1 if levels of t can be evicted: it wasn't requested in this frame
+// and has no read pending, which would keep its residency
+static char textureCanEvict(const Texture *t, uint64_t frame) {
+	return t->lastUsed < frame && t->reading == t->levelCount && t->resident < t->tail;
+}
+
+// bytes that can be evicted from textures not used in this frame
+static VkDeviceSize textureEvictable(TextureStreamer *ts, uint64_t frame) {
+	VkDeviceSize n = 0;
+	for (uint32_t i = 0; i < ts->count; i++) {
+		Texture *t = ts->textures[i];
+		if (textureCanEvict(t, frame))
+			n += textureLevelsSize(t, t->resident) - textureLevelsSize(t, t->tail);
+	}
+	return n;
+}
+
+static void textureReadJob(void *arg) {
+	Texture *t = arg;
+	uint8_t *p = t->readData;
+	for (uint32_t l = t->reading; l < t->resident; l++) {
+		const TextureLevel *lv = &t->levels[l];
+		if (fseek(t->file, lv->offset, SEEK_SET) != 0 || fread(p, 1, lv->size, t->file) != lv->size) {
+			t->readFailed = 1;
+			return;
+		}
+		p += (lv->size + TEXTURE_STAGING_ALIGN - 1) / TEXTURE_STAGING_ALIGN * TEXTURE_STAGING_ALIGN;
+	}
+}
+
+// starts reading the levels first..resident-1 of a file
+static void textureBeginRead(TextureStreamer *ts, Texture *t, uint32_t first) {
+	VkDeviceSize n = textureUploadSize(t, first);
+	t->readData = malloc(n);
+	mustPtr(t->readData, "texture %s read, len = %"PRIu64, t->name, n);
+	t->reading = first;
+	t->readFailed = 0;
+	jobsRun(ts->jobs, textureReadJob, t, &t->read);
+}
+
+static void textureEndRead(Texture *t) {
+	free(t->readData);
+	t->readData = NULL;
+	t->reading = t->levelCount;
+}
+
+// replaces a texture whose mip tail can't be read or uploaded, so that it
+// doesn't stay without an image
+static void textureFallback(Texture *t) {
+	errorf("texture %s: mip tail can't be loaded, using a checker texture", t->name);
+	textureDestroy(t);
+	textureGenerateChecker(t, TEXTURE_CHECKER_SIZE);
+}
+
+char textureStreamerUpdate(TextureStreamer *ts, VkCommandBuffer cmd, uint32_t frameIndex, uint64_t frame) {
+	char changed = 0;
+	// free images that are no longer used by any frame in flight
+	for (uint32_t i = 0; i < ts->garbageCount; ) {
+		if (ts->garbage[i].frame + ts->framesInFlight <= frame) {
+			textureFreeImage(ts, ts->garbage[i].img, ts->garbage[i].alloc, ts->garbage[i].view);
+			ts->garbage[i] = ts->garbage[--ts->garbageCount];
+		} else {
+			i++;
+		}
+	}
+
+	VkDeviceSize stagingOff = ts->stagingPart * frameIndex;
+	VkDeviceSize stagingEnd = stagingOff + ts->stagingPart;
+
+	// stream in requested levels, as far as the budget and staging allow
+	VkDeviceSize evictable = textureEvictable(ts, frame);
+	for (uint32_t i = 0; i < ts->count; i++) {
+		Texture *t = ts->textures[i];
+		// levels read by a job are uploaded once the read has completed
+		if (t->reading < t->levelCount) {
+			changed = 1;
+			if (SDL_AtomicGet(&t->read.pending) > 0)
+				continue;
+			if (!t->readFailed) {
+				// otherwise retried with the staging of the next frame
+				if (stagingOff + textureUploadSize(t, t->reading) <= stagingEnd) {
+					textureRebuild(ts, t, cmd, t->reading, &stagingOff, frame);
+					textureEndRead(t);
+				}
+				continue;
+			}
+			errorf("texture %s: failed to read levels %"PRIu32"+", t->name, t->reading);
+			textureEndRead(t);
+			if (t->resident < t->levelCount) {
+				// keep what is resident and don't try again
+				t->readLimit = t->resident;
+				continue;
+			}
+			// the checker is in memory, its tail is uploaded below
+			textureFallback(t);
+		}
+
+		uint32_t want = t->wanted < t->tail ? t->wanted : t->tail;
+		if (want < t->readLimit)
+			want = t->readLimit;
+		t->wanted = t->levelCount;
+		uint32_t first = t->resident;
+		for (uint32_t l = want; l < t->resident; l++) {
+			VkDeviceSize extra = textureLevelsSize(t, l) - textureLevelsSize(t, t->resident);
+			if (l >= t->tail
+					|| (ts->used + extra <= ts->budget + evictable
+						&& stagingOff + textureUploadSize(t, l) <= stagingEnd)) {
+				first = l;
+				break;
+			}
+		}
+		if (first < t->resident) {
+			VkDeviceSize extra = textureLevelsSize(t, first) - textureLevelsSize(t, t->resident);
+			evictable = evictable > extra ? evictable - extra : 0;
+			if (textureUploadSize(t, first) > ts->stagingPart) {
+				// only the mip tail of a texture without an image is chosen
+				// without checking the staging
+				textureFallback(t);
+				first = t->tail;
+			}
+			if (t->file != NULL) {
+				textureBeginRead(ts, t, first);
+				changed = 1;
+				continue;
+			}
+			if (stagingOff + textureUploadSize(t, first) > stagingEnd) {
+				debugf("texture %s: levels %"PRIu32"+ wait for the staging of the next frame", t->name, first);
+				changed = 1;
+				continue;
+			}
+			textureRebuild(ts, t, cmd, first, &stagingOff, frame);
+			changed = 1;
+		}
+	}
+
+	// evict the most detailed levels of the least recently used textures
+	while (ts->used > ts->budget) {
+		Texture *lru = NULL;
+		for (uint32_t i = 0; i < ts->count; i++) {
+			Texture *t = ts->textures[i];
+			// levels requested in this frame are kept, even over the budget
+			if (textureCanEvict(t, frame) && (lru == NULL || t->lastUsed < lru->lastUsed))
+				lru = t;
+		}
+		if (lru == NULL)
+			break;
+		uint32_t first = lru->resident;
+		VkDeviceSize over = ts->used - ts->budget;
+		VkDeviceSize freed = 0;
+		while (first < lru->tail && freed < over)
+			freed += lru->levels[first++].size;
+		textureRebuild(ts, lru, cmd, first, &stagingOff, frame);
+		ts->evictions++;
+		changed = 1;
+	}
+	return changed;
+}
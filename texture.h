@@ -0,0 +1,134 @@
+// streamed textures with mip-level residency
+// Textures are loaded from pre-mipped KTX2 or DDS files (or generated). Only
+// the small mip tail is uploaded at first; more detailed levels are streamed
+// when the renderer requests them and evicted again when the memory budget is
+// exceeded. Levels of files are read by jobs, the render thread only uploads
+// them once they have been read. The image of a texture holds the levels
+// resident..levelCount-1, changing the residency recreates it and copies the
+// kept levels on the gpu.
+// Each image view gets a new bindless texture index.
+// requires:
+// #include <vulkan.h>
+// #include <vk_mem_alloc.h>
+// #include <SDL.h>
+// #include "bindless.h"
+// #include "jobs.h"
+
+#define TEXTURE_MAX_LEVELS 16
+#define TEXTURE_MAX 256
+#define TEXTURE_GARBAGE_INITIAL 64 // capacity of the garbage list, it grows as needed
+// levels of at most this size (in both dimensions) form the mip tail
+#define TEXTURE_TAIL_SIZE 64
+// size of the checker used when a texture can't be loaded
+#define TEXTURE_CHECKER_SIZE 1024
+// size of the checker sampled instead of a texture without an image, it is
+// all mip tail
+#define TEXTURE_FALLBACK_SIZE 64
+
+typedef struct TextureLevel {
+	uint32_t width, height;
+	uint64_t offset; // in the source
+	uint64_t size;
+} TextureLevel;
+
+typedef struct Texture {
+	// source
+	char name[64];
+	FILE *file; // NULL if the levels are in mem
+	uint8_t *mem;
+	VkFormat format;
+	uint32_t blockWidth, blockHeight, blockSize; // 1x1 for uncompressed formats
+	uint32_t levelCount;
+	TextureLevel levels[TEXTURE_MAX_LEVELS];
+	uint32_t tail; // first level of the mip tail
+	// residency
+	uint32_t resident; // first resident level, levelCount if nothing is resident
+	uint32_t wanted; // most detailed level requested since the last update
+	uint64_t lastUsed; // frame number of the last request
+	uint32_t readLimit; // most detailed level that can be read, set when a read fails
+	// levels reading..resident-1 being read from the file by a job
+	JobCounter read;
+	uint32_t reading; // levelCount if there is no read
+	uint8_t *readData; // levels laid out as in the staging buffer
+	char readFailed;
+	VkImage img;
+	VmaAllocation alloc;
+	VkImageView view;
+	uint32_t index; // bindless texture index of view, BINDLESS_NONE if nothing is resident
+	VkDeviceSize bytes; // memory used by the image
+} Texture;
+
+typedef struct TextureGarbage {
+	VkImage img;
+	VmaAllocation alloc;
+	VkImageView view;
+	uint64_t frame; // frame in which it was last used
+} TextureGarbage;
+
+typedef struct TextureStreamer {
+	VkDevice dev;
+	VmaAllocator vma;
+	Bindless *bindless;
+	uint32_t framesInFlight;
+	VkDeviceSize budget; // bytes for all texture images
+	VkDeviceSize used;
+	VkSampler sampler;
+	// staging buffer, split into one part per frame in flight
+	VkBuffer staging;
+	VmaAllocation stagingAlloc;
+	uint8_t *stagingData;
+	VkDeviceSize stagingPart;
+	uint32_t count;
+	Texture *textures[TEXTURE_MAX];
+	Texture fallback; // resident from the first update on
+	JobSystem *jobs; // reads the levels of files
+	uint32_t garbageCount, garbageCapacity;
+	TextureGarbage *garbage;
+	// statistics
+	uint64_t uploaded; // bytes
+	uint32_t evictions;
+} TextureStreamer;
+
+// stagingSize is split between the frames in flight and limits the amount
+// of data uploaded per frame
+// the streamer is used from a thread registered with jobs
+void textureStreamerInit(TextureStreamer *ts, VkDevice dev, VmaAllocator vma, Bindless *bindless, JobSystem *jobs, uint32_t framesInFlight, VkDeviceSize stagingSize, VkDeviceSize budget);
+
+// waits for pending reads, destroys the streamer and the images of all
+// textures
+// caller has to ensure that the resources are no longer in use
+void textureStreamerDestroy(TextureStreamer *ts);
+
+// loads the level layout of a KTX2 or DDS file, the file is kept open
+// returns 0 if the file can't be used
+char textureLoad(Texture *t, const char *path);
+
+// creates an uncompressed RGBA checkerboard with a full mip chain in memory
+void textureGenerateChecker(Texture *t, uint32_t size);
+
+// closes the source, the texture must have been removed from the streamer
+void textureDestroy(Texture *t);
+
+// the mip tail is made resident by the next textureStreamerUpdate
+void textureStreamerAdd(TextureStreamer *ts, Texture *t);
+
+// returns the level whose size is closest to covering the given number of
+// pixels with one texel per pixel
+uint32_t textureLevelForPixels(const Texture *t, float pixels);
+
+// requests that the level is made resident
+void textureRequest(Texture *t, uint32_t level, uint64_t frame);
+
+// returns the bindless index to sample t with, that of the fallback texture
+// while t has no image
+uint32_t textureIndex(const TextureStreamer *ts, const Texture *t);
+
+// Streams requested levels in and evicts levels over the budget. Upload and
+// copy commands are recorded into cmd, which must be executed before any
+// draw using the textures. frameIndex selects the staging part (its previous
+// use must be complete), frame is the current frame number.
+// A texture whose mip tail can't be read or uploaded is replaced by the
+// generated checker.
+// Returns 1 if the residency of any texture changed or reads are pending, in
+// which case the streamer may have more to do in the next frame.
+char textureStreamerUpdate(TextureStreamer *ts, VkCommandBuffer cmd, uint32_t frameIndex, uint64_t frame);
@@ -0,0 +1,350 @@
+// converts a SPIR-V module into a C header with its reflection data
+// The header defines a uint32_t array with the code (so it's aligned for
+// vkCreateShaderModule) and a ShaderCode (shader.h) named after the symbol
+// argument, describing the stage inputs, push constants and descriptors.
+// usage: spvheader <symbol> <file.spv> > file.h
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define SPV_MAGIC 0x07230203
+
+// opcodes
+#define OP_ENTRY_POINT 15
+#define OP_TYPE_INT 21
+#define OP_TYPE_FLOAT 22
+#define OP_TYPE_VECTOR 23
+#define OP_TYPE_MATRIX 24
+#define OP_TYPE_IMAGE 25
+#define OP_TYPE_SAMPLER 26
+#define OP_TYPE_SAMPLED_IMAGE 27
+#define OP_TYPE_ARRAY 28
+#define OP_TYPE_RUNTIME_ARRAY 29
+#define OP_TYPE_STRUCT 30
+#define OP_TYPE_POINTER 32
+#define OP_CONSTANT 43
+#define OP_VARIABLE 59
+#define OP_DECORATE 71
+#define OP_MEMBER_DECORATE 72
+
+// decorations
+#define DEC_BUFFER_BLOCK 3
+#define DEC_ARRAY_STRIDE 6
+#define DEC_MATRIX_STRIDE 7
+#define DEC_BUILTIN 11
+#define DEC_LOCATION 30
+#define DEC_BINDING 33
+#define DEC_DESCRIPTOR_SET 34
+#define DEC_OFFSET 35
+
+// storage classes
+#define SC_UNIFORM_CONSTANT 0
+#define SC_INPUT 1
+#define SC_UNIFORM 2
+#define SC_PUSH_CONSTANT 9
+#define SC_STORAGE_BUFFER 12
+
+#define MEMBERS_MAX 64
+#define INPUTS_MAX 16 // SHADER_INPUTS_MAX
+#define BINDINGS_MAX 64
+
+// what is known about an id
+typedef struct Id {
+	uint32_t op; // instruction defining it
+	uint32_t type; // component, element or pointee type
+	uint32_t count; // vector components, matrix columns, array length id
+	uint32_t width; // int and float
+	uint32_t sign; // int
+	uint32_t storage; // pointers and variables
+	uint32_t value; // constants
+	uint32_t sampled; // images, 2 for storage images
+	uint32_t memberCount;
+	uint32_t *members;
+	uint32_t offsets[MEMBERS_MAX];
+	uint32_t matrixStrides[MEMBERS_MAX]; // 0 if not a matrix
+	char bufferBlock, builtin, hasLocation, hasBinding;
+	uint32_t location, binding, set, arrayStride;
+} Id;
+
+static Id *ids;
+static uint32_t bound;
+
+static void fail(const char *msg) {
+	fprintf(stderr, "spvheader: %s\n", msg);
+	exit(1);
+}
+
+static Id *id(uint32_t i) {
+	if (i >= bound)
+		fail("id out of bounds");
+	return &ids[i];
+}
+
+// size in bytes with explicit layout
+static uint32_t typeSize(uint32_t t) {
+	Id *ty = id(t);
+	switch (ty->op) {
+	case OP_TYPE_INT:
+	case OP_TYPE_FLOAT:
+		return ty->width / 8;
+	case OP_TYPE_VECTOR:
+	case OP_TYPE_MATRIX:
+		return ty->count * typeSize(ty->type);
+	case OP_TYPE_ARRAY:
+		return id(ty->count)->value * (ty->arrayStride ? ty->arrayStride : typeSize(ty->type));
+	case OP_TYPE_STRUCT: {
+		uint32_t size = 0;
+		for (uint32_t i = 0; i < ty->memberCount; i++) {
+			Id *m = id(ty->members[i]);
+			// the stride of matrix columns is a decoration of the member
+			uint32_t msize = m->op == OP_TYPE_MATRIX && ty->matrixStrides[i] > 0
+				? m->count * ty->matrixStrides[i] : typeSize(ty->members[i]);
+			uint32_t end = ty->offsets[i] + msize;
+			if (end > size)
+				size = end;
+		}
+		return size;
+	}
+	default:
+		return 0;
+	}
+}
+
+static const char *inputFormat(uint32_t t) {
+	Id *ty = id(t);
+	uint32_t n = 1;
+	if (ty->op == OP_TYPE_VECTOR) {
+		n = ty->count;
+		ty = id(ty->type);
+	}
+	if (ty->width != 32 || n < 1 || n > 4)
+		fail("unsupported stage input type");
+	static const char *floats[] = {"R32_SFLOAT", "R32G32_SFLOAT", "R32G32B32_SFLOAT", "R32G32B32A32_SFLOAT"};
+	static const char *sints[] = {"R32_SINT", "R32G32_SINT", "R32G32B32_SINT", "R32G32B32A32_SINT"};
+	static const char *uints[] = {"R32_UINT", "R32G32_UINT", "R32G32B32_UINT", "R32G32B32A32_UINT"};
+	if (ty->op == OP_TYPE_FLOAT)
+		return floats[n - 1];
+	if (ty->op == OP_TYPE_INT)
+		return ty->sign ? sints[n - 1] : uints[n - 1];
+	fail("unsupported stage input type");
+	return NULL;
+}
+
+static const char *descriptorType(uint32_t storage, uint32_t t) {
+	Id *ty = id(t);
+	switch (ty->op) {
+	case OP_TYPE_SAMPLED_IMAGE:
+		return "COMBINED_IMAGE_SAMPLER";
+	case OP_TYPE_SAMPLER:
+		return "SAMPLER";
+	case OP_TYPE_IMAGE:
+		return ty->sampled == 2 ? "STORAGE_IMAGE" : "SAMPLED_IMAGE";
+	case OP_TYPE_STRUCT:
+		if (storage == SC_STORAGE_BUFFER || ty->bufferBlock)
+			return "STORAGE_BUFFER";
+		return "UNIFORM_BUFFER";
+	}
+	fail("unsupported descriptor type");
+	return NULL;
+}
+
+static uint32_t *readFile(const char *path, uint32_t *count) {
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		fail("can't open the input file");
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (size < 20 || size % 4 != 0)
+		fail("the input isn't a SPIR-V module");
+	uint32_t *words = malloc(size);
+	if (words == NULL || fread(words, 1, size, f) != (size_t)size)
+		fail("can't read the input file");
+	fclose(f);
+	*count = size / 4;
+	if (words[0] != SPV_MAGIC)
+		fail("the input isn't a SPIR-V module");
+	return words;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3)
+		fail("usage: spvheader <symbol> <file.spv>");
+	const char *sym = argv[1];
+	uint32_t n;
+	uint32_t *w = readFile(argv[2], &n);
+	bound = w[3];
+	ids = calloc(bound, sizeof(Id));
+	if (ids == NULL)
+		fail("out of memory");
+
+	const char *stage = NULL;
+	for (uint32_t i = 5; i < n;) {
+		uint32_t len = w[i] >> 16, op = w[i] & 0xffff;
+		if (len == 0 || i + len > n)
+			fail("malformed instruction");
+		uint32_t *a = &w[i + 1];
+		switch (op) {
+		case OP_ENTRY_POINT:
+			if (stage != NULL)
+				fail("more than one entry point");
+			switch (a[0]) {
+			case 0: stage = "VERTEX"; break;
+			case 4: stage = "FRAGMENT"; break;
+			case 5: stage = "COMPUTE"; break;
+			default: fail("unsupported execution model");
+			}
+			break;
+		case OP_TYPE_INT:
+			id(a[0])->sign = a[2];
+			// fall through
+		case OP_TYPE_FLOAT:
+			id(a[0])->op = op;
+			id(a[0])->width = a[1];
+			break;
+		case OP_TYPE_VECTOR:
+		case OP_TYPE_MATRIX:
+		case OP_TYPE_ARRAY:
+			id(a[0])->op = op;
+			id(a[0])->type = a[1];
+			id(a[0])->count = a[2];
+			break;
+		case OP_TYPE_RUNTIME_ARRAY:
+		case OP_TYPE_SAMPLED_IMAGE:
+			id(a[0])->op = op;
+			id(a[0])->type = a[1];
+			break;
+		case OP_TYPE_SAMPLER:
+			id(a[0])->op = op;
+			break;
+		case OP_TYPE_IMAGE:
+			id(a[0])->op = op;
+			id(a[0])->sampled = a[6];
+			break;
+		case OP_TYPE_STRUCT:
+			if (len - 2 > MEMBERS_MAX)
+				fail("too many struct members");
+			id(a[0])->op = op;
+			id(a[0])->memberCount = len - 2;
+			id(a[0])->members = &a[1];
+			break;
+		case OP_TYPE_POINTER:
+			id(a[0])->op = op;
+			id(a[0])->storage = a[1];
+			id(a[0])->type = a[2];
+			break;
+		case OP_CONSTANT:
+			id(a[1])->op = op;
+			id(a[1])->value = a[2];
+			break;
+		case OP_VARIABLE:
+			id(a[1])->op = op;
+			id(a[1])->type = a[0];
+			id(a[1])->storage = a[2];
+			break;
+		case OP_DECORATE: {
+			Id *t = id(a[0]);
+			switch (a[1]) {
+			case DEC_BUFFER_BLOCK: t->bufferBlock = 1; break;
+			case DEC_ARRAY_STRIDE: t->arrayStride = a[2]; break;
+			case DEC_BUILTIN: t->builtin = 1; break;
+			case DEC_LOCATION: t->location = a[2]; t->hasLocation = 1; break;
+			case DEC_BINDING: t->binding = a[2]; t->hasBinding = 1; break;
+			case DEC_DESCRIPTOR_SET: t->set = a[2]; break;
+			}
+			break;
+		}
+		case OP_MEMBER_DECORATE:
+			if (a[1] >= MEMBERS_MAX)
+				fail("too many struct members");
+			if (a[2] == DEC_OFFSET)
+				id(a[0])->offsets[a[1]] = a[3];
+			else if (a[2] == DEC_MATRIX_STRIDE)
+				id(a[0])->matrixStrides[a[1]] = a[3];
+			else if (a[2] == DEC_BUILTIN)
+				id(a[0])->builtin = 1;
+			break;
+		}
+		i += len;
+	}
+	if (stage == NULL)
+		fail("no entry point");
+
+	uint32_t inputs[INPUTS_MAX], inputCount = 0;
+	uint32_t bindings[BINDINGS_MAX], bindingCount = 0;
+	uint32_t pushSize = 0;
+	for (uint32_t v = 0; v < bound; v++) {
+		Id *var = &ids[v];
+		if (var->op != OP_VARIABLE)
+			continue;
+		uint32_t t = id(var->type)->type;
+		if (var->storage == SC_INPUT && var->hasLocation && !var->builtin && !id(t)->builtin) {
+			if (inputCount == INPUTS_MAX)
+				fail("too many stage inputs");
+			inputs[inputCount++] = v;
+		} else if (var->storage == SC_PUSH_CONSTANT) {
+			pushSize = typeSize(t);
+		} else if (var->hasBinding && (var->storage == SC_UNIFORM_CONSTANT || var->storage == SC_UNIFORM || var->storage == SC_STORAGE_BUFFER)) {
+			if (bindingCount == BINDINGS_MAX)
+				fail("too many descriptor bindings");
+			bindings[bindingCount++] = v;
+		}
+	}
+	// inputs sorted by location
+	for (uint32_t i = 1; i < inputCount; i++)
+		for (uint32_t j = i; j > 0 && ids[inputs[j - 1]].location > ids[inputs[j]].location; j--) {
+			uint32_t tmp = inputs[j];
+			inputs[j] = inputs[j - 1];
+			inputs[j - 1] = tmp;
+		}
+
+	printf("// generated by tools/spvheader.c from %s, do not edit\n\n", argv[2]);
+	printf("static const uint32_t %s_code[] = {", sym);
+	for (uint32_t i = 0; i < n; i++)
+		printf("%s0x%08"PRIx32",", i % 8 == 0 ? "\n\t" : " ", w[i]);
+	printf("\n};\n");
+	if (inputCount > 0) {
+		printf("\nstatic const ShaderInput %s_inputs[] = {\n", sym);
+		for (uint32_t i = 0; i < inputCount; i++) {
+			uint32_t t = id(ids[inputs[i]].type)->type;
+			printf("\t{%"PRIu32", VK_FORMAT_%s, %"PRIu32"},\n", ids[inputs[i]].location, inputFormat(t), typeSize(t));
+		}
+		printf("};\n");
+	}
+	if (bindingCount > 0) {
+		printf("\nstatic const ShaderBinding %s_bindings[] = {\n", sym);
+		for (uint32_t i = 0; i < bindingCount; i++) {
+			Id *var = &ids[bindings[i]];
+			uint32_t t = id(var->type)->type, count = 1;
+			if (id(t)->op == OP_TYPE_ARRAY) {
+				count = id(id(t)->count)->value;
+				t = id(t)->type;
+			} else if (id(t)->op == OP_TYPE_RUNTIME_ARRAY) {
+				count = 0;
+				t = id(t)->type;
+			}
+			printf("\t{%"PRIu32", %"PRIu32", VK_DESCRIPTOR_TYPE_%s, %"PRIu32"},\n",
+				var->set, var->binding, descriptorType(var->storage, t), count);
+		}
+		printf("};\n");
+	}
+	printf("\nstatic const ShaderCode %s = {\n", sym);
+	printf("\t.name = \"%s\",\n", sym);
+	printf("\t.stage = VK_SHADER_STAGE_%s_BIT,\n", stage);
+	printf("\t.code = %s_code,\n", sym);
+	printf("\t.size = sizeof(%s_code),\n", sym);
+	printf("\t.inputCount = %"PRIu32",\n", inputCount);
+	if (inputCount > 0)
+		printf("\t.inputs = %s_inputs,\n", sym);
+	printf("\t.pushConstantSize = %"PRIu32",\n", pushSize);
+	printf("\t.bindingCount = %"PRIu32",\n", bindingCount);
+	if (bindingCount > 0)
+		printf("\t.bindings = %s_bindings,\n", sym);
+	printf("};\n");
+	free(ids);
+	free(w);
+	return 0;
+}
@@ -0,0 +1,109 @@
+// transform hierarchy
+
+#include <cglm/cglm.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "log.h"
+#include "util.h"
+#include "transform.h"
+
+// cglm uses aligned loads for mat4 and versor
+#define TRANSFORM_ALIGN 32
+
+static void *transformsAlloc(uint32_t n, size_t size) {
+	// at least one item, aligned_alloc may return NULL for a length of 0
+	size_t len = ((n > 0 ? n : 1) * size + TRANSFORM_ALIGN - 1) / TRANSFORM_ALIGN * TRANSFORM_ALIGN;
+	void *p = aligned_alloc(TRANSFORM_ALIGN, len);
+	mustPtr(p, "transforms array, len = %"PRIu32, n);
+	return p;
+}
+
+void transformsInit(Transforms *t, uint32_t capacity) {
+	t->count = 0;
+	t->capacity = capacity;
+	t->parent = transformsAlloc(capacity, sizeof(uint32_t));
+	t->pos = transformsAlloc(capacity, sizeof(vec3));
+	t->rot = transformsAlloc(capacity, sizeof(versor));
+	t->scale = transformsAlloc(capacity, sizeof(vec3));
+	t->world = transformsAlloc(capacity, sizeof(mat4));
+	t->dirty = transformsAlloc(capacity, sizeof(uint8_t));
+	t->firstDirty = 0;
+}
+
+void transformsDestroy(Transforms *t) {
+	free(t->parent);
+	free(t->pos);
+	free(t->rot);
+	free(t->scale);
+	free(t->world);
+	free(t->dirty);
+	t->count = t->capacity = 0;
+}
+
+static void transformsMarkDirty(Transforms *t, uint32_t i) {
+	t->dirty[i] = 1;
+	if (i < t->firstDirty)
+		t->firstDirty = i;
+}
+
+uint32_t transformsAdd(Transforms *t, uint32_t parent, vec3 pos, versor rot, vec3 scale) {
+	mustCondition(t->count < t->capacity, "transforms capacity (%"PRIu32") not exceeded", t->capacity);
+	uint32_t i = t->count++;
+	mustCondition(parent == TRANSFORM_NO_PARENT || parent < i, "transform parent %"PRIu32" added before child %"PRIu32, parent, i);
+	t->parent[i] = parent;
+	glm_vec3_copy(pos, t->pos[i]);
+	glm_quat_copy(rot, t->rot[i]);
+	glm_vec3_copy(scale, t->scale[i]);
+	transformsMarkDirty(t, i);
+	return i;
+}
+
+void transformsSetPos(Transforms *t, uint32_t i, vec3 pos) {
+	glm_vec3_copy(pos, t->pos[i]);
+	transformsMarkDirty(t, i);
+}
+
+void transformsSetRot(Transforms *t, uint32_t i, versor rot) {
+	glm_quat_copy(rot, t->rot[i]);
+	transformsMarkDirty(t, i);
+}
+
+void transformsSetScale(Transforms *t, uint32_t i, vec3 scale) {
+	glm_vec3_copy(scale, t->scale[i]);
+	transformsMarkDirty(t, i);
+}
+
+uint32_t transformsUpdate(Transforms *t) {
+	uint32_t first = t->firstDirty;
+	if (first >= t->count)
+		return t->count;
+
+	mat4 local;
+	for (uint32_t i = first; i < t->count; i++) {
+		uint32_t p = t->parent[i];
+		if (p != TRANSFORM_NO_PARENT)
+			t->dirty[i] |= t->dirty[p];
+		if (!t->dirty[i])
+			continue;
+
+		// local = T * R * S
+		glm_quat_mat4(t->rot[i], local);
+		glm_vec4_scale(local[0], t->scale[i][0], local[0]);
+		glm_vec4_scale(local[1], t->scale[i][1], local[1]);
+		glm_vec4_scale(local[2], t->scale[i][2], local[2]);
+		glm_vec4(t->pos[i], 1.0f, local[3]);
+
+		if (p == TRANSFORM_NO_PARENT)
+			glm_mat4_copy(local, t->world[i]);
+		else
+			glm_mul(t->world[p], local, t->world[i]); // affine, uses the simd path
+	}
+
+	memset(t->dirty + first, 0, t->count - first);
+	t->firstDirty = t->count;
+	return first;
+}
@@ -0,0 +1,37 @@
+// transform hierarchy
+// Nodes are stored in structure-of-arrays layout and sorted topologically
+// (a parent always has a lower index than its children), so the world
+// matrices can be computed in a single forward pass.
+// requires:
+// #include <cglm/cglm.h>
+
+#define TRANSFORM_NO_PARENT UINT32_MAX
+
+typedef struct Transforms {
+	uint32_t count;
+	uint32_t capacity;
+	uint32_t *parent; // TRANSFORM_NO_PARENT for roots
+	vec3 *pos;
+	versor *rot;
+	vec3 *scale;
+	mat4 *world;
+	uint8_t *dirty; // local transform changed or parent is dirty
+	uint32_t firstDirty; // lowest dirty index, count if nothing is dirty
+} Transforms;
+
+void transformsInit(Transforms *t, uint32_t capacity);
+
+void transformsDestroy(Transforms *t);
+
+// parent must have been added before (or be TRANSFORM_NO_PARENT)
+uint32_t transformsAdd(Transforms *t, uint32_t parent, vec3 pos, versor rot, vec3 scale);
+
+void transformsSetPos(Transforms *t, uint32_t i, vec3 pos);
+
+void transformsSetRot(Transforms *t, uint32_t i, versor rot);
+
+void transformsSetScale(Transforms *t, uint32_t i, vec3 scale);
+
+// recomputes the world matrices of dirty nodes and their descendants
+// returns the lowest updated index (count if nothing was updated)
+uint32_t transformsUpdate(Transforms *t);
@@ -1,15 +1,19 @@
 // requires:
 // #include <stdlib.h>
 // #include <stdio.h>
+// #include "log.h"
 
-// macro for printing informational messages
-#define infof(fmt, args...) printf("[info] "__FILE__":%d: " fmt "\n", __LINE__, ##args)
+// macro for logging messages that are only useful when debugging
+#define debugf(fmt, args...) logWrite(LOG_DEBUG, __FILE__, __LINE__, fmt, ##args)
 
-// macro for printing errors
-#define errorf(fmt, args...) printf("[error] "__FILE__":%d: " fmt "\n", __LINE__, ##args)
+// macro for logging informational messages
+#define infof(fmt, args...) logWrite(LOG_INFO, __FILE__, __LINE__, fmt, ##args)
 
-// like errorf, but exits
-#define panicf(fmt, args...) do {errorf(fmt, ##args); exit(1);} while(0)
+// macro for logging errors
+#define errorf(fmt, args...) logWrite(LOG_ERROR, __FILE__, __LINE__, fmt, ##args)
+
+// like errorf, but writes out all logged messages and exits
+#define panicf(fmt, args...) do {errorf(fmt, ##args); logFlush(); exit(1);} while(0)
 
 // checks if the result is VK_SUCCESS and exits otherwise
 #define must(result) do { \